@@ -1,11 +1,17 @@
 #include "DataLink.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <optional>
+#include <vector>
 
 #include "SimConnect.h"
 #include "data_def/sim_vars.h"
+#include "data_def/util.h"
 #include "serial_server/serial_port.h"
+#include "sim_bridge/command_queue.h"
 #include "spdlog/spdlog.h"
 
 namespace flight_panel {
@@ -15,18 +21,26 @@ using namespace ::flight_panel::data;
 using data::SIM_START;
 using data::SIM_STOP;
 using data::SimVarDefs;
+using data::kIdentityDataSize;
+using data::kTelemetryDataSize;
+using data::SimIdentity;
 using data::SimVars;
 using ::flight_panel::serial::SerialPort;
+using ::flight_panel::sim_bridge::CommandQueue;
 
 enum DEFINITION_ID {
-  // Definition that reads all variables defined in SimVar.h
+  // Definition that reads the telemetry vars into SimVars.
   DEF_READ_ALL,
+  // Definition that reads the identity strings into SimIdentity.
+  DEF_READ_IDENTITY,
   DEF_WRITE,
 };
 
 enum REQUEST_ID {
-  // The only request we would do is to read data.
-  REQ_ID
+  // Reads telemetry every visual frame.
+  REQ_ID,
+  // Reads the identity strings when they change.
+  REQ_IDENTITY,
 };
 
 enum GROUP_ID {
@@ -34,14 +48,29 @@ enum GROUP_ID {
 };
 
 HANDLE hSimConnect = NULL;
+// Signaled by SimConnect when messages arrive.
+HANDLE hMessageEvent = NULL;
 bool quit = false;
 SimVars simVars;
+SimIdentity simIdentity;
+// Receives a copy of each frame. simVars itself is only touched by the
+// DataLink thread.
+data_dispatcher::DataDispatcher* dispatcher = nullptr;
 int varSize = 0;
-// The first position is "connected", which is not part of the data read from
-// MSFS. +1 to skip it.
-double* varStart = (double*)&simVars + 1;
+int identitySize = 0;
+// The telemetry block fills SimVars from the start. "connected" comes after
+// it and is not part of the data read from MSFS.
+void* varStart = &simVars;
 // Step
 const double kTrimStep = 0.01;
+// Longest wait for sim messages while connected, so the serial port is still
+// polled when the sim is quiet.
+const DWORD kMessageWaitMs = 10;
+
+// Hands the current frame to the dispatcher.
+void Publish() {
+  if (dispatcher) dispatcher->Notify(simVars);
+}
 
 // DispathProcRD is the callback to consume SimConnect data.using This is the
 // callback that
@@ -70,14 +99,15 @@ void MyDispatchProcRd(SIMCONNECT_RECV* pData, DWORD cbData, void* pContext) {
       switch (pObjData->dwRequestID) {
         case REQ_ID:
           // Copy data to simVars_
-          memcpy(varStart, &pObjData->dwData, varSize);
+          memcpy(varStart, &pObjData->dwData,
+                 std::min<size_t>(varSize, kTelemetryDataSize));
 #ifdef DEBUG_VARS
           if (displayDelay > 0)
             displayDelay--;
 
           else {
-            SPDLOG_INFO("Aircraft: {}   Cruise Speed: {}", simVars.aircraft,
-                        simVars.cruiseSpeed);
+            SPDLOG_INFO("Aircraft: {}   Cruise Speed: {}",
+                        simIdentity.aircraft, simVars.cruiseSpeed);
             std::cout << "Air speed: " << simVars.asiAirspeed
                       << "\tVertical speed: " << simVars.vsiVerticalSpeed
                       << "\tRPM: " << simVars.rpmEngine << std::endl
@@ -91,6 +121,12 @@ void MyDispatchProcRd(SIMCONNECT_RECV* pData, DWORD cbData, void* pContext) {
             displayDelay = 500;
           }
 #endif  // DEBUG_VARS
+          Publish();
+          break;
+        case REQ_IDENTITY:
+          memcpy(&simIdentity, &pObjData->dwData,
+                 std::min<size_t>(identitySize, kIdentityDataSize));
+          if (dispatcher) dispatcher->NotifyIdentity(simIdentity);
           break;
         default:
           SPDLOG_ERROR("Unknown request id: {}", pObjData->dwRequestID);
@@ -121,16 +157,22 @@ void AddReadDefs() {
         dataLen = 8;
       }
 
-      // Try to add data def.
-      if (SimConnect_AddToDataDefinition(hSimConnect, DEF_READ_ALL,
+      // Try to add data def. Strings go to the identity block.
+      if (SimConnect_AddToDataDefinition(hSimConnect, DEF_READ_IDENTITY,
                                          SimVarDefs[i][0], NULL,
                                          dataType) < 0) {
         SPDLOG_ERROR("Data def failed: {} (string)\n", SimVarDefs[i][0]);
       } else {
-        varSize += dataLen;
+        identitySize += dataLen;
       }
-    } else {
-      // Add double
+    }
+  }
+  // Doubles follow the SimVars layout: every FRAME var, then every SECOND
+  // var.
+  for (data::RefreshGroup group :
+       {data::RefreshGroup::FRAME, data::RefreshGroup::SECOND}) {
+    for (int i = 0; i < data::kSimVarCount; i++) {
+      if (data::kSimVarFields[i].group != group) continue;
       if (SimConnect_AddToDataDefinition(hSimConnect, DEF_READ_ALL,
                                          SimVarDefs[i][0],
                                          SimVarDefs[i][1]) < 0) {
@@ -175,13 +217,48 @@ void CleanUp() {
             SIMCONNECT_PERIOD_NEVER, 0, 0, 0, 0) < 0) {
       SPDLOG_WARN("Failed to stop requesting data.");
     }
+    if (SimConnect_RequestDataOnSimObject(
+            hSimConnect, REQ_IDENTITY, DEF_READ_IDENTITY,
+            SIMCONNECT_OBJECT_ID_USER, SIMCONNECT_PERIOD_NEVER, 0, 0, 0,
+            0) < 0) {
+      SPDLOG_WARN("Failed to stop requesting identity.");
+    }
 
     SPDLOG_INFO("Disconnecting from MS FS2020");
     SimConnect_Close(hSimConnect);
   }
 }
 
-int Run(const std::string& inputComPort) {
+void QueueCommand(CommandQueue* commands, const WriteData& command) {
+  if (!commands->Push(command).ok()) {
+    SPDLOG_WARN("Dropped command of event {}: queue is full.",
+                command.eventId);
+  }
+}
+
+// Sends the queued commands, relative ones from the latest sim vars.
+void SendCommands(CommandQueue* commands, std::vector<WriteData>* batch) {
+  commands->Drain(
+      [](EVENT_ID id, double* value) {
+        return CurrentEventValue(id, simVars, value);
+      },
+      batch);
+  for (const WriteData& command : *batch) {
+    // Negative values, e.g. of axes, are sent as signed.
+    const DWORD data =
+        static_cast<DWORD>(static_cast<int32_t>(std::lround(command.value)));
+    if (SimConnect_TransmitClientEvent(
+            hSimConnect, 0, command.eventId, data,
+            SIMCONNECT_GROUP_PRIORITY_HIGHEST,
+            SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY) != 0) {
+      SPDLOG_ERROR("Failed to transmit event: {}", command.eventId);
+    }
+  }
+}
+
+int Run(const std::string& inputComPort,
+        data_dispatcher::DataDispatcher* frameDispatcher) {
+  dispatcher = frameDispatcher;
   std::cout << "DataLink " << versionString << std::endl;
   std::cout << "Searching for local MS FS2020..." << std::endl;
 
@@ -197,54 +274,49 @@ int Run(const std::string& inputComPort) {
 
   int bytesRead = 0;
   int retryDelay = 0;
-  double newTrim = 0;
+  // Presses are sent once per loop, coalesced into one set per event.
+  CommandQueue commands;
+  std::vector<WriteData> commandBatch;
+  hMessageEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
   while (!quit) {
     if (simVars.connected) {
+      // Handles every queued message as soon as the sim signals them.
+      WaitForSingleObject(hMessageEvent, kMessageWaitMs);
       result = SimConnect_CallDispatch(hSimConnect, MyDispatchProcRd, NULL);
       if (result != 0) {
         SPDLOG_INFO("Disconnected from MS FS2020");
         simVars.connected = 0;
+        // Tells the clients the data went stale.
+        Publish();
         SPDLOG_INFO("Searching for local MS FS2020...");
       }
       if (serial && serial->isConnected()) {
-        // Handle input from serial.
-        bytesRead = serial->readSerialPort(serialInputBuf, 1);
-        if (bytesRead > 0) {
-          switch (serialInputBuf[0]) {
-            case 1:
-              // compute new trim pos(up).
-              newTrim =
-                  (int)((-simVars.tfElevatorTrimIndicator - kTrimStep) * 16383);
-              if (SimConnect_TransmitClientEvent(
-                      hSimConnect, 0, KEY_AXIS_ELEV_TRIM_SET, (DWORD)newTrim,
-                      SIMCONNECT_GROUP_PRIORITY_HIGHEST,
-                      SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY) != 0) {
-                SPDLOG_WARN("Failed to transmit event: {}\n",
-                            KEY_AXIS_ELEV_TRIM_SET);
-              } else {
-                SPDLOG_INFO("big trim up to: {}", newTrim);
-              }
-              break;
-            case 2:
-              // compute new trim pos (down).
-              newTrim =
-                  (int)((-simVars.tfElevatorTrimIndicator + kTrimStep) * 16383);
-              if (SimConnect_TransmitClientEvent(
-                      hSimConnect, 0, KEY_AXIS_ELEV_TRIM_SET, (DWORD)newTrim,
-                      SIMCONNECT_GROUP_PRIORITY_HIGHEST,
-                      SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY) != 0) {
-                SPDLOG_ERROR("Failed to transmit event: {}",
-                             KEY_AXIS_ELEV_TRIM_SET);
-              }
-              break;
+        // Handle every byte from serial, one press each.
+        while ((bytesRead = serial->readSerialPort(serialInputBuf,
+                                                   sizeof(serialInputBuf))) >
+               0) {
+          for (int i = 0; i < bytesRead; ++i) {
+            switch (serialInputBuf[i]) {
+              case 1:
+                // Trim up.
+                QueueCommand(&commands, {KEY_AXIS_ELEV_TRIM_SET,
+                                         -kTrimStep * 16383, true});
+                break;
+              case 2:
+                // Trim down.
+                QueueCommand(&commands, {KEY_AXIS_ELEV_TRIM_SET,
+                                         kTrimStep * 16383, true});
+                break;
+            }
           }
         }
       }
+      SendCommands(&commands, &commandBatch);
     } else if (retryDelay > 0) {
       retryDelay--;
     } else {
-      result =
-          SimConnect_Open(&hSimConnect, "Instrument Data Link", NULL, 0, 0, 0);
+      result = SimConnect_Open(&hSimConnect, "Instrument Data Link", NULL, 0,
+                               hMessageEvent, 0);
       if (result == 0) {
         SPDLOG_INFO("Connected to MS FS2020");
         AddReadDefs();
@@ -258,19 +330,26 @@ int Run(const std::string& inputComPort) {
                 SIMCONNECT_PERIOD_VISUAL_FRAME, 0, 0, 0, 0) < 0) {
           SPDLOG_ERROR("Failed to start requesting data");
         }
+        // The identity only arrives when one of its strings changed.
+        if (SimConnect_RequestDataOnSimObject(
+                hSimConnect, REQ_IDENTITY, DEF_READ_IDENTITY,
+                SIMCONNECT_OBJECT_ID_USER, SIMCONNECT_PERIOD_SECOND,
+                SIMCONNECT_DATA_REQUEST_FLAG_CHANGED, 0, 0, 0) < 0) {
+          SPDLOG_ERROR("Failed to start requesting identity");
+        }
       } else {
         retryDelay = 200;
       }
     }  // if connected/elif retry>0/else(retry).
 
-    Sleep(10);
+    // Connected loops wait on the message event instead.
+    if (!simVars.connected) Sleep(10);
   }
 
   CleanUp();
+  CloseHandle(hMessageEvent);
   return 0;
 }
 
-const SimVars* const Read() { return &simVars; }
-
 }  // namespace datalink
 }  // namespace flight_panel
@@ -7,11 +7,13 @@
 #include <thread>
 
 #include "data_def/sim_vars.h"
+#include "data_dispatcher/data_dispatcher.h"
 #include "SimConnect.h"
 
 namespace flight_panel {
 namespace datalink {
-int Run(const std::string& inputSerialPort);
-const data::SimVars* const Read();
+// Publishes every frame read from the sim to `dispatcher`, if set.
+int Run(const std::string& inputSerialPort,
+        data_dispatcher::DataDispatcher* dispatcher = nullptr);
 }  // namespace datalink
 }  // namespace flight_panel
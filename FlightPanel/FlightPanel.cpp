@@ -10,6 +10,7 @@
 #include "serial_server/port_finder.h"
 #include "serial_server/serial_server.h"
 #include "DataLink.h"
+#include "data_dispatcher/data_dispatcher.h"
 
 #include "websocket_server/websocket_server.h"
 #include "spdlog/spdlog.h"
@@ -51,18 +52,22 @@ int main() {
   auto ws_event_thread =
       std::thread(&ws::WebSocketServer::ProcessEvents, &wsServer);
 
-  ws::SimDataBroadcaster broadcaster(
-      std::unique_ptr<ws::WebSocketServer>(&wsServer), datalink::Read());
-  auto broadcast_thread =
-      std::thread(&ws::SimDataBroadcaster::Run, &broadcaster, 
-        absl::Milliseconds(10));
+  // Frames are pushed to the clients as the sim sends them.
+  auto dispatcher = data_dispatcher::CreateDispatcher();
+  ws::SimDataBroadcaster broadcaster(&wsServer);
+  auto status = broadcaster.Attach(dispatcher.get());
+  if (!status.ok()) {
+    SPDLOG_ERROR("Failed to attach the WebSocket broadcaster: {}",
+                 status.ToString());
+  }
+  dispatcher->Start();
 
   // Runs the datalink
-  datalink::Run(inputComPort);
+  datalink::Run(inputComPort, dispatcher.get());
+  dispatcher->Stop();
 
   serial_thread.join();
   ws_thread.join();
   ws_event_thread.join();
-  broadcast_thread.join();
   return 0;
 }
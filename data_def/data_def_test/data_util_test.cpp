@@ -15,14 +15,95 @@ TEST(DataUtilText, TestTransponderCodeConvert) {
 TEST(DataUtilText, TestToSimData) {
   // Converts the decimal value to hex string.
   SimVars input;
+  SimIdentity identity;
   spdlog::info("Test started");
   input.adiBank = 50;
-  strncpy(input.atcCallSign, "HAPPY", 5);
-  SimData output = ToSimData(input);
+  strncpy(identity.atcCallSign, "HAPPY", 5);
+  SimData output = ToSimData(input, identity);
   EXPECT_EQ(output.instruments().bank_angle(), 50);
   EXPECT_EQ(output.aircraft_info().call_sign(), "HAPPY");
   spdlog::info("Test finished");
 }
+
+TEST(DataUtilText, TestToSimDataInPlace) {
+  SimVars input;
+  SimIdentity identity;
+  input.adiBank = 50;
+  input.transponderCode = 4660;
+  strncpy(identity.atcCallSign, "HAPPY", 5);
+  SimData output;
+  ToSimData(input, identity, &output);
+  EXPECT_EQ(output.SerializeAsString(),
+            ToSimData(input, identity).SerializeAsString());
+
+  // Refilling overwrites every field of the previous frame.
+  input.adiBank = 10;
+  input.transponderCode = 0x7700;
+  strncpy(identity.atcCallSign, "SAD\0\0", 5);
+  ToSimData(input, identity, &output);
+  EXPECT_EQ(output.instruments().bank_angle(), 10);
+  EXPECT_EQ(output.avionics().transponder_code(), "7700");
+  EXPECT_EQ(output.aircraft_info().call_sign(), "SAD");
+}
+
+TEST(DataUtilText, TestEveryVarHasField) {
+  int var_count = 0;
+  while (SimVarDefs[var_count][0] != NULL) ++var_count;
+  EXPECT_EQ(kSimVarCount, var_count);
+  EXPECT_LE(var_count, kMaxSimVars);
+}
+
+TEST(DataUtilText, TestFieldTableMatchesSimVarDefs) {
+  for (int i = 0; i < kSimVarCount; ++i) {
+    EXPECT_STREQ(kSimVarFields[i].name, SimVarDefs[i][0]);
+    EXPECT_STREQ(kSimVarFields[i].unit, SimVarDefs[i][1]);
+  }
+  EXPECT_EQ(SimVarDefs[kSimVarCount][0], nullptr);
+  EXPECT_EQ(kSimVarFields[3].offset, offsetof(SimVars, adiBank));
+  EXPECT_EQ(std::string(kSimVarFields[kSimVarCount - 1].unit), "string256");
+  EXPECT_EQ(kSimVarFields[kSimVarCount - 1].offset,
+            offsetof(SimIdentity, aircraft));
+  // The FRAME vars come first, the SECOND vars after them. atcHeavy is the
+  // last SECOND var and comes after the strings in the list.
+  EXPECT_EQ(offsetof(SimVars, altAltitude), 0u);
+  EXPECT_LT(offsetof(SimVars, adiBank), offsetof(SimVars, tfFlapsCount));
+  EXPECT_EQ(kTelemetryDataSize, offsetof(SimVars, atcHeavy) + sizeof(double));
+  EXPECT_EQ(kTelemetryDataSize, offsetof(SimVars, connected));
+  EXPECT_EQ(kIdentityDataSize, 64 + 64 + 8 + 256);
+  EXPECT_EQ(alignof(SimVars), kCacheLineSize);
+}
+
+TEST(DataUtilText, TestCurrentEventValue) {
+  SimVars vars = {};
+  vars.autopilotHeading = 270;
+  vars.tfElevatorTrimIndicator = 0.5;
+  double value;
+  ASSERT_TRUE(CurrentEventValue(KEY_HEADING_BUG_SET, vars, &value));
+  EXPECT_EQ(value, 270);
+  ASSERT_TRUE(CurrentEventValue(KEY_AXIS_ELEV_TRIM_SET, vars, &value));
+  EXPECT_EQ(value, -0.5 * 16383);
+  // Events that do not set a value have none.
+  EXPECT_FALSE(CurrentEventValue(KEY_AP_MASTER, vars, &value));
+}
+
+TEST(DataUtilText, TestClampEventValue) {
+  EXPECT_EQ(ClampEventValue(KEY_AXIS_ELEV_TRIM_SET, -20000), -16383);
+  EXPECT_EQ(ClampEventValue(KEY_AXIS_ELEV_TRIM_SET, 20000), 16383);
+  EXPECT_EQ(ClampEventValue(KEY_AXIS_ELEV_TRIM_SET, -100), -100);
+  // Events without a known range are left alone.
+  EXPECT_EQ(ClampEventValue(KEY_AP_ALT_VAR_SET_ENGLISH, 50000), 50000);
+}
+
+TEST(DataUtilText, TestHeadingEventsWrap) {
+  for (EVENT_ID id : {KEY_VOR1_SET, KEY_VOR2_SET, KEY_HEADING_BUG_SET}) {
+    EXPECT_EQ(ClampEventValue(id, -1), 359) << id;
+    EXPECT_EQ(ClampEventValue(id, 360), 0) << id;
+    EXPECT_EQ(ClampEventValue(id, 361), 1) << id;
+    EXPECT_EQ(ClampEventValue(id, -725), 355) << id;
+    EXPECT_EQ(ClampEventValue(id, 0), 0) << id;
+    EXPECT_EQ(ClampEventValue(id, 180), 180) << id;
+  }
+}
 }  // namespace
 }  // namespace data
 }  // namespace flight_panel
\ No newline at end of file
@@ -0,0 +1,186 @@
+#pragma once
+
+// The sim vars read from SimConnect, in the order of the SimConnect data
+// block. This list is the only place a var is declared: the SimVars struct,
+// SimVarDefs, kSimVarFields and the SimData conversion in ToSimData are all
+// generated from it.
+//
+// Each entry is one of
+//   NUMBER(member, default value, sim var name, unit, refresh group,
+//          threshold absolute, threshold relative, proto message, proto field)
+//   STRING(member, length, sim var name,
+//          threshold absolute, threshold relative, proto message, proto field)
+// The refresh group is a RefreshGroup: FRAME for the instruments that move
+// every frame, SECOND for slow gauges, clocks and radio settings. Strings are
+// always in the IDENTITY group. The thresholds are a ChangeThreshold. The
+// proto message names one of the messages in util.cpp, `none, none` leaves
+// the var out of SimData.
+//
+// Keep the comments in /* */ style, a // comment would swallow the rest of
+// the macro.
+#define FLIGHT_PANEL_SIM_VARS(NUMBER, STRING)                                 \
+  NUMBER(altAltitude, 0, "Indicated Altitude", "feet",                        \
+         FRAME, 1, 0, instruments, indicated_altitude)                        \
+  NUMBER(altKollsman, 29.92, "Kohlsman Setting Hg", "inHg",                   \
+         FRAME, 0.005, 0, instruments, kohlsman_setting_hg)                   \
+  NUMBER(adiPitch, 0, "Attitude Indicator Pitch Degrees", "degrees",          \
+         FRAME, 0.05, 0, instruments, pitch_angle)                            \
+  NUMBER(adiBank, 0, "Attitude Indicator Bank Degrees", "degrees",            \
+         FRAME, 0.05, 0, instruments, bank_angle)                             \
+  NUMBER(asiAirspeed, 0, "Airspeed Indicated", "knots",                       \
+         FRAME, 0.1, 0, instruments, indicated_airspeed)                      \
+  NUMBER(asiMachSpeed, 0, "Airspeed Mach", "mach",                            \
+         FRAME, 0.001, 0, none, none)                                         \
+  NUMBER(asiAirspeedCal, -14, "Airspeed True Calibrate", "degrees",           \
+         FRAME, 0.1, 0, none, none)                                           \
+  NUMBER(hiHeading, 0, "Heading Indicator", "degrees",                        \
+         FRAME, 0.05, 0, instruments, heading_indicator_deg)                  \
+  NUMBER(vsiVerticalSpeed, 0, "Vertical Speed", "feet per second",            \
+         FRAME, 0.05, 0, instruments, vertical_speed)                         \
+  NUMBER(tcRate, 0, "Turn Indicator Rate", "radians per second",              \
+         FRAME, 0.0005, 0, instruments, turn_indicator_rate)                  \
+  NUMBER(tcBall, 0, "Turn Coordinator Ball", "position",                      \
+         FRAME, 0.005, 0, instruments, turn_coordinator_ball)                 \
+  NUMBER(tfElevatorTrim, 0, "Elevator Trim Position", "radian",               \
+         FRAME, 0.0005, 0, none, none)                                        \
+  /* value from -1.0(nose down) ~ 1.0 (nose up) */                            \
+  NUMBER(tfElevatorTrimIndicator, 0, "ELEVATOR TRIM INDICATOR", "position",   \
+         FRAME, 0.001, 0, aircraft_controls, elevator_trim_indicator)         \
+  /* Max flap index value. 0-index. */                                        \
+  NUMBER(tfFlapsCount, 1, "Flaps Num Handle Positions", "number",             \
+         SECOND, 0, 0, aircraft_controls, flaps_count)                        \
+  /* Flap position index. 0-count. */                                         \
+  NUMBER(tfFlapsIndex, 0, "Flaps Handle Index", "number",                     \
+         FRAME, 0, 0, aircraft_controls, flaps_pos)                           \
+  NUMBER(dcUtcSeconds, 43200, "Zulu Time", "seconds",                         \
+         SECOND, 1, 0, none, none)                                            \
+  NUMBER(dcLocalSeconds, 46800, "Local Time", "seconds",                      \
+         SECOND, 1, 0, none, none)                                            \
+  NUMBER(dcFlightSeconds, 0, "Absolute Time", "seconds",                      \
+         SECOND, 1, 0, none, none)                                            \
+  NUMBER(dcVolts, 23.7, "Electrical Battery Bus Voltage", "volts",            \
+         SECOND, 0.05, 0, none, none)                                         \
+  NUMBER(dcTempC, 26.2, "Ambient Temperature", "celsius",                     \
+         SECOND, 0.1, 0, none, none)                                          \
+  NUMBER(rpmEngine, 0, "General Eng Rpm:1", "rpm",                            \
+         FRAME, 5, 0, engine_data, rpm)                                       \
+  NUMBER(rpmPercent, 0, "Eng Rpm Animation Percent:1", "percent",             \
+         FRAME, 0.1, 0, engine_data, rpm_percent)                             \
+  NUMBER(rpmElapsedTime, 0, "General Eng Elapsed Time:1", "hours",            \
+         SECOND, 0.01, 0, engine_data, engine_elapsed_time)                   \
+  NUMBER(fuelLeft, 0, "Fuel Tank Left Main Level", "percent",                 \
+         SECOND, 0.1, 0, engine_data, fuel_left_level)                        \
+  NUMBER(fuelRight, 0, "Fuel Tank Right Main Level", "percent",               \
+         SECOND, 0.1, 0, engine_data, fuel_right_level)                       \
+  NUMBER(vor1Obs, 0, "Nav Obs:1", "degrees",                                  \
+         FRAME, 0.1, 0, none, none)                                           \
+  NUMBER(vor1RadialError, 0, "Nav Radial Error:1", "degrees",                 \
+         FRAME, 0.05, 0, none, none)                                          \
+  NUMBER(vor1GlideSlopeError, 0, "Nav Glide Slope Error:1", "degrees",        \
+         FRAME, 0.05, 0, none, none)                                          \
+  NUMBER(vor1ToFrom, 0, "Nav ToFrom:1", "enum",                               \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(vor1GlideSlopeFlag, 0, "Nav Gs Flag:1", "bool",                      \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(vor2Obs, 0, "Nav Obs:2", "degrees",                                  \
+         FRAME, 0.1, 0, none, none)                                           \
+  NUMBER(vor2RadialError, 0, "Nav Radial Error:2", "degrees",                 \
+         FRAME, 0.05, 0, none, none)                                          \
+  NUMBER(vor2ToFrom, 0, "Nav ToFrom:2", "enum",                               \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(adfRadial, 0, "Adf Radial:1", "degrees",                             \
+         FRAME, 0.1, 0, none, none)                                           \
+  NUMBER(adfCard, 0, "Adf Card", "degrees",                                   \
+         FRAME, 0.1, 0, none, none)                                           \
+  NUMBER(com1Freq, 119.225, "Com Active Frequency:1", "mhz",                  \
+         SECOND, 0, 0, com_radio_1, active_freq)                              \
+  NUMBER(com1Standby, 124.850, "Com Standby Frequency:1", "mhz",              \
+         SECOND, 0, 0, com_radio_1, standby_freq)                             \
+  NUMBER(nav1Freq, 110.50, "Nav Active Frequency:1", "mhz",                   \
+         SECOND, 0, 0, nav_radio_1, active_freq)                              \
+  NUMBER(nav1Standby, 113.90, "Nav Standby Frequency:1", "mhz",               \
+         SECOND, 0, 0, nav_radio_1, standby_freq)                             \
+  NUMBER(com2Freq, 124.850, "Com Active Frequency:2", "mhz",                  \
+         SECOND, 0, 0, com_radio_2, active_freq)                              \
+  NUMBER(com2Standby, 124.850, "Com Standby Frequency:2", "mhz",              \
+         SECOND, 0, 0, com_radio_2, standby_freq)                             \
+  NUMBER(nav2Freq, 110.50, "Nav Active Frequency:2", "mhz",                   \
+         SECOND, 0, 0, nav_radio_2, active_freq)                              \
+  NUMBER(nav2Standby, 113.90, "Nav Standby Frequency:2", "mhz",               \
+         SECOND, 0, 0, nav_radio_2, standby_freq)                             \
+  NUMBER(adfFreq, 394, "Adf Active Frequency:1", "khz",                       \
+         SECOND, 0, 0, none, none)                                            \
+  NUMBER(adfStandby, 368, "Adf Standby Frequency:1", "khz",                   \
+         SECOND, 0, 0, none, none)                                            \
+  /* BCO16 encoding. The double value is an integer. Lower 16 bits            \
+     encodes the numbers. mask = 0xf; digit3 = int(val)>>12 & mask;           \
+     ToSimData decodes it into avionics.transponder_code. */                  \
+  NUMBER(transponderCode, 4608, "Transponder Code:1", "bco16",                \
+         SECOND, 0, 0, none, none)                                            \
+  NUMBER(autopilotAvailable, 1, "Autopilot Available", "bool",                \
+         SECOND, 0, 0, none, none)                                            \
+  NUMBER(autopilotEngaged, 0, "Autopilot Master", "bool",                     \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotHeading, 0, "Autopilot Heading Lock Dir", "degrees",        \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotHeadingLock, 0, "Autopilot Heading Lock", "bool",           \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotLevel, 0, "Autopilot Wing Leveler", "bool",                 \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotAltitude, 0, "Autopilot Altitude Lock Var", "feet",         \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotAltLock, 0, "Autopilot Altitude Lock", "bool",              \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotPitchHold, 0, "Autopilot Pitch Hold", "bool",               \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotVerticalSpeed, 0, "Autopilot Vertical Hold Var",            \
+         "feet/minute",                                                       \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotVerticalHold, 0, "Autopilot Vertical Hold", "bool",         \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotAirspeed, 0, "Autopilot Airspeed Hold Var", "knots",        \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotMach, 0, "Autopilot Mach Hold Var", "number",               \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(autopilotAirspeedHold, 0, "Autopilot Airspeed Hold", "bool",         \
+         FRAME, 0, 0, none, none)                                             \
+  NUMBER(gearRetractable, 1, "Is Gear Retractable", "bool",                   \
+         SECOND, 0, 0, none, none)                                            \
+  /* Landing gear position. Enum. 0: unknown. 1:up, 2:down.  (from            \
+     documentation) However, the actual value read from sim is float 0~1. */  \
+  NUMBER(gearPosition, 0, "Gear Position", "enum",                            \
+         FRAME, 0.001, 0, aircraft_controls, gear_pos)                        \
+  NUMBER(gearLeftPos, 100, "Gear Left Position", "percent",                   \
+         FRAME, 0.1, 0, none, none)                                           \
+  NUMBER(gearCentrePos, 100, "Gear Center Position", "percent",               \
+         FRAME, 0.1, 0, none, none)                                           \
+  NUMBER(gearRightPos, 100, "Gear Right Position", "percent",                 \
+         FRAME, 0.1, 0, none, none)                                           \
+  NUMBER(parkingBrakeOn, 1, "Brake Parking Position", "bool",                 \
+         FRAME, 0, 0, aircraft_controls, parking_brake_on)                    \
+  NUMBER(cruiseSpeed, 120, "Estimated Cruise Speed", "knots",                 \
+         SECOND, 0, 0, none, none)                                            \
+  NUMBER(oilTemp, 75, "General Eng Oil Temperature:1", "fahrenheit",          \
+         SECOND, 0.1, 0, none, none)                                          \
+  NUMBER(oilPress, 0, "General Eng Oil Pressure:1", "psi",                    \
+         SECOND, 0.1, 0, none, none)                                          \
+  NUMBER(exhaustGasTemp, 0, "General Eng Exhaust Gas Temperature:1",          \
+         "celsius",                                                           \
+         FRAME, 0, 0.001, none, none)                                         \
+  NUMBER(exhaustGasTempGES, 0, "Eng Exhaust Gas Temperature GES:1",           \
+         "percent scaler 16k",                                                \
+         FRAME, 0, 0.001, none, none)                                         \
+  NUMBER(engineFuelFlow, 0, "Eng Fuel Flow GPH:1", "gallon per hour",         \
+         FRAME, 0, 0.001, none, none)                                         \
+  NUMBER(suctionPressure, 0, "Suction Pressure", "inch of mercury",           \
+         FRAME, 0.01, 0, none, none)                                          \
+  STRING(atcTailNumber, 64, "Atc Id",                                         \
+         0, 0, none, none)                                                    \
+  STRING(atcCallSign, 64, "Atc Airline",                                      \
+         0, 0, aircraft_info, call_sign)                                      \
+  STRING(atcFlightNumber, 8, "Atc Flight Number",                             \
+         0, 0, none, none)                                                    \
+  NUMBER(atcHeavy, 0, "Atc Heavy", "bool",                                    \
+         SECOND, 0, 0, none, none)                                            \
+  STRING(aircraft, 256, "Title",                                              \
+         0, 0, aircraft_info, model)
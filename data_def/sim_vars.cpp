@@ -6,83 +6,11 @@ namespace data {
 const char* versionString = "v1.3.0";
 
 const char* SimVarDefs[][2] = {
-    {"Indicated Altitude", "feet"},
-    {"Kohlsman Setting Hg", "inHg"},
-    {"Attitude Indicator Pitch Degrees", "degrees"},
-    {"Attitude Indicator Bank Degrees", "degrees"},
-    {"Airspeed Indicated", "knots"},
-    {"Airspeed Mach", "mach"},
-    {"Airspeed True Calibrate", "degrees"},
-    {"Heading Indicator", "degrees"},
-    {"Vertical Speed", "feet per second"},
-    {"Turn Indicator Rate", "radians per second"},
-    {"Turn Coordinator Ball", "position"},
-    {"Elevator Trim Position", "radian"},
-    {"ELEVATOR TRIM INDICATOR", "position"},
-    {"Flaps Num Handle Positions", "number"},
-    {"Flaps Handle Index", "number"},
-    {"Zulu Time", "seconds"},
-    {"Local Time", "seconds"},
-    {"Absolute Time", "seconds"},
-    {"Electrical Battery Bus Voltage", "volts"},
-    {"Ambient Temperature", "celsius"},
-    {"General Eng Rpm:1", "rpm"},
-    {"Eng Rpm Animation Percent:1", "percent"},
-    {"General Eng Elapsed Time:1", "hours"},
-    {"Fuel Tank Left Main Level", "percent"},
-    {"Fuel Tank Right Main Level", "percent"},
-    {"Nav Obs:1", "degrees"},
-    {"Nav Radial Error:1", "degrees"},
-    {"Nav Glide Slope Error:1", "degrees"},
-    {"Nav ToFrom:1", "enum"},
-    {"Nav Gs Flag:1", "bool"},
-    {"Nav Obs:2", "degrees"},
-    {"Nav Radial Error:2", "degrees"},
-    {"Nav ToFrom:2", "enum"},
-    {"Adf Radial:1", "degrees"},
-    {"Adf Card", "degrees"},
-    {"Com Active Frequency:1", "mhz"},
-    {"Com Standby Frequency:1", "mhz"},
-    {"Nav Active Frequency:1", "mhz"},
-    {"Nav Standby Frequency:1", "mhz"},
-    {"Com Active Frequency:2", "mhz"},
-    {"Com Standby Frequency:2", "mhz"},
-    {"Nav Active Frequency:2", "mhz"},
-    {"Nav Standby Frequency:2", "mhz"},
-    {"Adf Active Frequency:1", "khz"},
-    {"Adf Standby Frequency:1", "khz"},
-    {"Transponder Code:1", "bco16"},
-    {"Autopilot Available", "bool"},
-    {"Autopilot Master", "bool"},
-    {"Autopilot Heading Lock Dir", "degrees"},
-    {"Autopilot Heading Lock", "bool"},
-    {"Autopilot Wing Leveler", "bool"},
-    {"Autopilot Altitude Lock Var", "feet"},
-    {"Autopilot Altitude Lock", "bool"},
-    {"Autopilot Pitch Hold", "bool"},
-    {"Autopilot Vertical Hold Var", "feet/minute"},
-    {"Autopilot Vertical Hold", "bool"},
-    {"Autopilot Airspeed Hold Var", "knots"},
-    {"Autopilot Mach Hold Var", "number"},
-    {"Autopilot Airspeed Hold", "bool"},
-    {"Is Gear Retractable", "bool"},
-    {"Gear Position", "enum"},
-    {"Gear Left Position", "percent"},
-    {"Gear Center Position", "percent"},
-    {"Gear Right Position", "percent"},
-    {"Brake Parking Position", "bool"},
-    {"Estimated Cruise Speed", "knots"},
-    {"General Eng Oil Temperature:1", "fahrenheit"},
-    {"General Eng Oil Pressure:1", "psi"},
-    {"General Eng Exhaust Gas Temperature:1", "celsius"},
-    {"Eng Exhaust Gas Temperature GES:1", "percent scaler 16k"},
-    {"Eng Fuel Flow GPH:1", "gallon per hour"},
-    {"Suction Pressure", "inch of mercury"},
-    {"Atc Id", "string64"},
-    {"Atc Airline", "string64"},
-    {"Atc Flight Number", "string8"},
-    {"Atc Heavy", "bool"},
-    {"Title", "string256"},
+#define FP_SIM_VAR_NUMBER(member, default_value, name, unit, ...) {name, unit},
+#define FP_SIM_VAR_STRING(member, length, name, ...) {name, "string" #length},
+    FLIGHT_PANEL_SIM_VARS(FP_SIM_VAR_NUMBER, FP_SIM_VAR_STRING)
+#undef FP_SIM_VAR_NUMBER
+#undef FP_SIM_VAR_STRING
     {NULL, NULL}};
 
 WriteEvent WriteEvents[] = {
@@ -1,98 +1,54 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdio.h>
+
+#include <bitset>
+
+#include "data_def/sim_var_list.h"
+
 namespace flight_panel {
 namespace data {
 
-struct SimVars {
-  double altAltitude = 0;
-  double altKollsman = 29.92;
-  double adiPitch = 0;
-  double adiBank = 0;
-  double asiAirspeed = 0;
-  double asiMachSpeed = 0;
-  double asiAirspeedCal = -14;
-  double hiHeading = 0;
-  double vsiVerticalSpeed = 0;
-  double tcRate = 0;
-  double tcBall = 0;
-  double tfElevatorTrim = 0;
-  // value from -1.0(nose down) ~ 1.0 (nose up)
-  double tfElevatorTrimIndicator = 0;
-  // Max flap index value. 0-index.
-  double tfFlapsCount = 1;
-  // Flap position index. 0-count.
-  double tfFlapsIndex = 0;
-  double dcUtcSeconds = 43200;
-  double dcLocalSeconds = 46800;
-  double dcFlightSeconds = 0;
-  double dcVolts = 23.7;
-  double dcTempC = 26.2;
-  double rpmEngine = 0;
-  double rpmPercent = 0;
-  double rpmElapsedTime = 0;
-  double fuelLeft = 0;
-  double fuelRight = 0;
-  double vor1Obs = 0;
-  double vor1RadialError = 0;
-  double vor1GlideSlopeError = 0;
-  double vor1ToFrom = 0;
-  double vor1GlideSlopeFlag = 0;
-  double vor2Obs = 0;
-  double vor2RadialError = 0;
-  double vor2ToFrom = 0;
-  double adfRadial = 0;
-  double adfCard = 0;
-  double com1Freq = 119.225;
-  double com1Standby = 124.850;
-  double nav1Freq = 110.50;
-  double nav1Standby = 113.90;
-  double com2Freq = 124.850;
-  double com2Standby = 124.850;
-  double nav2Freq = 110.50;
-  double nav2Standby = 113.90;
-  double adfFreq = 394;
-  double adfStandby = 368;
-  // BCO16 encoding. The double value is an integer. Lower 16 bits encodes the
-  // numbers. mask = 0xf; digit3 = int(val)>>12 & mask;
-  double transponderCode = 4608;
-  double autopilotAvailable = 1;
-  double autopilotEngaged = 0;
-  double autopilotHeading = 0;
-  double autopilotHeadingLock = 0;
-  double autopilotLevel = 0;
-  double autopilotAltitude = 0;
-  double autopilotAltLock = 0;
-  double autopilotPitchHold = 0;
-  double autopilotVerticalSpeed = 0;
-  double autopilotVerticalHold = 0;
-  double autopilotAirspeed = 0;
-  double autopilotMach = 0;
-  double autopilotAirspeedHold = 0;
-  double gearRetractable = 1;
-  // Landing gear position.
-  // Enum. 0: unknown. 1:up, 2:down.  (from documentation)
-  // However, the actual value read from sim is float 0~1.
-  double gearPosition = 0;
-  double gearLeftPos = 100;
-  double gearCentrePos = 100;
-  double gearRightPos = 100;
-  double parkingBrakeOn = 1;
-  double cruiseSpeed = 120;
-  double oilTemp = 75;
-  double oilPress = 0;
-  double exhaustGasTemp = 0;
-  double exhaustGasTempGES = 0;
-  double engineFuelFlow = 0;
-  double suctionPressure = 0;
-  char atcTailNumber[64] = "\0";
-  char atcCallSign[64] = "\0";
-  char atcFlightNumber[8] = "\0";
-  double atcHeavy = 0;
-  char aircraft[256] = "\0";
+// Size of a cache line on the CPUs the app runs on.
+constexpr size_t kCacheLineSize = 64;
+
+// The hot part of a frame: every numeric var. The doubles start on a cache
+// line, so a frame touches as few lines as possible when it is copied through
+// the reader, the dispatcher queue and the conversion. The FRAME group comes
+// first and the SECOND group after it, each in FLIGHT_PANEL_SIM_VARS order,
+// so the data block of either group is one contiguous copy.
+struct alignas(kCacheLineSize) SimVars {
+#define FP_SIM_VAR_NUMBER(member, default_value, name, unit, group, ...) \
+  FP_SIM_VAR_##group(double member = default_value;)
+#define FP_SIM_VAR_STRING(...)
+#define FP_SIM_VAR_FRAME(declaration) declaration
+#define FP_SIM_VAR_SECOND(declaration)
+  FLIGHT_PANEL_SIM_VARS(FP_SIM_VAR_NUMBER, FP_SIM_VAR_STRING)
+#undef FP_SIM_VAR_FRAME
+#undef FP_SIM_VAR_SECOND
+#define FP_SIM_VAR_FRAME(declaration)
+#define FP_SIM_VAR_SECOND(declaration) declaration
+  FLIGHT_PANEL_SIM_VARS(FP_SIM_VAR_NUMBER, FP_SIM_VAR_STRING)
+#undef FP_SIM_VAR_FRAME
+#undef FP_SIM_VAR_SECOND
+#undef FP_SIM_VAR_NUMBER
+#undef FP_SIM_VAR_STRING
+  // Not read from SimConnect. 1 while the app is connected to the sim.
   double connected = 0;
 };
 
+// The cold part of a frame: the identity strings of the aircraft. They are
+// requested separately and rarely change, so they are only published when
+// they do.
+struct SimIdentity {
+#define FP_SIM_VAR_NUMBER(...)
+#define FP_SIM_VAR_STRING(member, length, ...) char member[length] = "\0";
+  FLIGHT_PANEL_SIM_VARS(FP_SIM_VAR_NUMBER, FP_SIM_VAR_STRING)
+#undef FP_SIM_VAR_NUMBER
+#undef FP_SIM_VAR_STRING
+};
+
 enum EVENT_ID {
   SIM_START,
   SIM_STOP,
@@ -142,9 +98,99 @@ struct WriteEvent {
 struct WriteData {
   EVENT_ID eventId;
   double value;
+  // Whether value is added to the current setting instead of replacing it.
+  // Only for *_SET events, see CurrentEventValue().
+  bool relative = false;
+};
+
+// Smallest change of a sim var that is worth publishing. A number changed if
+// |new - old| > max(absolute, relative * max(|new|, |old|)). Strings change on
+// any difference, their threshold is ignored. Settings like radio
+// frequencies, autopilot targets and switches publish on any change, noisy
+// analog gauges only when the needle moves visibly.
+struct ChangeThreshold {
+  double absolute;
+  double relative;
 };
 
+// How often a var is read from SimConnect. Each group is its own SimConnect
+// data definition and request, see DataReader.
+enum class RefreshGroup {
+  // Instruments that move every visual frame.
+  FRAME,
+  // Slow gauges, clocks and radio settings, read once a second.
+  SECOND,
+  // The SimIdentity strings, read when they change.
+  IDENTITY,
+};
+constexpr int kRefreshGroupCount = 3;
+
+// Upper bound of the number of entries in SimVarDefs.
+constexpr int kMaxSimVars = 128;
+// One bit per SimVarDefs entry, set when the var changed.
+using DirtyMask = std::bitset<kMaxSimVars>;
+
+// A var of FLIGHT_PANEL_SIM_VARS and where it lives: numbers in SimVars,
+// strings in SimIdentity.
+struct SimVarField {
+  const char* name;
+  // The SimConnect unit, "string<length>" for strings.
+  const char* unit;
+  // Offset in SimVars, or in SimIdentity for strings.
+  size_t offset;
+  size_t size;
+  bool is_string;
+  RefreshGroup group;
+  ChangeThreshold threshold;
+};
+
+// Every SimConnect var, in SimVarDefs order.
+constexpr SimVarField kSimVarFields[] = {
+#define FP_SIM_VAR_NUMBER(member, default_value, name, unit, group,      \
+                          absolute, relative, ...)                       \
+  {name, unit, offsetof(SimVars, member), sizeof(double), false,         \
+   RefreshGroup::group, {absolute, relative}},
+#define FP_SIM_VAR_STRING(member, length, name, absolute, relative, ...) \
+  {name, "string" #length, offsetof(SimIdentity, member), length, true,  \
+   RefreshGroup::IDENTITY, {absolute, relative}},
+    FLIGHT_PANEL_SIM_VARS(FP_SIM_VAR_NUMBER, FP_SIM_VAR_STRING)
+#undef FP_SIM_VAR_NUMBER
+#undef FP_SIM_VAR_STRING
+};
+constexpr int kSimVarCount = sizeof(kSimVarFields) / sizeof(kSimVarFields[0]);
+// Size of the telemetry data block, the part of SimVars before `connected`.
+constexpr size_t kTelemetryDataSize = offsetof(SimVars, connected);
+constexpr int kTelemetryVarCount = kTelemetryDataSize / sizeof(double);
+// Size of the identity data block.
+constexpr size_t kIdentityDataSize = sizeof(SimIdentity);
+
+// Whether the vars of each RefreshGroup are packed in list order, the way
+// SimConnect lays out their data blocks: FRAME then SECOND in SimVars, and
+// IDENTITY in SimIdentity. DataReader copies each block in one piece.
+constexpr bool SimVarsMatchDataBlocks() {
+  size_t frame_size = 0;
+  for (const SimVarField& field : kSimVarFields) {
+    if (field.group == RefreshGroup::FRAME) frame_size += field.size;
+  }
+  size_t offsets[kRefreshGroupCount] = {0, frame_size, 0};
+  for (const SimVarField& field : kSimVarFields) {
+    size_t& offset = offsets[static_cast<int>(field.group)];
+    if (field.offset != offset) return false;
+    offset += field.size;
+  }
+  return offsets[static_cast<int>(RefreshGroup::FRAME)] == frame_size &&
+         offsets[static_cast<int>(RefreshGroup::SECOND)] ==
+             kTelemetryDataSize &&
+         offsets[static_cast<int>(RefreshGroup::IDENTITY)] ==
+             kIdentityDataSize;
+}
+static_assert(SimVarsMatchDataBlocks(),
+              "SimVars or SimIdentity do not match the SimConnect data "
+              "blocks.");
+static_assert(kSimVarCount <= kMaxSimVars, "Raise kMaxSimVars.");
+
 extern const char* versionString;
+// {name, unit} of every var, terminated by {NULL, NULL}.
 extern const char* SimVarDefs[][2];
 extern WriteEvent WriteEvents[];
 }  // namespace data
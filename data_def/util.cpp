@@ -1,6 +1,11 @@
 #include "util.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 #include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
 
 namespace flight_panel {
 namespace data {
@@ -12,60 +17,138 @@ std::string DecodeTransponder(double value) {
   return absl::StrFormat("%X", int(value));
 }
 
-SimData ToSimData(const SimVars& src) {
+namespace {
+
+// Axis events run from -kAxisMax to kAxisMax.
+constexpr double kAxisMax = 16383;
+// Heading events take degrees in [0, kFullCircle).
+constexpr double kFullCircle = 360;
+
+// The string in a fixed size char field of SimVars, up to the first NUL.
+template <size_t N>
+absl::string_view CharArrayView(const char (&field)[N]) {
+  return absl::string_view(field, strnlen(field, N));
+}
+
+// The SimData messages FLIGHT_PANEL_SIM_VARS maps vars to, by name.
+namespace proto_message {
+
+// Takes the vars that are not sent to clients.
+struct None {
+  void set_none(double) {}
+  std::string* mutable_none() { return nullptr; }
+};
+
+None* none(SimData*) {
+  static None none;
+  return &none;
+}
+Instrument* instruments(SimData* data) { return data->mutable_instruments(); }
+AircraftControls* aircraft_controls(SimData* data) {
+  return data->mutable_aircraft_controls();
+}
+AircraftInfo* aircraft_info(SimData* data) {
+  return data->mutable_aircraft_info();
+}
+EngineData* engine_data(SimData* data) { return data->mutable_engine_data(); }
+auto com_radio_1(SimData* data)
+    -> decltype(data->mutable_avionics()->mutable_com_radio_1()) {
+  return data->mutable_avionics()->mutable_com_radio_1();
+}
+auto com_radio_2(SimData* data)
+    -> decltype(data->mutable_avionics()->mutable_com_radio_2()) {
+  return data->mutable_avionics()->mutable_com_radio_2();
+}
+auto nav_radio_1(SimData* data)
+    -> decltype(data->mutable_avionics()->mutable_nav_radio_1()) {
+  return data->mutable_avionics()->mutable_nav_radio_1();
+}
+auto nav_radio_2(SimData* data)
+    -> decltype(data->mutable_avionics()->mutable_nav_radio_2()) {
+  return data->mutable_avionics()->mutable_nav_radio_2();
+}
+
+}  // namespace proto_message
+
+// Assigning keeps the capacity of `dst`, so this only allocates when the new
+// value is longer than any value `dst` held before. Does nothing for a null
+// `dst`.
+void AssignIfChanged(absl::string_view value, std::string* dst) {
+  if (dst != nullptr && *dst != value) dst->assign(value.data(), value.size());
+}
+
+}  // namespace
+
+void ToSimData(const SimVars& src, const SimIdentity& identity,
+               SimData* data) {
+#define FP_SIM_VAR_NUMBER(member, default_value, name, unit, group, \
+                          absolute, relative, message, field)       \
+  proto_message::message(data)->set_##field(src.member);
+#define FP_SIM_VAR_STRING(member, length, name, absolute, relative, message, \
+                          field)                                               \
+  AssignIfChanged(CharArrayView(identity.member),                              \
+                  proto_message::message(data)->mutable_##field());
+  FLIGHT_PANEL_SIM_VARS(FP_SIM_VAR_NUMBER, FP_SIM_VAR_STRING)
+#undef FP_SIM_VAR_NUMBER
+#undef FP_SIM_VAR_STRING
+
+  // Vars that need more than a copy.
+  char transponder[16];
+  const int length = absl::SNPrintF(transponder, sizeof(transponder), "%X",
+                                    int(src.transponderCode));
+  AssignIfChanged(absl::string_view(transponder, length),
+                  data->mutable_avionics()->mutable_transponder_code());
+  data->mutable_game_data()->set_connected(src.connected);
+}
+
+SimData ToSimData(const SimVars& src, const SimIdentity& identity) {
   SimData data;
-  // Instrument vars
-  Instrument* instruments = data.mutable_instruments();
-  instruments->set_indicated_airspeed(src.asiAirspeed);
-  instruments->set_bank_angle(src.adiBank);
-  instruments->set_pitch_angle(src.adiPitch);
-  instruments->set_kohlsman_setting_hg(src.altKollsman);
-  instruments->set_indicated_altitude(src.altAltitude);
-  instruments->set_heading_indicator_deg(src.hiHeading);
-  instruments->set_vertical_speed(src.vsiVerticalSpeed);
-  instruments->set_turn_indicator_rate(src.tcRate);
-  instruments->set_turn_coordinator_ball(src.tcBall);
-
-  // Radio data
-  Avionics* avionics = data.mutable_avionics();
-  avionics->mutable_com_radio_1()->set_active_freq(src.com1Freq);
-  avionics->mutable_com_radio_1()->set_standby_freq(src.com1Standby);
-  avionics->mutable_com_radio_2()->set_active_freq(src.com2Freq);
-  avionics->mutable_com_radio_2()->set_standby_freq(src.com2Standby);
-  avionics->mutable_nav_radio_1()->set_active_freq(src.nav1Freq);
-  avionics->mutable_nav_radio_1()->set_standby_freq(src.nav1Standby);
-  avionics->mutable_nav_radio_2()->set_active_freq(src.nav2Freq);
-  avionics->mutable_nav_radio_2()->set_standby_freq(src.nav2Standby);
-  avionics->set_transponder_code(DecodeTransponder(src.transponderCode));
-
-  // Aircraft data
-  AircraftInfo* aircraft = data.mutable_aircraft_info();
-  aircraft->set_model(src.aircraft);
-  aircraft->set_call_sign(src.atcCallSign);
-
-  // Control data
-  AircraftControls* controls = data.mutable_aircraft_controls();
-  controls->set_elevator_trim_indicator(src.tfElevatorTrimIndicator);
-  controls->set_flaps_count(src.tfFlapsCount);
-  controls->set_flaps_pos(src.tfFlapsIndex);
-  controls->set_gear_pos(src.gearPosition);
-  controls->set_parking_brake_on(src.parkingBrakeOn);
-  
-
-  // engine data
-  EngineData* engine = data.mutable_engine_data();
-  engine->set_rpm(src.rpmEngine);
-  engine->set_rpm_percent(src.rpmPercent);
-  engine->set_engine_elapsed_time(src.rpmElapsedTime);
-  engine->set_fuel_left_level(src.fuelLeft);
-  engine->set_fuel_right_level(src.fuelRight);
-
-
-  // Game environment
-  GameData* game = data.mutable_game_data();
-  game->set_connected(src.connected);
+  ToSimData(src, identity, &data);
   return data;
 }
 
+double ClampEventValue(EVENT_ID id, double value) {
+  switch (id) {
+    case KEY_AXIS_ELEV_TRIM_SET:
+      return std::min(std::max(value, -kAxisMax), kAxisMax);
+    case KEY_VOR1_SET:
+    case KEY_VOR2_SET:
+    case KEY_HEADING_BUG_SET: {
+      // Turning a knob past north wraps around.
+      const double degrees = std::fmod(value, kFullCircle);
+      return degrees < 0 ? degrees + kFullCircle : degrees;
+    }
+    default:
+      return value;
+  }
+}
+
+bool CurrentEventValue(EVENT_ID id, const SimVars& vars, double* value) {
+  switch (id) {
+    case KEY_AXIS_ELEV_TRIM_SET:
+      // The axis runs opposite to the indicator.
+      *value = ClampEventValue(id, -vars.tfElevatorTrimIndicator * kAxisMax);
+      return true;
+    case KEY_KOHLSMAN_SET:
+      // Millibars * 16.
+      *value = vars.altKollsman * 33.8639 * 16;
+      return true;
+    case KEY_VOR1_SET:
+      *value = vars.vor1Obs;
+      return true;
+    case KEY_VOR2_SET:
+      *value = vars.vor2Obs;
+      return true;
+    case KEY_HEADING_BUG_SET:
+      *value = vars.autopilotHeading;
+      return true;
+    case KEY_AP_ALT_VAR_SET_ENGLISH:
+      *value = vars.autopilotAltitude;
+      return true;
+    default:
+      return false;
+  }
+}
+
 }  // namespace data
 }  // namespace flight_panel
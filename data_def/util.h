@@ -7,8 +7,25 @@ namespace flight_panel {
 namespace data {
 std::string DecodeTransponder(double value);
 
-// Converts SimVars struct to SimData proto.
-SimData ToSimData(const SimVars& src);
+// Converts a frame, its telemetry and identity, to SimData proto.
+SimData ToSimData(const SimVars& src, const SimIdentity& identity);
+
+// Same as above, but fills `dst` in place. Sub-messages and strings already
+// present in `dst` are reused and strings are only rewritten when their value
+// changed, so refilling the same message allocates nothing once it has been
+// filled once.
+void ToSimData(const SimVars& src, const SimIdentity& identity,
+               SimData* dst);
+
+// The value of a *_SET event that keeps the sim as it is in `vars`, in the
+// units of the event. Relative WriteData commands are added to it. Returns
+// false for events without one.
+bool CurrentEventValue(EVENT_ID id, const SimVars& vars, double* value);
+
+// `value` limited to the range the event accepts: axes are clamped, headings
+// wrapped into [0, 360). Events without a known range are returned as they
+// are.
+double ClampEventValue(EVENT_ID id, double value);
 
 }  // namespace data
 }  // namespace flight_panel
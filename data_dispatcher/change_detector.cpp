@@ -0,0 +1,58 @@
+#include "data_dispatcher/change_detector.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace flight_panel {
+namespace data_dispatcher {
+
+ChangeDetector::ChangeDetector() {
+  // Split the thresholds into two arrays in SimVars order, so Compare() runs
+  // over plain arrays of doubles.
+  for (int i = 0; i < data::kSimVarCount; ++i) {
+    const data::SimVarField& field = data::kSimVarFields[i];
+    if (field.is_string) continue;
+    const int slot = field.offset / sizeof(double);
+    absolute_[slot] = field.threshold.absolute;
+    relative_[slot] = field.threshold.relative;
+    var_index_[slot] = i;
+  }
+}
+
+data::DirtyMask ChangeDetector::Compare(const data::SimVars& frame) const {
+  data::DirtyMask dirty;
+  if (!has_published_) return dirty.set();
+  // The telemetry vars are packed doubles from the start of SimVars (see
+  // data::SimVarsMatchDataBlocks), compare them as arrays. The loop has no
+  // branches, so the compiler can vectorize it.
+  const double* old_numbers = reinterpret_cast<const double*>(&published_);
+  const double* new_numbers = reinterpret_cast<const double*>(&frame);
+  bool changed[data::kTelemetryVarCount];
+  for (int i = 0; i < data::kTelemetryVarCount; ++i) {
+    const double limit = std::max(
+        absolute_[i], relative_[i] * std::max(std::abs(old_numbers[i]),
+                                              std::abs(new_numbers[i])));
+    changed[i] = std::abs(new_numbers[i] - old_numbers[i]) > limit;
+  }
+  for (int i = 0; i < data::kTelemetryVarCount; ++i) {
+    if (changed[i]) dirty.set(var_index_[i]);
+  }
+  return dirty;
+}
+
+void ChangeDetector::Publish(const data::SimVars& frame,
+                             const data::DirtyMask& dirty) {
+  if (!has_published_) {
+    published_ = frame;
+    has_published_ = true;
+    return;
+  }
+  double* old_numbers = reinterpret_cast<double*>(&published_);
+  const double* new_numbers = reinterpret_cast<const double*>(&frame);
+  for (int i = 0; i < data::kTelemetryVarCount; ++i) {
+    if (dirty.test(var_index_[i])) old_numbers[i] = new_numbers[i];
+  }
+}
+
+}  // namespace data_dispatcher
+}  // namespace flight_panel
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "data_def/sim_vars.h"
+
+namespace flight_panel {
+namespace data_dispatcher {
+
+// Finds the telemetry vars that changed significantly since the last
+// published frame, using the thresholds of data::kSimVarFields. Identity
+// strings are not compared, they are only published when they change.
+class ChangeDetector {
+ public:
+  ChangeDetector();
+
+  // Returns the vars of `frame` that differ from the last published frame by
+  // more than their threshold. Every var is dirty before the first Publish().
+  data::DirtyMask Compare(const data::SimVars& frame) const;
+  // Makes the `dirty` vars of `frame` the reference for the following
+  // comparisons. The other vars keep their reference, so their drift keeps
+  // adding up until it crosses the threshold.
+  void Publish(const data::SimVars& frame, const data::DirtyMask& dirty);
+
+ private:
+  // Thresholds of the telemetry vars, in SimVars order.
+  double absolute_[data::kTelemetryVarCount];
+  double relative_[data::kTelemetryVarCount];
+  // The SimVarDefs index, i.e. the DirtyMask bit, of each telemetry var.
+  int var_index_[data::kTelemetryVarCount];
+  bool has_published_ = false;
+  data::SimVars published_;
+};
+
+}  // namespace data_dispatcher
+}  // namespace flight_panel
@@ -1,5 +1,7 @@
 #include "data_dispatcher/data_dispatcher.h"
 
+#include <algorithm>
+#include <atomic>
 #include <queue>
 #include <thread>
 #include <vector>
@@ -8,46 +10,197 @@
 #include "absl/strings/str_format.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "data_def/proto/sim_data.pb.h"
-#include "data_def/util.h"
+#include "data_dispatcher/change_detector.h"
+#include "data_dispatcher/recipient_lane.h"
+#include "data_dispatcher/spsc_ring.h"
 #include "spdlog/spdlog.h"
+#include "trace/latency.h"
+#include "trace/trace.h"
 
 namespace flight_panel {
 namespace data_dispatcher {
 namespace {
+using ::flight_panel::data::SimIdentity;
 using ::flight_panel::data::SimVars;
+using ::flight_panel::trace::FrameStamp;
+using ::flight_panel::trace::LatencyHistogram;
+using ::flight_panel::trace::MonotonicNanos;
+using ::flight_panel::trace::Stage;
+
+// Buffers a ring needs besides its slots: the one the worker converts, the
+// one the producer fills and the last one the producer kept.
+constexpr int kRingSpareBuffers = 3;
+
+// Upper bound of a parked ring worker's sleep. The producer wakes the worker
+// up when it parks, this is only a safety net.
+constexpr absl::Duration kParkTimeout = absl::Milliseconds(100);
+
+// The DirtyMask bits of the vars in SimIdentity.
+data::DirtyMask IdentityMask() {
+  data::DirtyMask mask;
+  for (int i = 0; i < data::kSimVarCount; ++i) {
+    if (data::kSimVarFields[i].is_string) mask.set(i);
+  }
+  return mask;
+}
+
 class DataDispatcherImpl : public DataDispatcher {
  public:
-  DataDispatcherImpl(){};
+  DataDispatcherImpl(DispatcherOptions options)
+      : options_(options),
+        ring_(options_.queue_mode == QueueMode::kSpscRing
+                  ? absl::make_unique<SpscRing<FrameBufferPtr>>(
+                        options_.ring_capacity)
+                  : nullptr),
+        enqueue_latency_(trace::GetLatencyHistogram(Stage::kEnqueue)),
+        convert_latency_(trace::GetLatencyHistogram(Stage::kConvert)),
+        frame_pool_(options_.frame_pool_size),
+        buffer_pool_(BufferPoolSize(options_, ring_.get())) {
+    if (options_.suppress_unchanged) {
+      change_detector_ = absl::make_unique<ChangeDetector>();
+    }
+  };
 
   // Inherited via DataDispatcher
-  virtual void Start() override {
+  virtual void Start() LOCKS_EXCLUDED(lanes_lock_) override {
+    {
+      absl::MutexLock l(&lanes_lock_);
+      for (auto& lane : lanes_) lane->Start();
+      lanes_running_ = true;
+    }
     // Reset stop notification.
     stop_notification_ = absl::make_unique<absl::Notification>();
     worker_ = std::thread(&DataDispatcherImpl::RunWorker, this);
   }
   // Stop the worker thread, by calling "notify".
   virtual void Stop() override {
-    stop_notification_->Notify();
+    // Notify under the lock the worker waits on, so it re-evaluates its wait
+    // condition when the lock is released.
+    absl::Mutex* wait_lock = ring_ ? &park_lock_ : &data_lock_;
+    {
+      absl::MutexLock l(wait_lock);
+      stop_notification_->Notify();
+    }
+    // The worker may be blocked pushing to a full kBlock lane, which only
+    // makes room once its recipient returns.
+    for (RecipientLane* lane : GetLanes()) lane->RequestStop();
     worker_.join();
+    absl::MutexLock l(&lanes_lock_);
+    for (auto& lane : lanes_) lane->Stop();
+    lanes_running_ = false;
+  }
+
+  virtual absl::Status AddRecepient(DispatchCallback notify_callback) override {
+    return AddRecepient(notify_callback, RecipientOptions());
   }
 
-  virtual absl::Status AddRecepient(DispatchCallback notify_callback)
-      LOCKS_EXCLUDED(callbacks_lock) override {
-    absl::MutexLock l(&callbacks_lock_);
-    dispatch_callbacks_.push_back(notify_callback);
+  virtual absl::Status AddRecepient(DispatchCallback notify_callback,
+                                    RecipientOptions options) override {
+    return AddFrameRecipient(
+        [notify_callback](SimFramePtr frame) {
+          return notify_callback(frame->data());
+        },
+        options);
+  }
+
+  virtual absl::Status AddFrameRecipient(FrameCallback frame_callback,
+                                         RecipientOptions options)
+      LOCKS_EXCLUDED(lanes_lock_) override {
+    if (options.name.empty()) {
+      options.name = absl::StrFormat("recipient_%d", RecipientCount());
+    }
+    auto lane = absl::make_unique<RecipientLane>(frame_callback, options);
+    absl::MutexLock l(&lanes_lock_);
+    if (lanes_running_) lane->Start();
+    lanes_.push_back(std::move(lane));
     return absl::OkStatus();
   }
 
   // Notify the dispatch with new data.
-  virtual absl::Status Notify(SimVars new_data)
+  virtual absl::Status Notify(const SimVars& new_data) override {
+    FrameStamp stamp;
+    stamp.sequence = next_sequence_.fetch_add(1, std::memory_order_relaxed);
+    stamp.received_ns = MonotonicNanos();
+    return Notify(new_data, stamp);
+  }
+
+  virtual absl::Status Notify(const SimVars& new_data,
+                              FrameStamp stamp) override {
+    return Notify(new_data, stamp, data::DirtyMask().set());
+  }
+
+  virtual absl::Status Notify(const SimVars& new_data, FrameStamp stamp,
+                              const data::DirtyMask& changed) override {
+    FrameLease frame = LeaseFrame();
+    frame->vars = new_data;
+    frame->stamp = stamp;
+    frame->changed = changed;
+    return Commit(std::move(frame));
+  }
+
+  virtual FrameLease LeaseFrame() override { return buffer_pool_.Lease(); }
+
+  virtual absl::Status Commit(FrameLease frame)
       LOCKS_EXCLUDED(data_lock_) override {
+    notified_.fetch_add(1, std::memory_order_relaxed);
+    if (ring_) {
+      if (ring_dropped_) frame->changed.set();
+      return NotifyRing(std::move(frame));
+    }
+
     absl::MutexLock l(&data_lock_);
-    sim_vars_.push(new_data);
+    if (options_.queue_mode == QueueMode::kLatestOnly && !frames_.empty()) {
+      // The mailbox holds at most one frame. Replace the unconsumed one, and
+      // keep the vars it changed marked.
+      frame->changed |= frames_.back()->changed;
+      frames_.back() = std::move(frame);
+      coalesced_.fetch_add(1, std::memory_order_relaxed);
+      return absl::OkStatus();
+    }
+    frames_.push(std::move(frame));
     return absl::OkStatus();
   }
 
-  virtual int QueueSize() override { return sim_vars_.size(); }
+  virtual absl::Status NotifyIdentity(const SimIdentity& identity)
+      LOCKS_EXCLUDED(identity_lock_) override {
+    absl::MutexLock l(&identity_lock_);
+    pending_identity_ = identity;
+    identity_pending_.store(true, std::memory_order_release);
+    return absl::OkStatus();
+  }
+
+  virtual int QueueSize() LOCKS_EXCLUDED(data_lock_, lanes_lock_) override {
+    int size = 0;
+    if (ring_) {
+      size = ring_->Size() + (dispatching_ ? 1 : 0);
+    } else {
+      absl::MutexLock l(&data_lock_);
+      size = frames_.size() + (dispatching_ ? 1 : 0);
+    }
+    for (RecipientLane* lane : GetLanes()) size += lane->Backlog();
+    return size;
+  }
+
+  virtual DispatcherStats Stats() override {
+    DispatcherStats stats;
+    stats.notified = notified_.load(std::memory_order_relaxed);
+    stats.dispatched = dispatched_.load(std::memory_order_relaxed);
+    stats.coalesced = coalesced_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    stats.suppressed = suppressed_.load(std::memory_order_relaxed);
+    stats.skipped = skipped_.load(std::memory_order_relaxed);
+    stats.sequence_gaps = sequence_gaps_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  virtual std::vector<RecipientStats> GetRecipientStats() override {
+    std::vector<RecipientStats> stats;
+    for (RecipientLane* lane : GetLanes()) stats.push_back(lane->Stats());
+    return stats;
+  }
 
   virtual bool IsRunning() override {
     return worker_.joinable();
@@ -57,61 +210,293 @@ class DataDispatcherImpl : public DataDispatcher {
  private:
   // The worker thread function.
   void RunWorker();
-  absl::Status DispatchData(const SimData& sim_data_pb);
+  // Blocks until there is a frame to dispatch and moves it to `frame`.
+  // Returns false when the dispatcher is stopped.
+  bool WaitForFrame(FrameBufferPtr* frame) LOCKS_EXCLUDED(data_lock_);
+  bool WaitForRingFrame(FrameBufferPtr* frame) LOCKS_EXCLUDED(park_lock_);
+  // Lock free producer side of kSpscRing.
+  absl::Status NotifyRing(FrameBufferPtr frame);
+  // Enough buffers to fill the ring, which rounds its capacity up, and
+  // still lease the spares.
+  static int BufferPoolSize(const DispatcherOptions& options,
+                            const SpscRing<FrameBufferPtr>* ring) {
+    if (!ring) return options.buffer_pool_size;
+    return std::max(options.buffer_pool_size,
+                    static_cast<int>(ring->Capacity()) + kRingSpareBuffers);
+  }
+  // Records the queueing latency and sequence gaps of a frame the worker took.
+  void OnFrameTaken(const FrameStamp& stamp);
+  // Sets `dirty` to the vars that changed in `frame`. Returns true if every
+  // recipient wants the frame even if nothing changed since the last frame
+  // it got: always without suppress_unchanged, and for heartbeats with it.
+  // Only called by the worker.
+  bool ChangedVars(const FrameBuffer& frame, absl::Time now,
+                   data::DirtyMask* dirty);
+  // Picks up an identity set by NotifyIdentity(). Only called by the worker.
+  void TakeIdentity() LOCKS_EXCLUDED(identity_lock_);
+  // Queues the frame on the given lanes.
+  absl::Status DispatchData(SimFramePtr frame,
+                            const std::vector<RecipientLane*>& lanes);
+  // Lanes are never removed, so the pointers stay valid after the lock is
+  // released.
+  std::vector<RecipientLane*> GetLanes() LOCKS_EXCLUDED(lanes_lock_);
+  // Same as above, into a vector the caller reuses.
+  void GetLanes(std::vector<RecipientLane*>* lanes) LOCKS_EXCLUDED(lanes_lock_);
+  int RecipientCount() LOCKS_EXCLUDED(lanes_lock_);
+
+  const DispatcherOptions options_;
   std::thread worker_;
   std::unique_ptr<absl::Notification> stop_notification_;
-  absl::Mutex callbacks_lock_;
-  std::vector<DispatchCallback> dispatch_callbacks_ GUARDED_BY(callbacks_lock_);
-  // Lock for sim_vars_ vector.
+  absl::Mutex lanes_lock_;
+  // One delivery lane per recipient.
+  std::vector<std::unique_ptr<RecipientLane>> lanes_ GUARDED_BY(lanes_lock_);
+  bool lanes_running_ GUARDED_BY(lanes_lock_) = false;
+  // Lock for the frames_ queue.
   absl::Mutex data_lock_;
-  std::queue<SimVars> sim_vars_ GUARDED_BY(data_lock_);
+  std::queue<FrameBufferPtr> frames_ GUARDED_BY(data_lock_);
+  // Only set for kSpscRing, replaces frames_.
+  std::unique_ptr<SpscRing<FrameBufferPtr>> ring_;
+  // The ring worker parks on this lock when the ring is empty. The producer
+  // only touches it when `worker_parked_` is set.
+  absl::Mutex park_lock_;
+  std::atomic<bool> worker_parked_{false};
+  // Whether the worker is dispatching a frame it took from the queue.
+  std::atomic<bool> dispatching_{false};
+  // Set when the ring dropped the last frame. The changes it carried are
+  // lost, so the next frame pushed marks every var changed. Only used by the
+  // producer.
+  bool ring_dropped_ = false;
+  absl::Mutex identity_lock_;
+  SimIdentity pending_identity_ GUARDED_BY(identity_lock_);
+  // Set when pending_identity_ has not been taken by the worker yet, so the
+  // worker only takes the lock when the identity changed.
+  std::atomic<bool> identity_pending_{false};
+  // The identity sent with frames, and whether it changed since the last
+  // frame the worker took. Only used by the worker.
+  SimIdentity identity_;
+  bool identity_changed_ = false;
+  // The DirtyMask bits of the identity strings.
+  const data::DirtyMask identity_mask_ = IdentityMask();
+  // Only set with suppress_unchanged. Only used by the worker.
+  std::unique_ptr<ChangeDetector> change_detector_;
+  absl::Time last_publish_time_ = absl::InfinitePast();
+  // SimVars::connected of the last frame. Not a sim var, so the detector does
+  // not see it. Only set with suppress_unchanged.
+  double last_connected_ = 0;
+  // Sequence of the last frame the worker took. Only used by the worker.
+  int64_t last_sequence_ = 0;
+  // Sequence for frames notified without a stamp.
+  std::atomic<int64_t> next_sequence_{1};
+  LatencyHistogram* const enqueue_latency_;
+  LatencyHistogram* const convert_latency_;
+  // Frames handed to the lanes. Only used by the worker.
+  SimFramePool frame_pool_;
+  // Buffers leased to the producer. Only used by the producer.
+  FrameBufferPool buffer_pool_;
+  // Scratch vectors of the worker, kept to reuse their capacity.
+  std::vector<RecipientLane*> lanes_scratch_;
+  std::vector<RecipientLane*> due_lanes_;
+
+  std::atomic<int64_t> notified_{0};
+  std::atomic<int64_t> dispatched_{0};
+  std::atomic<int64_t> coalesced_{0};
+  std::atomic<int64_t> dropped_{0};
+  std::atomic<int64_t> suppressed_{0};
+  std::atomic<int64_t> skipped_{0};
+  std::atomic<int64_t> sequence_gaps_{0};
 };
 
-void DataDispatcherImpl::RunWorker() {
-  spdlog::info("Started run worker");
+absl::Status DataDispatcherImpl::NotifyRing(FrameBufferPtr frame) {
+  if (!ring_->TryPush(frame)) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    ring_dropped_ = true;
+    return absl::ResourceExhaustedError("Dispatcher ring is full.");
+  }
+  ring_dropped_ = false;
+  if (worker_parked_.load(std::memory_order_seq_cst)) {
+    // Releasing the lock makes the parked worker re-evaluate its condition.
+    absl::MutexLock l(&park_lock_);
+  }
+  return absl::OkStatus();
+}
+
+bool DataDispatcherImpl::WaitForFrame(FrameBufferPtr* frame) {
+  // Don't keep the previous frame out of the pool while waiting.
+  frame->reset();
   auto data_not_empty_or_stop = [this] {
-    return stop_notification_->HasBeenNotified() || !sim_vars_.empty();
+    return stop_notification_->HasBeenNotified() || !frames_.empty();
   };
+  absl::MutexLock l(&data_lock_);
+  data_lock_.Await(absl::Condition(&data_not_empty_or_stop));
+  if (stop_notification_->HasBeenNotified()) return false;
+  *frame = std::move(frames_.front());
+  frames_.pop();
+  dispatching_ = true;
+  return true;
+}
 
-  // Execute the loop until stop is notified.
+bool DataDispatcherImpl::WaitForRingFrame(FrameBufferPtr* frame) {
+  frame->reset();
+  auto ring_not_empty_or_stop = [this] {
+    return stop_notification_->HasBeenNotified() || !ring_->Empty();
+  };
   while (!stop_notification_->HasBeenNotified()) {
-    data_lock_.Lock();
-    spdlog::info("Waiting for new data....");
-    data_lock_.Await(absl::Condition(&data_not_empty_or_stop));
-    if (sim_vars_.empty()) continue;
-    spdlog::info("Reading new data");
-    // Data is not empty, process new data.
-    SimVars raw_data = sim_vars_.front();
-    sim_vars_.pop();
-    data_lock_.Unlock();
-    spdlog::info("New data: {}", raw_data.adiBank);
-    // TODO
-    // Convert SimVars to proto message
-
-    // Dispatch serialized proto data.
-    SimData data_pb = data::ToSimData(raw_data);
-    spdlog::info("Dispatching proto data: {}", data_pb.ShortDebugString());
-    DispatchData(data_pb);
-    continue;
+    for (int i = 0; i <= options_.spin_count; ++i) {
+      if (ring_->TryPop(frame)) {
+        dispatching_ = true;
+        return true;
+      }
+    }
+
+    // Nothing arrived while spinning. Park until the producer wakes us up.
+    absl::MutexLock l(&park_lock_);
+    worker_parked_.store(true, std::memory_order_seq_cst);
+    // Orders the store above before the ring check in the condition, which
+    // only loads the tail with acquire. Without it the check could see a
+    // stale empty ring while NotifyRing() still sees the worker running.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    park_lock_.AwaitWithTimeout(absl::Condition(&ring_not_empty_or_stop),
+                                kParkTimeout);
+    worker_parked_.store(false, std::memory_order_relaxed);
+  }
+  return false;
+}
+
+bool DataDispatcherImpl::ChangedVars(const FrameBuffer& frame, absl::Time now,
+                                     data::DirtyMask* dirty) {
+  if (!change_detector_) {
+    *dirty = frame.changed;
+    return true;
+  }
+  // The detector compares against the last changed frame, so it also looks
+  // at the vars the source did not update.
+  *dirty = change_detector_->Compare(frame.vars);
+  if (frame.vars.connected != last_connected_) {
+    // Every value is new, or stale, when the sim comes or goes.
+    dirty->set();
+    last_connected_ = frame.vars.connected;
+  }
+  // Each var is compared against its value when it last changed rather than
+  // the last received one, so slow drifts below the threshold still add up
+  // to a change. The lanes keep the change until they are sent a frame.
+  if (dirty->any()) change_detector_->Publish(frame.vars, *dirty);
+  return now - last_publish_time_ >= options_.heartbeat_interval;
+}
+
+void DataDispatcherImpl::TakeIdentity() {
+  if (!identity_pending_.exchange(false, std::memory_order_acquire)) return;
+  absl::MutexLock l(&identity_lock_);
+  identity_ = pending_identity_;
+  identity_changed_ = true;
+}
+
+void DataDispatcherImpl::OnFrameTaken(const FrameStamp& stamp) {
+  if (stamp.received_ns != 0) {
+    enqueue_latency_->Record(MonotonicNanos() - stamp.received_ns);
+  }
+  if (last_sequence_ != 0 && stamp.sequence > last_sequence_ + 1) {
+    sequence_gaps_.fetch_add(stamp.sequence - last_sequence_ - 1,
+                             std::memory_order_relaxed);
+  }
+  last_sequence_ = stamp.sequence;
+}
+
+void DataDispatcherImpl::RunWorker() {
+  spdlog::info("Started run worker");
+  FrameBufferPtr taken;
+  // Execute the loop until stop is notified.
+  while (ring_ ? WaitForRingFrame(&taken) : WaitForFrame(&taken)) {
+    // The frame is read where the producer wrote it.
+    const FrameBuffer& buffer = *taken;
+    FP_TRACE(kDebug, kDispatcherFrameTaken, buffer.stamp.sequence, 0);
+    OnFrameTaken(buffer.stamp);
+    TakeIdentity();
+    const absl::Time now = absl::Now();
+    data::DirtyMask dirty;
+    const bool heartbeat = ChangedVars(buffer, now, &dirty);
+    if (identity_changed_) dirty |= identity_mask_;
+    identity_changed_ = false;
+
+    // Every lane keeps the changes until it is due, so a recipient that
+    // skips frames still learns about everything that changed in them.
+    due_lanes_.clear();
+    data::DirtyMask due_dirty;
+    bool wanted = false;
+    GetLanes(&lanes_scratch_);
+    for (RecipientLane* lane : lanes_scratch_) {
+      lane->AddPending(dirty);
+      if (!heartbeat && lane->pending().none()) {
+        lane->CountIdleFrame();
+        continue;
+      }
+      wanted = true;
+      if (!lane->IsDue(now)) continue;
+      due_lanes_.push_back(lane);
+      due_dirty |= lane->TakePending();
+    }
+    // Without recipients nothing is wanted, but nothing was suppressed
+    // either. Such frames are skipped below.
+    if (!wanted && !lanes_scratch_.empty()) {
+      FP_TRACE(kDebug, kDispatcherFrameSuppressed, 0, 0);
+      suppressed_.fetch_add(1, std::memory_order_relaxed);
+      dispatching_ = false;
+      continue;
+    }
+    if (due_lanes_.empty()) {
+      // Nobody wants this frame, don't pay for the conversion.
+      FP_TRACE(kDebug, kDispatcherFrameSkipped, 0, 0);
+      skipped_.fetch_add(1, std::memory_order_relaxed);
+      dispatching_ = false;
+      continue;
+    }
+
+    // Convert once, every due lane shares the same frame. Its dirty mask
+    // covers what any of them missed, which may be more than one lane needs
+    // but never less.
+    const int64_t convert_start = MonotonicNanos();
+    SimFramePtr frame =
+        frame_pool_.Acquire(buffer.vars, identity_, due_dirty, buffer.stamp);
+    convert_latency_->Record(MonotonicNanos() - convert_start);
+    FP_TRACE(kInfo, kDispatcherFrameDispatched, due_lanes_.size(),
+             due_dirty.count());
+    DispatchData(std::move(frame), due_lanes_);
+    last_publish_time_ = now;
+    dispatched_.fetch_add(1, std::memory_order_relaxed);
+    dispatching_ = false;
   }
   return;
 }
-absl::Status DataDispatcherImpl::DispatchData(const SimData& sim_data_pb) {
-  spdlog::info("Entered dispatching.");
-  absl::MutexLock l(&callbacks_lock_);
-  spdlog::info(
-      absl::StrFormat("Size of callback list: %d", dispatch_callbacks_.size()));
-  for (const auto callback : dispatch_callbacks_) {
-    spdlog::info("Sending callback");
-    callback(sim_data_pb);
-  }
-  spdlog::info("Finishing dispatching.");
+
+absl::Status DataDispatcherImpl::DispatchData(
+    SimFramePtr frame, const std::vector<RecipientLane*>& lanes) {
+  // Pushing only queues the frame, the callbacks run on the lane threads.
+  for (RecipientLane* lane : lanes) {
+    lane->Push(frame);
+  }
   return absl::OkStatus();
 }
+
+std::vector<RecipientLane*> DataDispatcherImpl::GetLanes() {
+  absl::MutexLock l(&lanes_lock_);
+  std::vector<RecipientLane*> lanes;
+  for (auto& lane : lanes_) lanes.push_back(lane.get());
+  return lanes;
+}
+
+void DataDispatcherImpl::GetLanes(std::vector<RecipientLane*>* lanes) {
+  lanes->clear();
+  absl::MutexLock l(&lanes_lock_);
+  for (auto& lane : lanes_) lanes->push_back(lane.get());
+}
+
+int DataDispatcherImpl::RecipientCount() {
+  absl::MutexLock l(&lanes_lock_);
+  return lanes_.size();
+}
 }  // namespace
 
-std::unique_ptr<DataDispatcher> CreateDispatcher() {
-  return absl::make_unique<DataDispatcherImpl>();
+std::unique_ptr<DataDispatcher> CreateDispatcher(DispatcherOptions options) {
+  return absl::make_unique<DataDispatcherImpl>(options);
 }
 
 }  // namespace data_dispatcher
@@ -1,30 +1,184 @@
 #pragma once
 #include <functional>
+#include <string>
+#include <vector>
 
 #include "absl/status/status.h"
+#include "absl/time/time.h"
 #include "data_def/sim_vars.h"
 #include "data_def/proto/sim_data.pb.h"
+#include "data_dispatcher/sim_frame.h"
+#include "trace/latency.h"
 
 namespace flight_panel {
 namespace data_dispatcher {
 
 using DispatchCallback = std::function<absl::Status(const SimData&)>;
+// Receives the shared frame. Recipients may keep the pointer after the call,
+// and should use SimFrame::SerializedData() instead of serializing the proto.
+using FrameCallback = std::function<absl::Status(SimFramePtr)>;
+
+// How new data is buffered between Notify() and the worker thread.
+enum class QueueMode {
+  // Every frame is queued and dispatched in order. The queue is unbounded.
+  kFifo,
+  // A single-slot "latest wins" mailbox. A new frame replaces the one that
+  // has not been consumed yet, so clients are at most one frame behind.
+  kLatestOnly,
+  // A preallocated lock-free ring. Notify() never takes a lock, which keeps
+  // the SimConnect dispatch thread free of contention. Frames that arrive
+  // while the ring is full are dropped.
+  kSpscRing,
+};
+
+struct DispatcherOptions {
+  QueueMode queue_mode = QueueMode::kFifo;
+  // Number of slots in the ring. Only used by kSpscRing.
+  int ring_capacity = 16;
+  // How many times the worker polls an empty ring before it parks. Spinning
+  // saves a wakeup at high frame rates, parking saves CPU when idle. Only used
+  // by kSpscRing.
+  int spin_count = 1000;
+  // Drop frames in which no sim var changed by more than its threshold in
+  // data::kSimVarFields, compared to the last published frame.
+  bool suppress_unchanged = false;
+  // With suppress_unchanged, an unchanged frame is still published this often
+  // so recipients know the sim is alive.
+  absl::Duration heartbeat_interval = absl::Seconds(1);
+  // Number of converted frames the worker recycles, see SimFramePool. Should
+  // cover the frames recipients hold at once: their queues plus the frame
+  // being delivered.
+  int frame_pool_size = 64;
+  // Number of FrameBuffers leased to the producer, see LeaseFrame(). Should
+  // cover the frames queued, the one the worker converts and the ones the
+  // producer holds. kSpscRing always gets enough for a full ring.
+  int buffer_pool_size = 8;
+};
+
+// Frame counters of a dispatcher, since it was created.
+struct DispatcherStats {
+  // Frames received by Notify().
+  int64_t notified = 0;
+  // Frames sent to the recipients.
+  int64_t dispatched = 0;
+  // Frames replaced by a newer frame before they were dispatched.
+  int64_t coalesced = 0;
+  // Frames dropped because the queue was full.
+  int64_t dropped = 0;
+  // Frames not published because nothing changed significantly since any
+  // recipient was last sent a frame.
+  int64_t suppressed = 0;
+  // Frames no recipient was due for, or that came while there were no
+  // recipients. They are not converted at all.
+  int64_t skipped = 0;
+  // Frames missing from the stamp sequence when the worker took a frame:
+  // frames dropped or coalesced by the queue, or lost before Notify().
+  int64_t sequence_gaps = 0;
+};
+
+// What a recipient's lane does when a new frame arrives and its queue is full.
+enum class OverflowPolicy {
+  // Drop the oldest queued frame to make room.
+  kDropOldest,
+  // Keep only the latest frame. The queue never holds more than one frame.
+  kCoalesce,
+  // Wait for the recipient to catch up. This stalls the dispatcher worker,
+  // and with it every other recipient, so only use it for lossless clients.
+  kBlock,
+};
+
+// Each recipient is called from its own delivery lane: a bounded queue and a
+// thread. A slow recipient only delays itself.
+//
+// A recipient can also ask for a lower cadence than the sim's. Frames it is not
+// due for are skipped before they are converted, and the next due frame is
+// always the latest one. The limits below combine: a frame is only delivered
+// when all of them allow it.
+struct RecipientOptions {
+  // Used in logs and stats.
+  std::string name;
+  // Maximum number of frames queued for the recipient.
+  int queue_capacity = 8;
+  OverflowPolicy overflow_policy = OverflowPolicy::kDropOldest;
+  // Maximum deliveries per second. 0 means unlimited.
+  double max_rate_hz = 0;
+  // Minimum time between two deliveries.
+  absl::Duration min_interval = absl::ZeroDuration();
+  // Only deliver every Nth frame. 1 delivers every frame. Frames count
+  // whether they changed or not: with suppress_unchanged, a change is
+  // delivered once N frames passed since the last delivery.
+  int every_nth = 1;
+};
+
+// Counters of a single recipient.
+struct RecipientStats {
+  std::string name;
+  // Frames the callback was called with.
+  int64_t delivered = 0;
+  // Frames the callback returned an error for.
+  int64_t errors = 0;
+  // Frames dropped or replaced because the recipient was too slow.
+  int64_t dropped = 0;
+  // Frames skipped because the recipient was not due yet.
+  int64_t skipped = 0;
+  // Frames currently queued for the recipient, i.e. how far it lags behind.
+  int backlog = 0;
+};
+
 class DataDispatcher {
  public:
+  virtual ~DataDispatcher() = default;
   // Start running, and dispatch new data when they arrive.
   virtual void Start() = 0;
   virtual void Stop() = 0;
   virtual bool IsRunning() = 0;
+  // Number of frames waiting to be dispatched, including the one being
+  // dispatched right now and the frames queued for each recipient.
   virtual int QueueSize() = 0;
+  virtual DispatcherStats Stats() = 0;
+  // Stats of every recipient, in the order they were added.
+  virtual std::vector<RecipientStats> GetRecipientStats() = 0;
 
+  // Adds a recipient with default RecipientOptions.
   virtual absl::Status AddRecepient(
       DispatchCallback notify_callback)=0;
-  // Notify the dispatch with new data.
-  virtual absl::Status Notify(flight_panel::data::SimVars new_data) = 0;
+  virtual absl::Status AddRecepient(DispatchCallback notify_callback,
+                                    RecipientOptions options) = 0;
+  virtual absl::Status AddFrameRecipient(FrameCallback frame_callback,
+                                         RecipientOptions options) = 0;
+  // Frames are produced by one thread: LeaseFrame(), Commit() and Notify()
+  // must not be called concurrently.
+  //
+  // Leases a preallocated buffer for the next frame. Fill its vars, stamp and
+  // changed mask in place, then pass it to Commit(). The worker reads the
+  // committed buffer where it is, so a leased frame is never copied.
+  virtual FrameLease LeaseFrame() = 0;
+  // Queues a leased frame. The producer may keep the pointer to read the
+  // frame later, but must not write to it anymore.
+  virtual absl::Status Commit(FrameLease frame) = 0;
+  // Notify the dispatch with new data. The frame is stamped on arrival.
+  virtual absl::Status Notify(const flight_panel::data::SimVars& new_data) = 0;
+  // Notify with a frame that was already stamped, e.g. by the DataReader.
+  // Stamps must come from one source, so their sequence has no gaps.
+  virtual absl::Status Notify(const flight_panel::data::SimVars& new_data,
+                              trace::FrameStamp stamp) = 0;
+  // Same as above, for a source that knows which vars it updated, e.g. from
+  // a changed-only SimConnect request. The vars not in `changed` are the same
+  // as in the previous frame. Without suppress_unchanged, `changed` becomes
+  // the dirty mask of the published frame.
+  virtual absl::Status Notify(const flight_panel::data::SimVars& new_data,
+                              trace::FrameStamp stamp,
+                              const data::DirtyMask& changed) = 0;
+  // Sets the identity strings sent with the following frames. Only call this
+  // when they changed: the next frame is published with the string vars
+  // marked dirty, even if its telemetry did not change.
+  virtual absl::Status NotifyIdentity(
+      const flight_panel::data::SimIdentity& identity) = 0;
 };
 
 
-std::unique_ptr<DataDispatcher> CreateDispatcher();
+std::unique_ptr<DataDispatcher> CreateDispatcher(
+    DispatcherOptions options = DispatcherOptions());
 
 }  // namespace data_dispatcher
 }  // namespace flight_panel
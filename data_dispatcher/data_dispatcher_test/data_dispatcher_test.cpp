@@ -1,9 +1,18 @@
 #include "data_dispatcher/data_dispatcher.h"
 
+#include <cstring>
+#include <thread>
+
 #include "absl/functional/bind_front.h"
 #include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
 #include "absl/time/clock.h"
 #include "data_def/proto/sim_data.pb.h"
+#include "data_dispatcher/change_detector.h"
+#include "data_dispatcher/sim_frame.h"
+#include "data_dispatcher/spsc_ring.h"
+#include "trace/latency.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -23,6 +32,65 @@ class MockClient {
   MOCK_METHOD(absl::Status, Dispatch, (const SimData&));
 };
 
+// A recipient that blocks in its callback until released, and records the
+// bank angle of every frame it got.
+class BlockingClient {
+ public:
+  absl::Status Dispatch(const SimData& data) {
+    {
+      absl::MutexLock l(&lock_);
+      called_ = true;
+    }
+    release_.WaitForNotification();
+    absl::MutexLock l(&lock_);
+    banks_.push_back(data.instruments().bank_angle());
+    return absl::OkStatus();
+  }
+  void Release() { release_.Notify(); }
+  // Waits until the callback is blocked on its first frame.
+  void WaitForFirstCall() {
+    absl::MutexLock l(&lock_);
+    lock_.Await(absl::Condition(&called_));
+  }
+  std::vector<double> banks() {
+    absl::MutexLock l(&lock_);
+    return banks_;
+  }
+
+ private:
+  absl::Notification release_;
+  absl::Mutex lock_;
+  std::vector<double> banks_;
+  bool called_ = false;
+};
+
+// Notifies frames with bank angle 1..count, and waits until the dispatcher
+// worker has handed all of them to the recipient lanes.
+void NotifyFrames(DataDispatcher* dispatcher, int count) {
+  SimVars data;
+  for (int bank = 1; bank <= count; ++bank) {
+    data.adiBank = bank;
+    dispatcher->Notify(data);
+  }
+  while (dispatcher->Stats().dispatched < count) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+}
+
+// Index of a var in SimVarDefs, i.e. its bit in a DirtyMask.
+int VarIndex(absl::string_view name) {
+  for (int i = 0; data::SimVarDefs[i][0] != NULL; ++i) {
+    if (name == data::SimVarDefs[i][0]) return i;
+  }
+  return -1;
+}
+
+void WaitUntilDelivered(DataDispatcher* dispatcher) {
+  while (dispatcher->QueueSize() > 0) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+}
+
 TEST(DataDispatcherTest, TestNotifyTriggersDispatch) {
   MockClient mock_client1, mock_client2;
   SimVars data;
@@ -76,6 +144,845 @@ TEST(DataDispatcherTest, TestDataConverted) {
   EXPECT_THAT(dispatched.instruments().bank_angle(), DoubleEq(50));
 }
 
+TEST(DataDispatcherTest, TestFifoQueuesEveryFrame) {
+  SimVars data;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  dispatcher->Notify(data);
+  dispatcher->Notify(data);
+  dispatcher->Notify(data);
+  EXPECT_EQ(dispatcher->QueueSize(), 3);
+  EXPECT_EQ(dispatcher->Stats().notified, 3);
+  EXPECT_EQ(dispatcher->Stats().coalesced, 0);
+}
+
+TEST(DataDispatcherTest, TestLatestOnlyCoalescesFrames) {
+  MockClient mock_client;
+  SimData dispatched;
+  EXPECT_CALL(mock_client, Dispatch(_))
+      .WillOnce(
+          ::testing::DoAll(SaveArg<0>(&dispatched), Return(absl::OkStatus())));
+  DispatcherOptions options;
+  options.queue_mode = QueueMode::kLatestOnly;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  dispatcher->AddRecepient(
+      absl::bind_front(&MockClient::Dispatch, &mock_client));
+  // Notify before the worker starts, so none of the frames is consumed.
+  SimVars data;
+  for (int bank = 1; bank <= 3; ++bank) {
+    data.adiBank = bank;
+    dispatcher->Notify(data);
+  }
+  EXPECT_EQ(dispatcher->QueueSize(), 1);
+  dispatcher->Start();
+  while (dispatcher->QueueSize() > 0) {
+    ;
+  }
+  dispatcher->Stop();
+  EXPECT_THAT(dispatched.instruments().bank_angle(), DoubleEq(3));
+  DispatcherStats stats = dispatcher->Stats();
+  EXPECT_EQ(stats.notified, 3);
+  EXPECT_EQ(stats.coalesced, 2);
+  EXPECT_EQ(stats.dispatched, 1);
+}
+
+TEST(DataDispatcherTest, TestSpscRingDispatchesEveryFrame) {
+  MockClient mock_client;
+  SimVars data;
+  EXPECT_CALL(mock_client, Dispatch(_)).Times(3);
+  DispatcherOptions options;
+  options.queue_mode = QueueMode::kSpscRing;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  dispatcher->AddRecepient(
+      absl::bind_front(&MockClient::Dispatch, &mock_client));
+  dispatcher->Start();
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(dispatcher->Notify(data).ok());
+    // Give the worker time to park, so the wakeup path is exercised too.
+    absl::SleepFor(absl::Milliseconds(5));
+  }
+  while (dispatcher->QueueSize() > 0) {
+    ;
+  }
+  dispatcher->Stop();
+  EXPECT_EQ(dispatcher->Stats().dispatched, 3);
+}
+
+TEST(DataDispatcherTest, TestSpscRingDropsWhenFull) {
+  SimVars data;
+  DispatcherOptions options;
+  options.queue_mode = QueueMode::kSpscRing;
+  options.ring_capacity = 2;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  EXPECT_TRUE(dispatcher->Notify(data).ok());
+  EXPECT_TRUE(dispatcher->Notify(data).ok());
+  EXPECT_EQ(dispatcher->Notify(data).code(),
+            absl::StatusCode::kResourceExhausted);
+  EXPECT_EQ(dispatcher->QueueSize(), 2);
+  EXPECT_EQ(dispatcher->Stats().dropped, 1);
+}
+
+TEST(DataDispatcherTest, TestSlowRecipientDoesNotStallOthers) {
+  BlockingClient slow_client, fast_client;
+  fast_client.Release();
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  dispatcher->AddRecepient(
+      absl::bind_front(&BlockingClient::Dispatch, &slow_client));
+  dispatcher->AddRecepient(
+      absl::bind_front(&BlockingClient::Dispatch, &fast_client));
+  dispatcher->Start();
+  NotifyFrames(dispatcher.get(), 3);
+  // The slow client is still stuck on the first frame.
+  while (fast_client.banks().size() < 3) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_THAT(fast_client.banks(), ::testing::ElementsAre(1, 2, 3));
+  EXPECT_TRUE(slow_client.banks().empty());
+  std::vector<RecipientStats> stats = dispatcher->GetRecipientStats();
+  EXPECT_EQ(stats[0].backlog, 3);
+  EXPECT_EQ(stats[1].backlog, 0);
+  EXPECT_EQ(stats[1].delivered, 3);
+
+  slow_client.Release();
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+  EXPECT_THAT(slow_client.banks(), ::testing::ElementsAre(1, 2, 3));
+}
+
+TEST(DataDispatcherTest, TestRecipientDropsOldestWhenFull) {
+  BlockingClient client;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  RecipientOptions options;
+  options.name = "slow";
+  options.queue_capacity = 2;
+  options.overflow_policy = OverflowPolicy::kDropOldest;
+  dispatcher->AddRecepient(absl::bind_front(&BlockingClient::Dispatch, &client),
+                           options);
+  dispatcher->Start();
+  // Wait for the first frame to be taken by the blocked callback, so the
+  // queue holds exactly the frames after it.
+  NotifyFrames(dispatcher.get(), 1);
+  client.WaitForFirstCall();
+  SimVars data;
+  for (int bank = 2; bank <= 5; ++bank) {
+    data.adiBank = bank;
+    dispatcher->Notify(data);
+  }
+  while (dispatcher->Stats().dispatched < 5) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  client.Release();
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+  EXPECT_THAT(client.banks(), ::testing::ElementsAre(1, 4, 5));
+  RecipientStats stats = dispatcher->GetRecipientStats()[0];
+  EXPECT_EQ(stats.name, "slow");
+  EXPECT_EQ(stats.delivered, 3);
+  EXPECT_EQ(stats.dropped, 2);
+}
+
+TEST(DataDispatcherTest, TestRecipientCoalescesToLatest) {
+  BlockingClient client;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  RecipientOptions options;
+  options.overflow_policy = OverflowPolicy::kCoalesce;
+  dispatcher->AddRecepient(absl::bind_front(&BlockingClient::Dispatch, &client),
+                           options);
+  dispatcher->Start();
+  NotifyFrames(dispatcher.get(), 1);
+  client.WaitForFirstCall();
+  SimVars data;
+  for (int bank = 2; bank <= 5; ++bank) {
+    data.adiBank = bank;
+    dispatcher->Notify(data);
+  }
+  while (dispatcher->Stats().dispatched < 5) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  client.Release();
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+  EXPECT_THAT(client.banks(), ::testing::ElementsAre(1, 5));
+  EXPECT_EQ(dispatcher->GetRecipientStats()[0].dropped, 3);
+}
+
+TEST(DataDispatcherTest, TestFrameRecipientsShareOneFrame) {
+  SimFramePtr frame1, frame2;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  dispatcher->AddFrameRecipient(
+      [&frame1](SimFramePtr frame) {
+        frame1 = frame;
+        return absl::OkStatus();
+      },
+      RecipientOptions());
+  dispatcher->AddFrameRecipient(
+      [&frame2](SimFramePtr frame) {
+        frame2 = frame;
+        return absl::OkStatus();
+      },
+      RecipientOptions());
+  dispatcher->Start();
+  NotifyFrames(dispatcher.get(), 1);
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+  ASSERT_NE(frame1, nullptr);
+  EXPECT_EQ(frame1, frame2);
+  EXPECT_THAT(frame1->data().instruments().bank_angle(), DoubleEq(1));
+}
+
+TEST(DataDispatcherTest, TestSuppressesUnchangedFrames) {
+  std::vector<SimFramePtr> frames;
+  absl::Mutex lock;
+  DispatcherOptions options;
+  options.suppress_unchanged = true;
+  options.heartbeat_interval = absl::InfiniteDuration();
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  dispatcher->AddFrameRecipient(
+      [&](SimFramePtr frame) {
+        absl::MutexLock l(&lock);
+        frames.push_back(frame);
+        return absl::OkStatus();
+      },
+      RecipientOptions());
+  dispatcher->Start();
+  SimVars data;
+  data.adiBank = 10;
+  dispatcher->Notify(data);
+  // Below the bank angle threshold.
+  data.adiBank = 10.01;
+  dispatcher->Notify(data);
+  data.adiBank = 20;
+  dispatcher->Notify(data);
+  while (dispatcher->Stats().dispatched + dispatcher->Stats().suppressed < 3) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+
+  EXPECT_EQ(dispatcher->Stats().dispatched, 2);
+  EXPECT_EQ(dispatcher->Stats().suppressed, 1);
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_TRUE(frames[0]->dirty().all());
+  data::DirtyMask expected;
+  expected.set(VarIndex("Attitude Indicator Bank Degrees"));
+  EXPECT_EQ(frames[1]->dirty(), expected);
+}
+
+TEST(DataDispatcherTest, TestHeartbeatPublishesUnchangedFrames) {
+  DispatcherOptions options;
+  options.suppress_unchanged = true;
+  options.heartbeat_interval = absl::ZeroDuration();
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  dispatcher->AddFrameRecipient(
+      [](SimFramePtr frame) { return absl::OkStatus(); }, RecipientOptions());
+  dispatcher->Start();
+  NotifyFrames(dispatcher.get(), 1);
+  SimVars data;
+  data.adiBank = 1;
+  dispatcher->Notify(data);
+  while (dispatcher->Stats().dispatched < 2) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  dispatcher->Stop();
+  EXPECT_EQ(dispatcher->Stats().suppressed, 0);
+}
+
+TEST(DataDispatcherTest, TestRecipientGetsEveryNthFrame) {
+  BlockingClient every_third, every_frame;
+  every_third.Release();
+  every_frame.Release();
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  RecipientOptions options;
+  options.every_nth = 3;
+  dispatcher->AddRecepient(
+      absl::bind_front(&BlockingClient::Dispatch, &every_third), options);
+  dispatcher->AddRecepient(
+      absl::bind_front(&BlockingClient::Dispatch, &every_frame));
+  dispatcher->Start();
+  NotifyFrames(dispatcher.get(), 6);
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+  EXPECT_THAT(every_third.banks(), ::testing::ElementsAre(3, 6));
+  EXPECT_EQ(every_frame.banks().size(), 6);
+  EXPECT_EQ(dispatcher->GetRecipientStats()[0].skipped, 4);
+  EXPECT_EQ(dispatcher->GetRecipientStats()[1].skipped, 0);
+}
+
+TEST(DataDispatcherTest, TestFramesNoRecipientIsDueForAreSkipped) {
+  BlockingClient client;
+  client.Release();
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  RecipientOptions options;
+  options.min_interval = absl::Hours(1);
+  dispatcher->AddRecepient(absl::bind_front(&BlockingClient::Dispatch, &client),
+                           options);
+  dispatcher->Start();
+  SimVars data;
+  for (int bank = 1; bank <= 4; ++bank) {
+    data.adiBank = bank;
+    dispatcher->Notify(data);
+  }
+  while (dispatcher->Stats().dispatched + dispatcher->Stats().skipped < 4) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+  // Only the first frame is delivered within the interval, and the others
+  // are never converted.
+  EXPECT_THAT(client.banks(), ::testing::ElementsAre(1));
+  EXPECT_EQ(dispatcher->Stats().dispatched, 1);
+  EXPECT_EQ(dispatcher->Stats().skipped, 3);
+  EXPECT_EQ(dispatcher->GetRecipientStats()[0].skipped, 3);
+}
+
+TEST(DataDispatcherTest, TestFramesWithoutRecipientsAreSkipped) {
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  dispatcher->Start();
+  SimVars data;
+  for (int bank = 1; bank <= 3; ++bank) {
+    data.adiBank = bank;
+    dispatcher->Notify(data);
+  }
+  while (dispatcher->Stats().skipped + dispatcher->Stats().suppressed < 3) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  dispatcher->Stop();
+  EXPECT_EQ(dispatcher->Stats().skipped, 3);
+  EXPECT_EQ(dispatcher->Stats().suppressed, 0);
+  EXPECT_EQ(dispatcher->Stats().dispatched, 0);
+}
+
+// Keeps the frames a recipient got.
+class FrameRecorder {
+ public:
+  absl::Status Record(SimFramePtr frame) {
+    absl::MutexLock l(&lock_);
+    frames_.push_back(std::move(frame));
+    return absl::OkStatus();
+  }
+  std::vector<SimFramePtr> frames() {
+    absl::MutexLock l(&lock_);
+    return frames_;
+  }
+
+ private:
+  absl::Mutex lock_;
+  std::vector<SimFramePtr> frames_;
+};
+
+// Waits until the worker took `count` frames.
+void WaitUntilTaken(DataDispatcher* dispatcher, int count) {
+  while (true) {
+    const DispatcherStats stats = dispatcher->Stats();
+    if (stats.dispatched + stats.suppressed + stats.skipped >= count) break;
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+}
+
+TEST(DataDispatcherTest, TestSuppressedChangeReachesEveryNthRecipient) {
+  DispatcherOptions options;
+  options.suppress_unchanged = true;
+  options.heartbeat_interval = absl::InfiniteDuration();
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  FrameRecorder every_second, every_frame;
+  RecipientOptions every_second_options;
+  every_second_options.every_nth = 2;
+  dispatcher->AddFrameRecipient(
+      absl::bind_front(&FrameRecorder::Record, &every_second),
+      every_second_options);
+  dispatcher->AddFrameRecipient(
+      absl::bind_front(&FrameRecorder::Record, &every_frame),
+      RecipientOptions());
+  dispatcher->Start();
+  SimVars data;
+  // Every change comes in a frame the every-second recipient skips, and is
+  // followed by an unchanged frame.
+  for (double bank : {10, 10, 20, 20}) {
+    data.adiBank = bank;
+    dispatcher->Notify(data);
+  }
+  WaitUntilTaken(dispatcher.get(), 4);
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+
+  const std::vector<SimFramePtr> frames = every_second.frames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[0]->data().instruments().bank_angle(), 10);
+  EXPECT_TRUE(frames[0]->dirty().all());
+  EXPECT_EQ(frames[1]->data().instruments().bank_angle(), 20);
+  data::DirtyMask bank;
+  bank.set(VarIndex("Attitude Indicator Bank Degrees"));
+  EXPECT_EQ(frames[1]->dirty(), bank);
+  // The other recipient only gets the changes.
+  ASSERT_EQ(every_frame.frames().size(), 2);
+  EXPECT_EQ(every_frame.frames()[1]->dirty(), bank);
+  EXPECT_EQ(dispatcher->Stats().suppressed, 0);
+}
+
+TEST(DataDispatcherTest, TestEveryNthCountsUnchangedFrames) {
+  DispatcherOptions options;
+  options.suppress_unchanged = true;
+  options.heartbeat_interval = absl::InfiniteDuration();
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  FrameRecorder every_second;
+  RecipientOptions every_second_options;
+  every_second_options.every_nth = 2;
+  dispatcher->AddFrameRecipient(
+      absl::bind_front(&FrameRecorder::Record, &every_second),
+      every_second_options);
+  dispatcher->Start();
+  SimVars data;
+  // The second frame is due. The unchanged third frame counts, so the fourth
+  // one is due again.
+  for (double bank : {10, 10, 10, 20}) {
+    data.adiBank = bank;
+    dispatcher->Notify(data);
+  }
+  WaitUntilTaken(dispatcher.get(), 4);
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+
+  const std::vector<SimFramePtr> frames = every_second.frames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[1]->data().instruments().bank_angle(), 20);
+  EXPECT_EQ(dispatcher->Stats().suppressed, 1);
+  EXPECT_EQ(dispatcher->Stats().skipped, 1);
+}
+
+TEST(DataDispatcherTest, TestSuppressedChangeReachesRateLimitedRecipient) {
+  DispatcherOptions options;
+  options.suppress_unchanged = true;
+  options.heartbeat_interval = absl::InfiniteDuration();
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  FrameRecorder recorder;
+  RecipientOptions recipient_options;
+  recipient_options.max_rate_hz = 20;
+  dispatcher->AddFrameRecipient(
+      absl::bind_front(&FrameRecorder::Record, &recorder), recipient_options);
+  dispatcher->Start();
+  SimVars data;
+  data.adiBank = 10;
+  dispatcher->Notify(data);
+  // Changed, but within 50 ms of the first frame.
+  data.adiBank = 20;
+  dispatcher->Notify(data);
+  WaitUntilTaken(dispatcher.get(), 2);
+  EXPECT_EQ(dispatcher->Stats().skipped, 1);
+  absl::SleepFor(absl::Milliseconds(60));
+  // Unchanged since the skipped frame, yet the recipient has not seen it.
+  dispatcher->Notify(data);
+  WaitUntilTaken(dispatcher.get(), 3);
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+
+  const std::vector<SimFramePtr> frames = recorder.frames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[1]->data().instruments().bank_angle(), 20);
+  data::DirtyMask bank;
+  bank.set(VarIndex("Attitude Indicator Bank Degrees"));
+  EXPECT_EQ(frames[1]->dirty(), bank);
+  EXPECT_EQ(dispatcher->Stats().suppressed, 0);
+}
+
+// Waits until the recipients delivered `count` frames in total.
+void WaitUntilDeliveredCount(DataDispatcher* dispatcher, int count) {
+  while (true) {
+    int64_t delivered = 0;
+    for (const RecipientStats& stats : dispatcher->GetRecipientStats()) {
+      delivered += stats.delivered;
+    }
+    if (delivered >= count) break;
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+}
+
+TEST(DataDispatcherTest, TestCoalescedFrameKeepsItsChanges) {
+  DispatcherOptions options;
+  options.suppress_unchanged = true;
+  options.heartbeat_interval = absl::InfiniteDuration();
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  FrameRecorder recorder;
+  absl::Notification first_call, release;
+  RecipientOptions recipient_options;
+  recipient_options.overflow_policy = OverflowPolicy::kCoalesce;
+  dispatcher->AddFrameRecipient(
+      [&](SimFramePtr frame) {
+        if (!first_call.HasBeenNotified()) first_call.Notify();
+        release.WaitForNotification();
+        return recorder.Record(std::move(frame));
+      },
+      recipient_options);
+  dispatcher->Start();
+  SimVars data;
+  dispatcher->Notify(data);
+  first_call.WaitForNotification();
+  // Only the bank changes in the second frame, which the third one replaces
+  // in the lane while the recipient is busy.
+  data.adiBank = 10;
+  dispatcher->Notify(data);
+  data.altAltitude = 100;
+  dispatcher->Notify(data);
+  WaitUntilTaken(dispatcher.get(), 3);
+  EXPECT_EQ(dispatcher->GetRecipientStats()[0].dropped, 1);
+  release.Notify();
+  WaitUntilDeliveredCount(dispatcher.get(), 2);
+  // Unchanged, but the recipient still has to learn about the bank.
+  dispatcher->Notify(data);
+  WaitUntilTaken(dispatcher.get(), 4);
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+
+  const std::vector<SimFramePtr> frames = recorder.frames();
+  ASSERT_EQ(frames.size(), 3);
+  const int bank = VarIndex("Attitude Indicator Bank Degrees");
+  const int altitude = VarIndex("Indicated Altitude");
+  data::DirtyMask expected;
+  expected.set(altitude);
+  EXPECT_EQ(frames[1]->dirty(), expected);
+  expected.reset();
+  expected.set(bank);
+  EXPECT_EQ(frames[2]->dirty(), expected);
+  EXPECT_EQ(frames[2]->data().instruments().bank_angle(), 10);
+}
+
+TEST(DataDispatcherTest, TestStopsWhileBlockingRecipientIsStalled) {
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  FrameRecorder recorder;
+  absl::Notification first_call, release;
+  RecipientOptions recipient_options;
+  recipient_options.overflow_policy = OverflowPolicy::kBlock;
+  recipient_options.queue_capacity = 1;
+  dispatcher->AddFrameRecipient(
+      [&](SimFramePtr frame) {
+        if (!first_call.HasBeenNotified()) first_call.Notify();
+        release.WaitForNotification();
+        return recorder.Record(std::move(frame));
+      },
+      recipient_options);
+  dispatcher->Start();
+  SimVars data;
+  for (int bank = 1; bank <= 3; ++bank) {
+    data.adiBank = bank;
+    dispatcher->Notify(data);
+  }
+  // The recipient is busy with the first frame and the second fills the
+  // queue, so the worker blocks on the third.
+  first_call.WaitForNotification();
+  while (dispatcher->GetRecipientStats()[0].backlog < 2) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  absl::SleepFor(absl::Milliseconds(50));
+  EXPECT_EQ(dispatcher->Stats().dispatched, 2);
+
+  absl::Notification stopped;
+  std::thread stopper([&] {
+    dispatcher->Stop();
+    stopped.Notify();
+  });
+  // The worker gives up on the full lane instead of waiting for the
+  // recipient.
+  const absl::Time deadline = absl::Now() + absl::Seconds(5);
+  while (dispatcher->Stats().dispatched < 3 && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_EQ(dispatcher->Stats().dispatched, 3);
+  // Stop() still waits for the frame being delivered.
+  EXPECT_FALSE(stopped.HasBeenNotified());
+  release.Notify();
+  stopper.join();
+  // The queued frame was discarded.
+  const std::vector<SimFramePtr> frames = recorder.frames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0]->data().instruments().bank_angle(), 1);
+}
+
+TEST(DataDispatcherTest, TestDriftIsPublishedWhileOtherVarsChange) {
+  DispatcherOptions options;
+  options.suppress_unchanged = true;
+  options.heartbeat_interval = absl::InfiniteDuration();
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  FrameRecorder recorder;
+  dispatcher->AddFrameRecipient(
+      absl::bind_front(&FrameRecorder::Record, &recorder), RecipientOptions());
+  dispatcher->Start();
+  SimVars data;
+  for (int frame = 0; frame < 4; ++frame) {
+    data.adiBank = 0.02 * frame;
+    data.altAltitude = 10 * frame;
+    dispatcher->Notify(data);
+  }
+  WaitUntilTaken(dispatcher.get(), 4);
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+
+  const std::vector<SimFramePtr> frames = recorder.frames();
+  ASSERT_EQ(frames.size(), 4);
+  const int bank = VarIndex("Attitude Indicator Bank Degrees");
+  EXPECT_FALSE(frames[1]->dirty().test(bank));
+  EXPECT_FALSE(frames[2]->dirty().test(bank));
+  // 0.06 since the first frame.
+  EXPECT_TRUE(frames[3]->dirty().test(bank));
+}
+
+TEST(DataDispatcherTest, TestStampTravelsWithFrame) {
+  trace::ResetLatency();
+  SimFramePtr delivered;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  RecipientOptions options;
+  options.name = "stamp_test";
+  dispatcher->AddFrameRecipient(
+      [&delivered](SimFramePtr frame) {
+        delivered = frame;
+        return absl::OkStatus();
+      },
+      options);
+  dispatcher->Start();
+  trace::FrameStamp stamp;
+  stamp.sequence = 7;
+  stamp.received_ns = trace::MonotonicNanos();
+  dispatcher->Notify(SimVars(), stamp);
+  while (dispatcher->Stats().dispatched < 1) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+  ASSERT_NE(delivered, nullptr);
+  EXPECT_EQ(delivered->stamp().sequence, 7);
+  EXPECT_EQ(delivered->stamp().received_ns, stamp.received_ns);
+  EXPECT_EQ(
+      trace::GetLatencyHistogram(trace::Stage::kDelivery, "stamp_test")
+          ->Count(),
+      1);
+  EXPECT_EQ(trace::GetLatencyHistogram(trace::Stage::kEnqueue)->Count(), 1);
+  EXPECT_EQ(trace::GetLatencyHistogram(trace::Stage::kConvert)->Count(), 1);
+}
+
+TEST(DataDispatcherTest, TestLeasedFrameIsDispatched) {
+  SimFramePtr delivered;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher();
+  dispatcher->AddFrameRecipient(
+      [&delivered](SimFramePtr frame) {
+        delivered = frame;
+        return absl::OkStatus();
+      },
+      RecipientOptions());
+  dispatcher->Start();
+  FrameLease frame = dispatcher->LeaseFrame();
+  frame->vars.adiBank = 12;
+  frame->stamp.sequence = 3;
+  frame->changed.set(VarIndex("Attitude Indicator Bank Degrees"));
+  EXPECT_TRUE(dispatcher->Commit(std::move(frame)).ok());
+  while (dispatcher->Stats().dispatched < 1) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+  ASSERT_NE(delivered, nullptr);
+  EXPECT_THAT(delivered->data().instruments().bank_angle(), DoubleEq(12));
+  EXPECT_EQ(delivered->stamp().sequence, 3);
+  EXPECT_EQ(delivered->dirty().count(), 1);
+}
+
+TEST(DataDispatcherTest, TestChangedMaskBecomesDirtyMask) {
+  std::vector<SimFramePtr> frames;
+  absl::Mutex lock;
+  DispatcherOptions options;
+  options.queue_mode = QueueMode::kLatestOnly;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  dispatcher->AddFrameRecipient(
+      [&](SimFramePtr frame) {
+        absl::MutexLock l(&lock);
+        frames.push_back(frame);
+        return absl::OkStatus();
+      },
+      RecipientOptions());
+  // Notify before the worker starts, so the two frames are coalesced and the
+  // published one carries the changes of both.
+  data::DirtyMask bank, pitch;
+  bank.set(VarIndex("Attitude Indicator Bank Degrees"));
+  pitch.set(VarIndex("Attitude Indicator Pitch Degrees"));
+  dispatcher->Notify(SimVars(), trace::FrameStamp(), bank);
+  dispatcher->Notify(SimVars(), trace::FrameStamp(), pitch);
+  dispatcher->Start();
+  while (dispatcher->Stats().dispatched < 1) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0]->dirty(), bank | pitch);
+}
+
+TEST(DataDispatcherTest, TestFrameAfterRingDropMarksEverything) {
+  std::vector<SimFramePtr> frames;
+  absl::Mutex lock;
+  DispatcherOptions options;
+  options.queue_mode = QueueMode::kSpscRing;
+  options.ring_capacity = 1;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  dispatcher->AddFrameRecipient(
+      [&](SimFramePtr frame) {
+        absl::MutexLock l(&lock);
+        frames.push_back(frame);
+        return absl::OkStatus();
+      },
+      RecipientOptions());
+  data::DirtyMask bank;
+  bank.set(VarIndex("Attitude Indicator Bank Degrees"));
+  EXPECT_TRUE(dispatcher->Notify(SimVars(), trace::FrameStamp(), bank).ok());
+  // Dropped, its changes are lost.
+  EXPECT_FALSE(dispatcher->Notify(SimVars(), trace::FrameStamp(), bank).ok());
+  dispatcher->Start();
+  while (dispatcher->QueueSize() > 0) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_TRUE(dispatcher->Notify(SimVars(), trace::FrameStamp(), bank).ok());
+  while (dispatcher->Stats().dispatched < 2) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  WaitUntilDelivered(dispatcher.get());
+  dispatcher->Stop();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[0]->dirty(), bank);
+  EXPECT_TRUE(frames[1]->dirty().all());
+}
+
+TEST(DataDispatcherTest, TestCountsSequenceGaps) {
+  DispatcherOptions options;
+  options.queue_mode = QueueMode::kLatestOnly;
+  std::unique_ptr<DataDispatcher> dispatcher = CreateDispatcher(options);
+  dispatcher->AddFrameRecipient(
+      [](SimFramePtr frame) { return absl::OkStatus(); }, RecipientOptions());
+  trace::FrameStamp stamp;
+  stamp.sequence = 1;
+  dispatcher->Notify(SimVars(), stamp);
+  dispatcher->Start();
+  while (dispatcher->QueueSize() > 0) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  // Frame 4 arrives after 2 and 3 were lost upstream.
+  stamp.sequence = 4;
+  dispatcher->Notify(SimVars(), stamp);
+  while (dispatcher->Stats().dispatched < 2) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  dispatcher->Stop();
+  EXPECT_EQ(dispatcher->Stats().sequence_gaps, 2);
+}
+
+TEST(ChangeDetectorTest, TestEverythingIsDirtyBeforeFirstPublish) {
+  ChangeDetector detector;
+  data::DirtyMask dirty = detector.Compare(SimVars());
+  EXPECT_TRUE(dirty.test(0));
+  EXPECT_TRUE(dirty.test(VarIndex("Title")));
+}
+
+TEST(ChangeDetectorTest, TestIgnoresChangesBelowThreshold) {
+  ChangeDetector detector;
+  SimVars data;
+  data.adiBank = 10;
+  detector.Publish(data, detector.Compare(data));
+  EXPECT_TRUE(detector.Compare(data).none());
+  data.adiBank = 10.04;
+  EXPECT_TRUE(detector.Compare(data).none());
+  data.adiBank = 10.06;
+  data::DirtyMask dirty = detector.Compare(data);
+  EXPECT_EQ(dirty.count(), 1);
+  EXPECT_TRUE(dirty.test(VarIndex("Attitude Indicator Bank Degrees")));
+}
+
+TEST(ChangeDetectorTest, TestComparesAgainstPublishedFrame) {
+  ChangeDetector detector;
+  SimVars data;
+  detector.Publish(data, detector.Compare(data));
+  // Small steps add up, since the reference only moves on Publish().
+  data.adiBank = 0.04;
+  EXPECT_TRUE(detector.Compare(data).none());
+  data.adiBank = 0.08;
+  EXPECT_FALSE(detector.Compare(data).none());
+}
+
+TEST(ChangeDetectorTest, TestDriftAddsUpWhileOtherVarsChange) {
+  ChangeDetector detector;
+  SimVars data;
+  detector.Publish(data, detector.Compare(data));
+  const int bank = VarIndex("Attitude Indicator Bank Degrees");
+  const int altitude = VarIndex("Indicated Altitude");
+  // The bank drifts below its 0.05 threshold on every frame, while the
+  // altitude changes on every frame and gets published.
+  int frames_until_dirty = 0;
+  for (int frame = 1; frame <= 10; ++frame) {
+    data.adiBank += 0.02;
+    data.altAltitude += 10;
+    const data::DirtyMask dirty = detector.Compare(data);
+    EXPECT_TRUE(dirty.test(altitude));
+    detector.Publish(data, dirty);
+    if (dirty.test(bank)) {
+      frames_until_dirty = frame;
+      break;
+    }
+  }
+  EXPECT_EQ(frames_until_dirty, 3);
+}
+
+TEST(ChangeDetectorTest, TestMapsVarsAfterStrings) {
+  ChangeDetector detector;
+  SimVars data;
+  detector.Publish(data, detector.Compare(data));
+  data.atcHeavy = 1;
+  data::DirtyMask dirty = detector.Compare(data);
+  EXPECT_EQ(dirty.count(), 1);
+  EXPECT_TRUE(dirty.test(VarIndex("Atc Heavy")));
+}
+
+TEST(SimFrameTest, TestSerializedDataIsCached) {
+  SimData data;
+  data.mutable_instruments()->set_bank_angle(30);
+  SimFrame frame(data);
+  const std::string& serialized = frame.SerializedData();
+  EXPECT_EQ(serialized, data.SerializeAsString());
+  // The second call returns the same buffer instead of serializing again.
+  EXPECT_EQ(&frame.SerializedData(), &serialized);
+}
+
+TEST(SpscRingTest, TestPushPopInOrder) {
+  SpscRing<int> ring(3);
+  // Capacity is rounded up to a power of two.
+  EXPECT_EQ(ring.Capacity(), 4);
+  for (int i = 0; i < 4; ++i) EXPECT_TRUE(ring.TryPush(i));
+  EXPECT_FALSE(ring.TryPush(4));
+  int item;
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(ring.TryPop(&item));
+    EXPECT_EQ(item, i);
+  }
+  EXPECT_FALSE(ring.TryPop(&item));
+  EXPECT_TRUE(ring.Empty());
+}
+
+TEST(SpscRingTest, TestConcurrentProducerConsumer) {
+  constexpr int kItemCount = 100000;
+  SpscRing<int> ring(8);
+  std::thread producer([&ring] {
+    for (int i = 0; i < kItemCount; ++i) {
+      while (!ring.TryPush(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  int expected = 0;
+  int item;
+  while (expected < kItemCount) {
+    if (!ring.TryPop(&item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_EQ(item, expected);
+    ++expected;
+  }
+  producer.join();
+  EXPECT_TRUE(ring.Empty());
+}
+
 }  // namespace
 }  // namespace data_dispatcher
 }  // namespace flight_panel
\ No newline at end of file
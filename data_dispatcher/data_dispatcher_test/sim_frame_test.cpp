@@ -0,0 +1,150 @@
+#include "data_dispatcher/sim_frame.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "data_def/util.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Allocations made by the current thread. The test binary replaces the
+// global operator new to count them.
+thread_local int64_t thread_allocation_count = 0;
+
+void* CountedAlloc(size_t size) {
+  ++thread_allocation_count;
+  if (void* ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+  throw std::bad_alloc();
+}
+
+}  // namespace
+
+void* operator new(size_t size) { return CountedAlloc(size); }
+void* operator new[](size_t size) { return CountedAlloc(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+namespace flight_panel {
+namespace data_dispatcher {
+namespace {
+
+data::SimVars SampleFrame(int i) {
+  data::SimVars vars;
+  vars.adiBank = i;
+  vars.asiAirspeed = 100 + i;
+  vars.transponderCode = 4660;
+  return vars;
+}
+
+data::SimIdentity SampleIdentity() {
+  data::SimIdentity identity;
+  strncpy(identity.aircraft, "Cessna Skyhawk G1000 Asobo",
+          sizeof(identity.aircraft));
+  strncpy(identity.atcCallSign, "HAPPY", sizeof(identity.atcCallSign));
+  return identity;
+}
+
+TEST(SimFramePoolTest, TestReusesReleasedFrames) {
+  data::SimIdentity identity = SampleIdentity();
+  SimFramePool pool(2);
+  const SimFrame* first =
+      pool.Acquire(SampleFrame(1), identity, {}, {}).get();
+  SimFramePtr held = pool.Acquire(SampleFrame(2), identity, {}, {});
+  EXPECT_EQ(pool.size(), 1);
+  EXPECT_EQ(held.get(), first);
+
+  // The held frame is not refilled, a second frame joins the pool.
+  SimFramePtr other = pool.Acquire(SampleFrame(3), identity, {}, {});
+  EXPECT_NE(other.get(), held.get());
+  EXPECT_EQ(pool.size(), 2);
+  EXPECT_EQ(held->data().instruments().bank_angle(), 2);
+  EXPECT_EQ(other->data().instruments().bank_angle(), 3);
+}
+
+TEST(SimFramePoolTest, TestFallsBackWhenFull) {
+  data::SimIdentity identity = SampleIdentity();
+  SimFramePool pool(1);
+  SimFramePtr held = pool.Acquire(SampleFrame(1), identity, {}, {});
+  SimFramePtr extra = pool.Acquire(SampleFrame(2), identity, {}, {});
+  EXPECT_NE(extra.get(), held.get());
+  EXPECT_EQ(pool.size(), 1);
+}
+
+TEST(SimFramePoolTest, TestRefilledFrameIsSerializedAgain) {
+  data::SimIdentity identity = SampleIdentity();
+  SimFramePool pool(1);
+  trace::FrameStamp stamp;
+  stamp.sequence = 7;
+  std::string first =
+      pool.Acquire(SampleFrame(1), identity, {}, {})->SerializedData();
+  SimFramePtr frame = pool.Acquire(SampleFrame(2), identity,
+                                   data::DirtyMask().set(3), stamp);
+  EXPECT_NE(frame->SerializedData(), first);
+  EXPECT_EQ(frame->SerializedData(),
+            data::ToSimData(SampleFrame(2), identity).SerializeAsString());
+  EXPECT_EQ(frame->dirty().count(), 1);
+  EXPECT_EQ(frame->stamp().sequence, 7);
+}
+
+TEST(SimFramePoolTest, TestSteadyStateDoesNotAllocate) {
+  data::SimIdentity identity = SampleIdentity();
+  SimFramePool pool(4);
+  // Warm up: the first frames create the sub-messages and buffers.
+  for (int i = 0; i < 4; ++i) {
+    pool.Acquire(SampleFrame(i), identity, {}, {})->SerializedData();
+  }
+  data::SimVars vars = SampleFrame(0);
+  const int64_t start = thread_allocation_count;
+  for (int i = 0; i < 100; ++i) {
+    vars.adiBank = i;
+    // Strings change too, but never grow past what the frames held before.
+    strncpy(identity.atcCallSign, i % 2 ? "HAPPY" : "SAD",
+            sizeof(identity.atcCallSign));
+    SimFramePtr frame = pool.Acquire(vars, identity, {}, {});
+    frame->SerializedData();
+  }
+  EXPECT_EQ(thread_allocation_count - start, 0);
+}
+
+TEST(FrameBufferPoolTest, TestReusesReleasedBuffers) {
+  FrameBufferPool pool(2);
+  EXPECT_EQ(pool.size(), 2);
+  FrameBuffer* first = pool.Lease().get();
+  FrameLease held = pool.Lease();
+  FrameLease other = pool.Lease();
+  EXPECT_NE(held.get(), other.get());
+  EXPECT_TRUE(held.get() == first || other.get() == first);
+}
+
+TEST(FrameBufferPoolTest, TestFallsBackWhenAllHeld) {
+  FrameBufferPool pool(1);
+  FrameBufferPtr committed = pool.Lease();
+  FrameLease extra = pool.Lease();
+  EXPECT_NE(extra.get(), committed.get());
+  EXPECT_EQ(pool.size(), 1);
+}
+
+TEST(FrameBufferPoolTest, TestSteadyStateDoesNotAllocate) {
+  FrameBufferPool pool(4);
+  FrameBufferPtr previous;
+  const int64_t start = thread_allocation_count;
+  for (int i = 0; i < 100; ++i) {
+    // The producer keeps the last frame while it fills the next one.
+    FrameLease frame = pool.Lease();
+    frame->vars = previous ? previous->vars : SampleFrame(0);
+    frame->vars.adiBank = i;
+    previous = std::move(frame);
+  }
+  EXPECT_EQ(thread_allocation_count - start, 0);
+  EXPECT_EQ(previous->vars.adiBank, 99);
+}
+
+}  // namespace
+}  // namespace data_dispatcher
+}  // namespace flight_panel
@@ -0,0 +1,144 @@
+#include "data_dispatcher/recipient_lane.h"
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+#include "trace/trace.h"
+
+namespace flight_panel {
+namespace data_dispatcher {
+namespace {
+
+absl::Duration DeliveryInterval(const RecipientOptions& options) {
+  if (options.max_rate_hz <= 0) return options.min_interval;
+  return std::max(options.min_interval, absl::Seconds(1 / options.max_rate_hz));
+}
+
+}  // namespace
+
+RecipientLane::RecipientLane(FrameCallback callback,
+                             RecipientOptions options)
+    : callback_(callback),
+      options_(options),
+      interval_(DeliveryInterval(options)),
+      delivery_latency_(
+          trace::GetLatencyHistogram(trace::Stage::kDelivery, options.name)) {
+  stats_.name = options_.name;
+}
+
+RecipientLane::~RecipientLane() { Stop(); }
+
+void RecipientLane::Start() {
+  {
+    absl::MutexLock l(&lock_);
+    stopping_ = false;
+  }
+  worker_ = std::thread(&RecipientLane::Run, this);
+}
+
+void RecipientLane::Stop() {
+  if (!worker_.joinable()) return;
+  RequestStop();
+  worker_.join();
+}
+
+void RecipientLane::RequestStop() {
+  absl::MutexLock l(&lock_);
+  stopping_ = true;
+  frames_.clear();
+}
+
+bool RecipientLane::IsDue(absl::Time now) {
+  if (++frames_since_due_ < options_.every_nth || now < next_due_) {
+    skipped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  frames_since_due_ = 0;
+  // Schedule from the previous due time rather than from now, so frame jitter
+  // does not lower the average rate. After a pause, restart from now instead
+  // of letting a burst of frames through.
+  next_due_ += interval_;
+  if (next_due_ <= now) next_due_ = now + interval_;
+  return true;
+}
+
+data::DirtyMask RecipientLane::TakePending() {
+  const data::DirtyMask pending = pending_;
+  pending_.reset();
+  return pending;
+}
+
+void RecipientLane::Push(SimFramePtr frame) {
+  absl::MutexLock l(&lock_);
+  if (stopping_) return;
+  const int capacity = options_.overflow_policy == OverflowPolicy::kCoalesce
+                           ? 1
+                           : std::max(options_.queue_capacity, 1);
+  if (static_cast<int>(frames_.size()) >= capacity) {
+    if (options_.overflow_policy == OverflowPolicy::kBlock) {
+      auto has_room_or_stopping = [this, capacity] {
+        return stopping_ || static_cast<int>(frames_.size()) < capacity;
+      };
+      lock_.Await(absl::Condition(&has_room_or_stopping));
+      if (stopping_) return;
+    } else {
+      // The recipient never sees this frame, so the next one it gets marks
+      // its changes.
+      pending_ |= frames_.front()->dirty();
+      frames_.pop_front();
+      ++stats_.dropped;
+      FP_TRACE(kInfo, kLaneDropped, frames_.size(), 0);
+    }
+  }
+  frames_.push_back(std::move(frame));
+}
+
+int RecipientLane::Backlog() {
+  absl::MutexLock l(&lock_);
+  return frames_.size() + (delivering_ ? 1 : 0);
+}
+
+RecipientStats RecipientLane::Stats() {
+  absl::MutexLock l(&lock_);
+  RecipientStats stats = stats_;
+  stats.skipped = skipped_.load(std::memory_order_relaxed);
+  stats.backlog = frames_.size() + (delivering_ ? 1 : 0);
+  return stats;
+}
+
+void RecipientLane::Run() {
+  auto has_frame_or_stopping = [this] {
+    return stopping_ || !frames_.empty();
+  };
+  while (true) {
+    SimFramePtr frame;
+    {
+      absl::MutexLock l(&lock_);
+      lock_.Await(absl::Condition(&has_frame_or_stopping));
+      if (stopping_) return;
+      frame = std::move(frames_.front());
+      frames_.pop_front();
+      delivering_ = true;
+    }
+    // Call the recipient without holding the lock, so the dispatcher can keep
+    // queueing frames while a slow recipient works.
+    const int64_t received_ns = frame->stamp().received_ns;
+    absl::Status status = callback_(std::move(frame));
+    if (received_ns != 0) {
+      delivery_latency_->Record(trace::MonotonicNanos() - received_ns);
+    }
+
+    absl::MutexLock l(&lock_);
+    delivering_ = false;
+    ++stats_.delivered;
+    FP_TRACE(kDebug, kLaneDelivered, frames_.size(), status.ok() ? 0 : 1);
+    if (!status.ok()) {
+      ++stats_.errors;
+      spdlog::warn("Recipient {} failed: {}", options_.name,
+                   status.ToString());
+    }
+  }
+}
+
+}  // namespace data_dispatcher
+}  // namespace flight_panel
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "data_def/proto/sim_data.pb.h"
+#include "data_dispatcher/data_dispatcher.h"
+#include "data_dispatcher/sim_frame.h"
+#include "trace/latency.h"
+
+namespace flight_panel {
+namespace data_dispatcher {
+
+// The delivery lane of one recipient: a bounded frame queue and a thread that
+// calls the recipient's callback. Frames are shared between lanes, so pushing
+// a frame to a lane never copies it.
+class RecipientLane {
+ public:
+  RecipientLane(FrameCallback callback, RecipientOptions options);
+  ~RecipientLane();
+
+  void Start() LOCKS_EXCLUDED(lock_);
+  // Stops the lane thread. Queued frames are discarded.
+  void Stop() LOCKS_EXCLUDED(lock_);
+  // Discards the queued frames and every frame pushed from now on, and wakes
+  // up a Push() blocked on a full kBlock queue. The lane thread stops after
+  // the frame it is delivering, Stop() waits for it.
+  void RequestStop() LOCKS_EXCLUDED(lock_);
+
+  // Whether the recipient wants a frame that arrived at `now`, according to its
+  // rate limits. A frame the lane is not due for is counted as skipped. Either
+  // this or CountIdleFrame() must be called once per frame, from the
+  // dispatcher worker only.
+  bool IsDue(absl::Time now);
+  // Counts a frame the lane has nothing to be sent for, so every_nth counts
+  // sim frames whether they changed or not.
+  void CountIdleFrame() {
+    if (frames_since_due_ < options_.every_nth) ++frames_since_due_;
+  }
+
+  // The vars that changed in frames the lane was not sent, because it was
+  // not due for them or dropped them when its queue was full. Only used by
+  // the dispatcher worker.
+  void AddPending(const data::DirtyMask& dirty) { pending_ |= dirty; }
+  const data::DirtyMask& pending() const { return pending_; }
+  // Returns the pending vars and clears them, for a frame sent to the lane.
+  data::DirtyMask TakePending();
+
+  // Queues a frame for the recipient, applying the overflow policy when the
+  // queue is full. The changes of a dropped frame are kept pending. Only
+  // called by the dispatcher worker.
+  void Push(SimFramePtr frame) LOCKS_EXCLUDED(lock_);
+
+  // Frames queued or being delivered.
+  int Backlog() LOCKS_EXCLUDED(lock_);
+  RecipientStats Stats() LOCKS_EXCLUDED(lock_);
+
+ private:
+  void Run() LOCKS_EXCLUDED(lock_);
+
+  const FrameCallback callback_;
+  const RecipientOptions options_;
+  // The larger of min_interval and 1 / max_rate_hz.
+  const absl::Duration interval_;
+  // Time from receipt of a frame until the callback returned.
+  trace::LatencyHistogram* const delivery_latency_;
+  std::thread worker_;
+
+  // Cadence state, only used by IsDue().
+  int frames_since_due_ = 0;
+  absl::Time next_due_ = absl::InfinitePast();
+  data::DirtyMask pending_;
+  std::atomic<int64_t> skipped_{0};
+
+  absl::Mutex lock_;
+  std::deque<SimFramePtr> frames_ GUARDED_BY(lock_);
+  bool stopping_ GUARDED_BY(lock_) = false;
+  // Whether the callback is running for a frame popped from frames_.
+  bool delivering_ GUARDED_BY(lock_) = false;
+  RecipientStats stats_ GUARDED_BY(lock_);
+};
+
+}  // namespace data_dispatcher
+}  // namespace flight_panel
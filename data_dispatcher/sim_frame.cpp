@@ -0,0 +1,81 @@
+#include "data_dispatcher/sim_frame.h"
+
+#include <atomic>
+
+#include "data_def/util.h"
+
+namespace flight_panel {
+namespace data_dispatcher {
+
+const std::string& SimFrame::SerializedData() const {
+  absl::MutexLock l(&serialize_lock_);
+  if (!serialized_) {
+    serialized_data_.resize(data_.ByteSizeLong());
+    data_.SerializeToArray(&serialized_data_[0], serialized_data_.size());
+    serialized_ = true;
+  }
+  return serialized_data_;
+}
+
+void SimFrame::Refill(const data::SimVars& vars,
+                      const data::SimIdentity& identity,
+                      const data::DirtyMask& dirty,
+                      const trace::FrameStamp& stamp) {
+  // ToSimData sets every field, so nothing of the previous frame survives.
+  data::ToSimData(vars, identity, &data_);
+  dirty_ = dirty;
+  stamp_ = stamp;
+  absl::MutexLock l(&serialize_lock_);
+  serialized_ = false;
+}
+
+SimFramePool::SimFramePool(int capacity) : capacity_(capacity) {
+  frames_.reserve(capacity_);
+}
+
+SimFramePtr SimFramePool::Acquire(const data::SimVars& vars,
+                                  const data::SimIdentity& identity,
+                                  const data::DirtyMask& dirty,
+                                  const trace::FrameStamp& stamp) {
+  for (size_t i = 0; i < frames_.size(); ++i) {
+    const size_t index = (next_ + i) % frames_.size();
+    std::shared_ptr<SimFrame>& frame = frames_[index];
+    if (frame.use_count() != 1) continue;
+    // Pairs with the release of the last recipient's reference, so its reads
+    // of the frame happen before the refill.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    frame->Refill(vars, identity, dirty, stamp);
+    next_ = index + 1;
+    return frame;
+  }
+  std::shared_ptr<SimFrame> frame(new SimFrame());
+  frame->Refill(vars, identity, dirty, stamp);
+  if (frames_.size() < static_cast<size_t>(capacity_)) {
+    frames_.push_back(frame);
+    next_ = 0;
+  }
+  return frame;
+}
+
+FrameBufferPool::FrameBufferPool(int capacity) {
+  buffers_.reserve(capacity);
+  for (int i = 0; i < capacity; ++i) {
+    buffers_.push_back(std::make_shared<FrameBuffer>());
+  }
+}
+
+FrameLease FrameBufferPool::Lease() {
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    const size_t index = (next_ + i) % buffers_.size();
+    if (buffers_[index].use_count() != 1) continue;
+    // Pairs with the release of the last reader's reference, so its reads of
+    // the buffer happen before the producer writes to it.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    next_ = index;
+    return buffers_[index];
+  }
+  return std::make_shared<FrameBuffer>();
+}
+
+}  // namespace data_dispatcher
+}  // namespace flight_panel
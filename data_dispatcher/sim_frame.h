@@ -0,0 +1,135 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "data_def/proto/sim_data.pb.h"
+#include "data_def/sim_vars.h"
+#include "trace/latency.h"
+
+namespace flight_panel {
+namespace data_dispatcher {
+
+// One published frame of sim data. The dispatcher converts each frame once
+// and shares the same immutable SimFrame with every recipient.
+class SimFrame {
+ public:
+  // `dirty` marks the SimVarDefs entries that changed since the previous
+  // frame. By default every var is considered changed. `stamp` is the stamp
+  // the reader gave the frame.
+  explicit SimFrame(SimData data,
+                    data::DirtyMask dirty = data::DirtyMask().set(),
+                    trace::FrameStamp stamp = trace::FrameStamp())
+      : data_(std::move(data)), dirty_(dirty), stamp_(stamp) {}
+
+  SimFrame(const SimFrame&) = delete;
+  SimFrame& operator=(const SimFrame&) = delete;
+
+  const SimData& data() const { return data_; }
+  const data::DirtyMask& dirty() const { return dirty_; }
+  // SimData has no room for it, so the stamp travels next to the proto.
+  const trace::FrameStamp& stamp() const { return stamp_; }
+
+  // The frame in proto wire format. The frame is serialized by the first
+  // caller and the bytes are cached, so N recipients cost one serialization.
+  // Thread safe.
+  const std::string& SerializedData() const LOCKS_EXCLUDED(serialize_lock_);
+
+ private:
+  friend class SimFramePool;
+
+  SimFrame() = default;
+
+  // Refills a frame no recipient holds anymore. Only SimFramePool does this;
+  // to everybody else a frame is immutable.
+  void Refill(const data::SimVars& vars, const data::SimIdentity& identity,
+              const data::DirtyMask& dirty, const trace::FrameStamp& stamp)
+      LOCKS_EXCLUDED(serialize_lock_);
+
+  SimData data_;
+  data::DirtyMask dirty_;
+  trace::FrameStamp stamp_;
+  mutable absl::Mutex serialize_lock_;
+  mutable bool serialized_ GUARDED_BY(serialize_lock_) = false;
+  // Keeps its capacity when the frame is refilled, so serializing a reused
+  // frame does not allocate.
+  mutable std::string serialized_data_ GUARDED_BY(serialize_lock_);
+};
+
+using SimFramePtr = std::shared_ptr<const SimFrame>;
+
+// A frame of raw sim vars on its way from the producer to the dispatcher
+// worker. The producer leases a buffer, fills it in place and commits it, and
+// from then on it is only read.
+struct FrameBuffer {
+  data::SimVars vars;
+  trace::FrameStamp stamp;
+  // The vars the producer updated, see DataDispatcher::Notify().
+  data::DirtyMask changed;
+};
+// A leased buffer, written by the producer until it is committed.
+using FrameLease = std::shared_ptr<FrameBuffer>;
+// A committed buffer.
+using FrameBufferPtr = std::shared_ptr<const FrameBuffer>;
+
+// Preallocated FrameBuffers. A buffer goes back to the pool once the queue,
+// the worker and the producer all dropped their pointers to it, so a frame
+// travels from the producer to the worker without being copied or allocated.
+// Not thread safe, only the producer leases buffers.
+class FrameBufferPool {
+ public:
+  // Allocates `capacity` buffers up front. When all of them are still held,
+  // Lease() falls back to a new buffer outside the pool.
+  explicit FrameBufferPool(int capacity);
+
+  FrameBufferPool(const FrameBufferPool&) = delete;
+  FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+  // A buffer nobody else holds. Its content is left from its previous use.
+  FrameLease Lease();
+
+  // Buffers owned by the pool.
+  int size() const { return buffers_.size(); }
+
+ private:
+  std::vector<FrameLease> buffers_;
+  // Where the search for a free buffer starts, see SimFramePool::next_.
+  size_t next_ = 0;
+};
+
+// Recycles the frames of the dispatcher worker. A frame goes back to the pool
+// once every recipient dropped its pointer, and is then refilled in place:
+// the proto keeps its sub-messages and strings and the serialization buffer
+// keeps its capacity, so a warm pool converts frames without allocating.
+// Not thread safe, only the dispatcher worker acquires frames.
+class SimFramePool {
+ public:
+  // The pool holds at most `capacity` frames. When all of them are still held
+  // by recipients, Acquire() falls back to a new frame outside the pool.
+  explicit SimFramePool(int capacity);
+
+  SimFramePool(const SimFramePool&) = delete;
+  SimFramePool& operator=(const SimFramePool&) = delete;
+
+  // A frame holding `vars` and `identity` converted to SimData.
+  SimFramePtr Acquire(const data::SimVars& vars,
+                      const data::SimIdentity& identity,
+                      const data::DirtyMask& dirty,
+                      const trace::FrameStamp& stamp);
+
+  // Frames owned by the pool.
+  int size() const { return frames_.size(); }
+
+ private:
+  const int capacity_;
+  std::vector<std::shared_ptr<SimFrame>> frames_;
+  // Where the search for a free frame starts. Frames are released roughly in
+  // the order they were handed out, so the oldest frame is the best guess.
+  size_t next_ = 0;
+};
+
+}  // namespace data_dispatcher
+}  // namespace flight_panel
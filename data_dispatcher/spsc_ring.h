@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace flight_panel {
+namespace data_dispatcher {
+
+// A bounded single-producer/single-consumer ring buffer.
+//
+// All slots are allocated when the ring is created. TryPush() must only be
+// called from one producer thread and TryPop() from one consumer thread. Both
+// are wait-free: they never block and never allocate.
+template <typename T>
+class SpscRing {
+ public:
+  // The capacity is rounded up to a power of two.
+  explicit SpscRing(size_t capacity)
+      : slots_(RoundUpToPowerOfTwo(capacity)), mask_(slots_.size() - 1) {}
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  // Copies the item into the next free slot. Returns false if the ring is
+  // full, in which case the item is not added.
+  bool TryPush(const T& item) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+      return false;
+    }
+    slots_[tail & mask_] = item;
+    // Sequentially consistent, and so is the producer's check for a parked
+    // consumer that follows. A consumer that announces it parks and then
+    // issues a seq_cst fence before checking the ring either sees this item
+    // or is seen parked. See DataDispatcherImpl::WaitForRingFrame.
+    tail_.store(tail + 1, std::memory_order_seq_cst);
+    return true;
+  }
+
+  // Moves the oldest item out of the ring. Returns false if it is empty.
+  bool TryPop(T* item) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    // Moved rather than copied, so the slot doesn't keep a shared item alive
+    // until it is reused.
+    *item = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Number of items in the ring. Only a snapshot when called concurrently.
+  size_t Size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+  bool Empty() const { return Size() == 0; }
+  size_t Capacity() const { return slots_.size(); }
+
+ private:
+  static size_t RoundUpToPowerOfTwo(size_t n) {
+    size_t result = 1;
+    while (result < n) result <<= 1;
+    return result;
+  }
+
+  std::vector<T> slots_;
+  const size_t mask_;
+  // The consumer and producer positions live on separate cache lines, so the
+  // two threads don't invalidate each other's line on every frame.
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+}  // namespace data_dispatcher
+}  // namespace flight_panel
@@ -1,15 +1,23 @@
 #include "data_reader/data_reader.h"
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 #include "absl/status/statusor.h"
 #include "data_def/sim_vars.h"
 #include "data_dispatcher/data_dispatcher.h"
 #include "sim_bridge/sim_bridge.h"
 #include "spdlog/spdlog.h"
+#include "trace/latency.h"
+#include "trace/trace.h"
 
 namespace flight_panel {
 namespace {
 
+using data::RefreshGroup;
 using data_dispatcher::DataDispatcher;
+using data_dispatcher::FrameLease;
 using sim_bridge::SimBridge;
 
 class DataReaderImpl : public DataReader {
@@ -21,40 +29,279 @@ class DataReaderImpl : public DataReader {
       : req_id_(request_id),
         def_id_(def_id),
         bridge_(bridge),
-        dispatcher_(dispatcher),
-        data_length_(0){};
+        dispatcher_(dispatcher){};
   virtual absl::Status OnStart() override { return absl::Status(); }
   virtual absl::Status OnStop() override { return absl::Status(); }
 
   virtual absl::Status OnData(int req_id, void* pData) override {
-    if (req_id != req_id_) return absl::OkStatus();
-    // request ID matches. Start processing data.
-    // Copy data to a SimVars struct
-    data::SimVars data_buf;
-    memcpy(&data_buf, pData, data_length_);
-    return dispatcher_->Notify(data_buf);
+    int group = req_id - req_id_;
+    if (group < 0 || group >= data::kRefreshGroupCount) {
+      return absl::OkStatus();
+    }
+    if (group == static_cast<int>(RefreshGroup::IDENTITY)) {
+      return OnIdentity(pData);
+    }
+    trace::FrameStamp stamp = Stamp(req_id, groups_[group].data_length);
+    // Fill the leased frame once: the vars of this block from the SimConnect
+    // buffer, the others with the value they were last read with.
+    FrameLease frame = dispatcher_->LeaseFrame();
+    const char* src = static_cast<const char*>(pData);
+    const char* previous = reinterpret_cast<const char*>(&PreviousVars());
+    char* dst = reinterpret_cast<char*>(&frame->vars);
+    for (const CopyRun& run : groups_[group].runs) {
+      memcpy(dst + run.snapshot_offset, src + run.block_offset, run.size);
+    }
+    for (const CopyRun& run : groups_[group].kept_runs) {
+      memcpy(dst + run.snapshot_offset, previous + run.snapshot_offset,
+             run.size);
+    }
+    frame->stamp = stamp;
+    frame->changed = groups_[group].vars;
+    return Commit(std::move(frame));
+  }
+
+  virtual absl::Status OnTaggedData(int req_id, int datum_count,
+                                    void* pData) override {
+    int group_index = req_id - req_id_;
+    if (group_index < 0 || group_index >= data::kRefreshGroupCount) {
+      return absl::OkStatus();
+    }
+    if (group_index == static_cast<int>(RefreshGroup::IDENTITY)) {
+      return absl::InvalidArgumentError("Identity is not requested tagged.");
+    }
+    const Group& group = groups_[group_index];
+    trace::FrameStamp stamp = Stamp(req_id, datum_count);
+    // Each datum is a DWORD datum ID followed by the var. Only the vars that
+    // are present are updated, the others keep their previous value.
+    FrameLease frame = dispatcher_->LeaseFrame();
+    frame->vars = PreviousVars();
+    const char* src = static_cast<const char*>(pData);
+    char* dst = reinterpret_cast<char*>(&frame->vars);
+    data::DirtyMask changed;
+    for (int i = 0; i < datum_count; ++i) {
+      uint32_t datum_id;
+      memcpy(&datum_id, src, sizeof(datum_id));
+      src += sizeof(datum_id);
+      if (datum_id >= group.datums.size()) {
+        // The rest of the block can't be located without the datum size.
+        spdlog::error("Unknown datum {} in request {}", datum_id, req_id);
+        break;
+      }
+      const Datum& datum = group.datums[datum_id];
+      memcpy(dst + datum.snapshot_offset, src, datum.copy_size);
+      src += datum.block_size;
+      changed.set(datum.var_index);
+    }
+    // Dropping the lease gives the frame back.
+    if (changed.none()) return absl::OkStatus();
+    frame->stamp = stamp;
+    frame->changed = changed;
+    return Commit(std::move(frame));
   }
 
   // Add data definition to the bridge.
   virtual absl::Status RegisterDataDef() override {
-    using data::SimVarDefs;
-    for (int i = 0; SimVarDefs[i][0] != NULL; ++i) {
+    for (Group& group : groups_) group = Group();
+    for (int var_index = 0; var_index < data::kSimVarCount; ++var_index) {
+      const data::SimVarField& field = data::kSimVarFields[var_index];
+      const int group_index = static_cast<int>(field.group);
+      Group& group = groups_[group_index];
       auto status_or =
-          bridge_->AddDataDef(def_id_, SimVarDefs[i][0], SimVarDefs[i][1]);
+          bridge_->AddDataDef(def_id_ + group_index, field.name, field.unit);
       if (!status_or.ok()) {
         return status_or.status();
       }
-      data_length_ += status_or.value();
+      if (!field.is_string) {
+        // If the bridge sized the var differently than SimVars, it is still
+        // copied, but never past its slot.
+        const size_t copy_size =
+            std::min<size_t>(status_or.value(), field.size);
+        AddCopyRun(&group, field.offset, copy_size);
+        // The bridge numbers the vars of a def in the order they are added.
+        group.datums.push_back({field.offset,
+                                static_cast<size_t>(status_or.value()),
+                                copy_size, var_index});
+      }
+      group.vars.set(var_index);
+      group.data_length += status_or.value();
+    }
+    for (Group& group : groups_) AddKeptRuns(&group);
+    if (static_cast<size_t>(DataLength()) != data::kTelemetryDataSize) {
+      spdlog::warn("Telemetry blocks are {} bytes, SimVars expects {}",
+                   DataLength(), data::kTelemetryDataSize);
+    }
+    if (identity().data_length != data::kIdentityDataSize) {
+      spdlog::warn("Identity block is {} bytes, SimIdentity expects {}",
+                   identity().data_length, data::kIdentityDataSize);
     }
     return absl::OkStatus();
   }
 
-  virtual int DataLength() override { return data_length_; }
+  virtual absl::Status RequestData(sim_bridge::RefreshPeriod period) override {
+    using sim_bridge::RefreshPeriod;
+    // The slow groups never refresh faster than once a second, nor faster
+    // than the instruments.
+    RefreshPeriod slow_period =
+        period == RefreshPeriod::VISUAL_FRAME ||
+                period == RefreshPeriod::SIM_FRAME
+            ? RefreshPeriod::SECOND
+            : period;
+    // Most FRAME vars move every frame in flight, a tag per var would only
+    // grow the block, so it is always sent whole. Few SECOND vars change in
+    // a second, they are sent tagged. The identity is sent whole, and only
+    // when it changed.
+    absl::Status status = bridge_->RequestData(
+        req_id_ + static_cast<int>(RefreshGroup::FRAME),
+        def_id_ + static_cast<int>(RefreshGroup::FRAME), period,
+        sim_bridge::REQUEST_DEFAULT);
+    if (!status.ok()) return status;
+    status = bridge_->RequestData(
+        req_id_ + static_cast<int>(RefreshGroup::SECOND),
+        def_id_ + static_cast<int>(RefreshGroup::SECOND), slow_period,
+        sim_bridge::REQUEST_TAGGED);
+    if (!status.ok()) return status;
+    return bridge_->RequestData(
+        req_id_ + static_cast<int>(RefreshGroup::IDENTITY),
+        def_id_ + static_cast<int>(RefreshGroup::IDENTITY), slow_period,
+        sim_bridge::REQUEST_CHANGED);
+  }
+
+  virtual const data::SimVars& LatestVars() override {
+    return PreviousVars();
+  }
+
+  virtual absl::Status SetConnected(bool connected) override {
+    FrameLease frame = dispatcher_->LeaseFrame();
+    frame->vars = PreviousVars();
+    frame->vars.connected = connected ? 1 : 0;
+    frame->stamp = Stamp(req_id_, 0);
+    frame->changed.set();
+    return Commit(std::move(frame));
+  }
+
+  virtual int DataLength() override {
+    return static_cast<int>(
+        groups_[static_cast<int>(RefreshGroup::FRAME)].data_length +
+        groups_[static_cast<int>(RefreshGroup::SECOND)].data_length);
+  }
 
  private:
+  // A memcpy from a data block into the snapshot.
+  struct CopyRun {
+    size_t block_offset;
+    size_t snapshot_offset;
+    size_t size;
+  };
+  // A var of a tagged data block.
+  struct Datum {
+    size_t snapshot_offset;
+    // Size of the var in the block, and how much of it is copied.
+    size_t block_size;
+    size_t copy_size;
+    // Index in data::kSimVarFields.
+    int var_index;
+  };
+  // The SimConnect data definition of a RefreshGroup.
+  struct Group {
+    // Size of the data block.
+    size_t data_length = 0;
+    // The vars of the block, merged into runs of consecutive SimVars members.
+    std::vector<CopyRun> runs;
+    // The parts of SimVars not in the block, copied from the previous frame.
+    std::vector<CopyRun> kept_runs;
+    // The number vars of the block, indexed by datum ID.
+    std::vector<Datum> datums;
+    // The DirtyMask bits of the vars of the block.
+    data::DirtyMask vars;
+  };
+
+  // Appends a var to the group's block, extending the last run when the var
+  // follows it in SimVars too.
+  static void AddCopyRun(Group* group, size_t snapshot_offset, size_t size) {
+    if (!group->runs.empty()) {
+      CopyRun& last = group->runs.back();
+      if (last.block_offset + last.size == group->data_length &&
+          last.snapshot_offset + last.size == snapshot_offset) {
+        last.size += size;
+        return;
+      }
+    }
+    group->runs.push_back({group->data_length, snapshot_offset, size});
+  }
+
+  // Fills kept_runs with the gaps between the runs of the group.
+  static void AddKeptRuns(Group* group) {
+    size_t offset = 0;
+    for (const CopyRun& run : group->runs) {
+      if (run.snapshot_offset > offset) {
+        group->kept_runs.push_back(
+            {offset, offset, run.snapshot_offset - offset});
+      }
+      offset = run.snapshot_offset + run.size;
+    }
+    if (offset < sizeof(data::SimVars)) {
+      group->kept_runs.push_back(
+          {offset, offset, sizeof(data::SimVars) - offset});
+    }
+  }
+
+  // The vars of the last frame committed, or the defaults before the first.
+  const data::SimVars& PreviousVars() const {
+    static const data::SimVars default_vars;
+    return last_frame_ ? last_frame_->vars : default_vars;
+  }
+
+  // Commits the frame and keeps a pointer to it, the next frame copies the
+  // vars it doesn't read from it. Frames are numbered here rather than when
+  // they arrive, so a block that is not committed leaves no gap.
+  absl::Status Commit(FrameLease frame) {
+    frame->stamp.sequence = ++sequence_;
+    last_frame_ = frame;
+    return dispatcher_->Commit(std::move(frame));
+  }
+
+  // Stamps a frame as it arrives, so its latency includes the copy. The
+  // sequence number is set by Commit().
+  trace::FrameStamp Stamp(int req_id, int64_t size) {
+    trace::FrameStamp stamp;
+    stamp.received_ns = trace::MonotonicNanos();
+    // One sample per second at the usual 60 Hz, enough to see the reader is
+    // alive without filling the ring.
+    FP_TRACE_SAMPLED(60, kInfo, kReaderData, req_id, size);
+    return stamp;
+  }
+
+  const Group& identity() const {
+    return groups_[static_cast<int>(RefreshGroup::IDENTITY)];
+  }
+
+  // Publishes the identity block if it differs from the last one.
+  absl::Status OnIdentity(void* pData) {
+    data::SimIdentity identity;
+    memcpy(&identity, pData,
+           std::min<size_t>(this->identity().data_length,
+                            data::kIdentityDataSize));
+    if (has_identity_ &&
+        memcmp(&identity, &identity_, sizeof(data::SimIdentity)) == 0) {
+      return absl::OkStatus();
+    }
+    identity_ = identity;
+    has_identity_ = true;
+    return dispatcher_->NotifyIdentity(identity_);
+  }
+
   int req_id_;
   int def_id_;
-  int data_length_;
+  // Indexed by RefreshGroup.
+  Group groups_[data::kRefreshGroupCount];
+  // The last frame committed. Every group is merged into it. Only touched on
+  // the SimConnect dispatch thread.
+  data_dispatcher::FrameBufferPtr last_frame_;
+  // Sequence of the last frame received.
+  int64_t sequence_ = 0;
+  // The identity last sent to the dispatcher.
+  data::SimIdentity identity_;
+  bool has_identity_ = false;
   // Dispatch the data read from SimBridge to clients. (WS, Serial, etc.)
   // This object doesn't own the dispatcher, since the clients also need to
   // attach themselves to the dispatcher.
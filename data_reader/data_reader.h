@@ -10,10 +10,30 @@ namespace flight_panel {
 class DataReader : public sim_bridge::DispatchHandler {
  public:
   virtual absl::Status RegisterDataDef() = 0;
-  // Start running, and dispatch new data when they arrive.
+  // Requests the FRAME group at `period`, the SECOND and IDENTITY groups
+  // once a second, or at `period` when it is slower. The SECOND group is
+  // requested tagged and the IDENTITY group changed-only, so they are only
+  // sent when something in them changed. RefreshPeriod::NEVER stops all of
+  // them.
+  virtual absl::Status RequestData(sim_bridge::RefreshPeriod period) = 0;
+  // Size of the telemetry blocks, FRAME and SECOND together.
   virtual int DataLength() = 0;
+  // The vars of the last frame. Only call it from the thread that handles
+  // the data.
+  virtual const data::SimVars& LatestVars() = 0;
+  // Publishes the latest vars again with SimVars::connected set, marked all
+  // changed. While the sim is away, clients keep the last snapshot and know
+  // it is stale. Later frames keep the flag.
+  virtual absl::Status SetConnected(bool connected) = 0;
 };
 
+// The reader registers one data block per data::RefreshGroup, with
+// `request_id + group` and `data_def_id + group`, so it uses
+// data::kRefreshGroupCount consecutive IDs of each. The FRAME and SECOND
+// blocks are merged into one data::SimVars snapshot, written straight into a
+// frame leased from the dispatcher whenever either arrives, along with the
+// mask of the vars it updated. The
+// identity strings (data::SimIdentity) are only sent when they changed.
 std::unique_ptr<DataReader> CreateDataReader(
     int request_id, int data_def_id, sim_bridge::SimBridge* bridge,
     data_dispatcher::DataDispatcher* dispatcher);
@@ -1,5 +1,8 @@
 #include "data_reader/data_reader.h"
 
+#include <memory>
+#include <vector>
+
 #include "absl/functional/bind_front.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -19,14 +22,20 @@ namespace flight_panel {
 
 namespace {
 
+using data::RefreshGroup;
 using data::SimVars;
 using data_dispatcher::DataDispatcher;
+using data_dispatcher::FrameBuffer;
+using data_dispatcher::FrameLease;
 using data_dispatcher::MockDataDispatcher;
 using sim_bridge::MockSimBridge;
 using sim_bridge::SimBridge;
 using ::testing::_;
+using ::testing::DoAll;
 using ::testing::DoubleEq;
 using ::testing::Field;
+using ::testing::Invoke;
+using ::testing::IsEmpty;
 using ::testing::Return;
 using ::testing::SaveArg;
 
@@ -38,70 +47,348 @@ MATCHER(IsNotStringType, "Check if string type") {
   return !absl::StrContains(arg, "string");
 }
 
-int DataDefCount() {
-  int i = 0;
-  while (data::SimVarDefs[i][0] != NULL) ++i;
-  return i;
+int GroupVarCount(RefreshGroup group) {
+  int count = 0;
+  for (const data::SimVarField& field : data::kSimVarFields) {
+    if (field.group == group) ++count;
+  }
+  return count;
+}
+
+// Leases fresh frames to the reader and collects the committed ones.
+void ExpectFrames(MockDataDispatcher* mock_dispatcher,
+                  std::vector<FrameLease>* frames) {
+  EXPECT_CALL(*mock_dispatcher, LeaseFrame())
+      .WillRepeatedly(Invoke([] { return std::make_shared<FrameBuffer>(); }));
+  EXPECT_CALL(*mock_dispatcher, Commit(_))
+      .WillRepeatedly(Invoke([frames](FrameLease frame) {
+        frames->push_back(frame);
+        return absl::OkStatus();
+      }));
+}
+
+int VarIndex(absl::string_view name) {
+  for (int i = 0; i < data::kSimVarCount; ++i) {
+    if (name == data::kSimVarFields[i].name) return i;
+  }
+  return -1;
+}
+
+// The datum ID the bridge gives a var: its position in its group's def.
+int DatumId(absl::string_view name) {
+  int datum_id = 0;
+  const data::SimVarField& var = data::kSimVarFields[VarIndex(name)];
+  for (const data::SimVarField& field : data::kSimVarFields) {
+    if (&field == &var) return datum_id;
+    if (field.group == var.group) ++datum_id;
+  }
+  return -1;
+}
+
+// A SimConnect tagged data block of doubles.
+struct TaggedBlock {
+  TaggedBlock& Add(uint32_t datum_id, double value) {
+    const char* id = reinterpret_cast<const char*>(&datum_id);
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    data.insert(data.end(), id, id + sizeof(datum_id));
+    data.insert(data.end(), bytes, bytes + sizeof(value));
+    ++count;
+    return *this;
+  }
+  std::vector<char> data;
+  int count = 0;
+};
+
+// Packs the vars of a number group the way SimConnect sends its data block.
+std::vector<char> GroupBlock(const SimVars& vars, RefreshGroup group) {
+  std::vector<char> block;
+  const char* src = reinterpret_cast<const char*>(&vars);
+  for (const data::SimVarField& field : data::kSimVarFields) {
+    if (field.group != group) continue;
+    block.insert(block.end(), src + field.offset,
+                 src + field.offset + field.size);
+  }
+  return block;
+}
+
+// Sizes data defs the way SimConnect does.
+void ExpectSimConnectSizes(MockSimBridge* mock_bridge) {
+  EXPECT_CALL(*mock_bridge, AddDataDef(_, _, IsNotStringType()))
+      .WillRepeatedly(Return(sizeof(double)));
+  EXPECT_CALL(*mock_bridge, AddDataDef(_, _, IsStringType(8)))
+      .WillRepeatedly(Return(8));
+  EXPECT_CALL(*mock_bridge, AddDataDef(_, _, IsStringType(64)))
+      .WillRepeatedly(Return(64));
+  EXPECT_CALL(*mock_bridge, AddDataDef(_, _, IsStringType(256)))
+      .WillRepeatedly(Return(256));
 }
 
 TEST(DataReaderTest, TestAddDataDefForAllEntries) {
   MockSimBridge mock_bridge;
   MockDataDispatcher mock_dispatcher;
   auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
-  EXPECT_CALL(mock_bridge, AddDataDef(0, _, _))
-      .Times(DataDefCount())
+  // One block per refresh group, strings go to the identity block.
+  EXPECT_CALL(mock_bridge, AddDataDef(0, _, IsNotStringType()))
+      .Times(GroupVarCount(RefreshGroup::FRAME))
+      .WillRepeatedly(Return(8));
+  EXPECT_CALL(mock_bridge, AddDataDef(1, _, IsNotStringType()))
+      .Times(GroupVarCount(RefreshGroup::SECOND))
+      .WillRepeatedly(Return(8));
+  EXPECT_CALL(mock_bridge, AddDataDef(2, _, _))
+      .Times(GroupVarCount(RefreshGroup::IDENTITY))
       .WillRepeatedly(Return(8));
   reader->RegisterDataDef();
+  EXPECT_EQ(GroupVarCount(RefreshGroup::FRAME) +
+                GroupVarCount(RefreshGroup::SECOND),
+            data::kTelemetryVarCount);
+}
+
+TEST(DataReaderTest, TestRequestsEveryGroup) {
+  MockSimBridge mock_bridge;
+  MockDataDispatcher mock_dispatcher;
+  auto reader = CreateDataReader(10, 20, &mock_bridge, &mock_dispatcher);
+  EXPECT_CALL(mock_bridge,
+              RequestData(10, 20, sim_bridge::RefreshPeriod::VISUAL_FRAME,
+                          sim_bridge::REQUEST_DEFAULT))
+      .WillOnce(Return(absl::OkStatus()));
+  EXPECT_CALL(mock_bridge,
+              RequestData(11, 21, sim_bridge::RefreshPeriod::SECOND,
+                          sim_bridge::REQUEST_TAGGED))
+      .WillOnce(Return(absl::OkStatus()));
+  EXPECT_CALL(mock_bridge,
+              RequestData(12, 22, sim_bridge::RefreshPeriod::SECOND,
+                          sim_bridge::REQUEST_CHANGED))
+      .WillOnce(Return(absl::OkStatus()));
+  EXPECT_TRUE(
+      reader->RequestData(sim_bridge::RefreshPeriod::VISUAL_FRAME).ok());
+}
+
+TEST(DataReaderTest, TestStopsEveryGroup) {
+  MockSimBridge mock_bridge;
+  MockDataDispatcher mock_dispatcher;
+  auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
+  EXPECT_CALL(mock_bridge,
+              RequestData(_, _, sim_bridge::RefreshPeriod::NEVER, _))
+      .Times(data::kRefreshGroupCount)
+      .WillRepeatedly(Return(absl::OkStatus()));
+  EXPECT_TRUE(reader->RequestData(sim_bridge::RefreshPeriod::NEVER).ok());
 }
 
 TEST(DataReaderTest, TestDataLengthCorrect) {
   MockSimBridge mock_bridge;
   MockDataDispatcher mock_dispatcher;
   auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
-  EXPECT_CALL(mock_bridge, AddDataDef(0, _, IsNotStringType()))
-      .WillRepeatedly(Return(sizeof(double)));
-  EXPECT_CALL(mock_bridge, AddDataDef(0, _, IsStringType(8)))
-      .WillRepeatedly(Return(8));
-  EXPECT_CALL(mock_bridge, AddDataDef(0, _, IsStringType(64)))
-      .WillRepeatedly(Return(64));
-  EXPECT_CALL(mock_bridge, AddDataDef(0, _, IsStringType(256)))
-      .WillRepeatedly(Return(256));
+  ExpectSimConnectSizes(&mock_bridge);
   reader->RegisterDataDef();
-  SimVars buffer;
-  // we have another field for "connected" in SimVars, which is not part of the
-  // SimConnect data frame.
-  EXPECT_EQ(reader->DataLength() + 8, sizeof(buffer));
+  // SimVars also has "connected", which is not part of the SimConnect data
+  // frame.
+  EXPECT_EQ(reader->DataLength(), data::kTelemetryDataSize);
+  EXPECT_EQ(reader->DataLength(), offsetof(SimVars, connected));
 }
 
 TEST(DataReaderTest, TestOnDataCopyOver) {
   MockSimBridge mock_bridge;
   MockDataDispatcher mock_dispatcher;
   auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
-  EXPECT_CALL(mock_bridge, AddDataDef(0, _, IsNotStringType()))
-      .WillRepeatedly(Return(sizeof(double)));
-  EXPECT_CALL(mock_bridge, AddDataDef(0, _, IsStringType(8)))
-      .WillRepeatedly(Return(8));
-  EXPECT_CALL(mock_bridge, AddDataDef(0, _, IsStringType(64)))
-      .WillRepeatedly(Return(64));
-  EXPECT_CALL(mock_bridge, AddDataDef(0, _, IsStringType(256)))
-      .WillRepeatedly(Return(256));
-  SimVars notified_data;
-  EXPECT_CALL(mock_dispatcher, Notify(_))
-      .WillOnce(DoAll(SaveArg<0>(&notified_data), Return(absl::OkStatus())));
+  ExpectSimConnectSizes(&mock_bridge);
+  std::vector<FrameLease> frames;
+  ExpectFrames(&mock_dispatcher, &frames);
   reader->RegisterDataDef();
   SimVars buffer;
   // Modify the buffer so it's different from the default value.
   buffer.asiAirspeed = 99;
   buffer.altAltitude = 555;
-  strncpy(buffer.atcTailNumber, "HELLO", 5);
   // We will verify if the "connected" is copied over or not.
   buffer.connected = 1;
-  reader->OnData(0, &buffer);
+  reader->OnData(0, GroupBlock(buffer, RefreshGroup::FRAME).data());
   // Verify that the data sent to the dispatcher matches the buffer
-  EXPECT_EQ(notified_data.asiAirspeed, 99);
-  EXPECT_EQ(notified_data.altAltitude, 555);
-  EXPECT_EQ(std::string(notified_data.atcTailNumber), "HELLO");
-  EXPECT_EQ(notified_data.connected, 0);
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0]->vars.asiAirspeed, 99);
+  EXPECT_EQ(frames[0]->vars.altAltitude, 555);
+  EXPECT_EQ(frames[0]->vars.connected, 0);
+}
+
+TEST(DataReaderTest, TestMergesGroupsIntoOneSnapshot) {
+  MockSimBridge mock_bridge;
+  MockDataDispatcher mock_dispatcher;
+  auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
+  ExpectSimConnectSizes(&mock_bridge);
+  std::vector<FrameLease> frames;
+  ExpectFrames(&mock_dispatcher, &frames);
+  reader->RegisterDataDef();
+  SimVars slow;
+  slow.com1Standby = 121.5;
+  slow.atcHeavy = 1;
+  slow.asiAirspeed = 200;
+  reader->OnData(1, GroupBlock(slow, RefreshGroup::SECOND).data());
+  SimVars fast;
+  fast.asiAirspeed = 99;
+  reader->OnData(0, GroupBlock(fast, RefreshGroup::FRAME).data());
+  ASSERT_EQ(frames.size(), 2);
+  const SimVars& after_second = frames[0]->vars;
+  const SimVars& after_frame = frames[1]->vars;
+  // asiAirspeed is not in the SECOND block.
+  EXPECT_EQ(after_second.asiAirspeed, 0);
+  EXPECT_EQ(after_second.com1Standby, 121.5);
+  // The SECOND vars keep their value when a FRAME block arrives.
+  EXPECT_EQ(after_frame.asiAirspeed, 99);
+  EXPECT_EQ(after_frame.com1Standby, 121.5);
+  EXPECT_EQ(after_frame.atcHeavy, 1);
+}
+
+TEST(DataReaderTest, TestBlockMarksItsGroupChanged) {
+  MockSimBridge mock_bridge;
+  MockDataDispatcher mock_dispatcher;
+  auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
+  ExpectSimConnectSizes(&mock_bridge);
+  std::vector<FrameLease> frames;
+  ExpectFrames(&mock_dispatcher, &frames);
+  reader->RegisterDataDef();
+  reader->OnData(1, GroupBlock(SimVars(), RefreshGroup::SECOND).data());
+  ASSERT_EQ(frames.size(), 1);
+  const data::DirtyMask& changed = frames[0]->changed;
+  EXPECT_EQ(changed.count(), GroupVarCount(RefreshGroup::SECOND));
+  EXPECT_TRUE(changed.test(VarIndex("Atc Heavy")));
+  EXPECT_FALSE(changed.test(VarIndex("Airspeed Indicated")));
+}
+
+TEST(DataReaderTest, TestTaggedDataUpdatesOnlyItsVars) {
+  MockSimBridge mock_bridge;
+  MockDataDispatcher mock_dispatcher;
+  auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
+  ExpectSimConnectSizes(&mock_bridge);
+  std::vector<FrameLease> frames;
+  ExpectFrames(&mock_dispatcher, &frames);
+  reader->RegisterDataDef();
+  const int com1_standby = DatumId("Com Standby Frequency:1");
+  const int heavy = DatumId("Atc Heavy");
+  TaggedBlock block;
+  block.Add(com1_standby, 121.5).Add(heavy, 1);
+  reader->OnTaggedData(1, block.count, block.data.data());
+  TaggedBlock next;
+  next.Add(heavy, 0);
+  reader->OnTaggedData(1, next.count, next.data.data());
+
+  ASSERT_EQ(frames.size(), 2);
+  const SimVars& first = frames[0]->vars;
+  const SimVars& second = frames[1]->vars;
+  const data::DirtyMask& first_changed = frames[0]->changed;
+  const data::DirtyMask& second_changed = frames[1]->changed;
+  EXPECT_EQ(first.com1Standby, 121.5);
+  EXPECT_EQ(first.atcHeavy, 1);
+  EXPECT_EQ(first_changed.count(), 2);
+  EXPECT_TRUE(first_changed.test(VarIndex("Com Standby Frequency:1")));
+  EXPECT_TRUE(first_changed.test(VarIndex("Atc Heavy")));
+  // Vars missing from a tagged block keep their value.
+  EXPECT_EQ(second.com1Standby, 121.5);
+  EXPECT_EQ(second.atcHeavy, 0);
+  EXPECT_EQ(second.com2Standby, SimVars().com2Standby);
+  data::DirtyMask expected;
+  expected.set(VarIndex("Atc Heavy"));
+  EXPECT_EQ(second_changed, expected);
+}
+
+TEST(DataReaderTest, TestTaggedDataStopsAtUnknownDatum) {
+  MockSimBridge mock_bridge;
+  MockDataDispatcher mock_dispatcher;
+  auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
+  ExpectSimConnectSizes(&mock_bridge);
+  std::vector<FrameLease> frames;
+  ExpectFrames(&mock_dispatcher, &frames);
+  reader->RegisterDataDef();
+  TaggedBlock block;
+  block.Add(DatumId("Atc Heavy"), 1).Add(1000, 5).Add(0, 5);
+  reader->OnTaggedData(1, block.count, block.data.data());
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0]->vars.atcHeavy, 1);
+  EXPECT_EQ(frames[0]->changed.count(), 1);
+}
+
+TEST(DataReaderTest, TestEmptyTaggedDataNotSent) {
+  MockSimBridge mock_bridge;
+  MockDataDispatcher mock_dispatcher;
+  auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
+  ExpectSimConnectSizes(&mock_bridge);
+  std::vector<FrameLease> frames;
+  ExpectFrames(&mock_dispatcher, &frames);
+  reader->RegisterDataDef();
+  TaggedBlock block;
+  EXPECT_TRUE(reader->OnTaggedData(1, 0, block.data.data()).ok());
+  EXPECT_FALSE(reader->OnTaggedData(2, 0, block.data.data()).ok());
+  TaggedBlock unknown;
+  unknown.Add(1000, 1);
+  EXPECT_TRUE(reader->OnTaggedData(1, unknown.count, unknown.data.data()).ok());
+  EXPECT_THAT(frames, IsEmpty());
+  // The blocks that were not sent leave no gap in the sequence.
+  TaggedBlock next;
+  next.Add(0, 1);
+  EXPECT_TRUE(reader->OnTaggedData(1, next.count, next.data.data()).ok());
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0]->stamp.sequence, 1);
+}
+
+TEST(DataReaderTest, TestIdentityOnlySentWhenChanged) {
+  MockSimBridge mock_bridge;
+  MockDataDispatcher mock_dispatcher;
+  auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
+  ExpectSimConnectSizes(&mock_bridge);
+  data::SimIdentity first, second;
+  EXPECT_CALL(mock_dispatcher, NotifyIdentity(_))
+      .WillOnce(DoAll(SaveArg<0>(&first), Return(absl::OkStatus())))
+      .WillOnce(DoAll(SaveArg<0>(&second), Return(absl::OkStatus())));
+  reader->RegisterDataDef();
+  data::SimIdentity buffer;
+  strncpy(buffer.atcTailNumber, "HELLO", 5);
+  reader->OnData(2, &buffer);
+  // Unchanged, not sent again.
+  reader->OnData(2, &buffer);
+  strncpy(buffer.aircraft, "Cessna", 6);
+  reader->OnData(2, &buffer);
+  EXPECT_EQ(std::string(first.atcTailNumber), "HELLO");
+  EXPECT_EQ(std::string(second.aircraft), "Cessna");
+}
+
+TEST(DataReaderTest, TestOnDataStampsFrames) {
+  MockSimBridge mock_bridge;
+  MockDataDispatcher mock_dispatcher;
+  auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
+  ExpectSimConnectSizes(&mock_bridge);
+  std::vector<FrameLease> frames;
+  ExpectFrames(&mock_dispatcher, &frames);
+  reader->RegisterDataDef();
+  std::vector<char> block = GroupBlock(SimVars(), RefreshGroup::FRAME);
+  reader->OnData(0, block.data());
+  reader->OnData(0, block.data());
+  ASSERT_EQ(frames.size(), 2);
+  const trace::FrameStamp& first = frames[0]->stamp;
+  const trace::FrameStamp& second = frames[1]->stamp;
+  EXPECT_EQ(first.sequence, 1);
+  EXPECT_EQ(second.sequence, 2);
+  EXPECT_GT(first.received_ns, 0);
+  EXPECT_LE(first.received_ns, second.received_ns);
+}
+
+TEST(DataReaderTest, TestSetConnectedRepublishesLastFrame) {
+  MockSimBridge mock_bridge;
+  MockDataDispatcher mock_dispatcher;
+  auto reader = CreateDataReader(0, 0, &mock_bridge, &mock_dispatcher);
+  ExpectSimConnectSizes(&mock_bridge);
+  std::vector<FrameLease> frames;
+  ExpectFrames(&mock_dispatcher, &frames);
+  reader->RegisterDataDef();
+  EXPECT_TRUE(reader->SetConnected(true).ok());
+  SimVars buffer;
+  buffer.altAltitude = 555;
+  reader->OnData(0, GroupBlock(buffer, RefreshGroup::FRAME).data());
+  EXPECT_TRUE(reader->SetConnected(false).ok());
+  ASSERT_EQ(frames.size(), 3);
+  EXPECT_EQ(frames[0]->vars.connected, 1);
+  // Frames keep the flag.
+  EXPECT_EQ(frames[1]->vars.connected, 1);
+  // The last values stay, marked all changed.
+  EXPECT_EQ(frames[2]->vars.connected, 0);
+  EXPECT_EQ(frames[2]->vars.altAltitude, 555);
+  EXPECT_TRUE(frames[2]->changed.all());
 }
 
 }  // namespace
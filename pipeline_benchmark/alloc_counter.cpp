@@ -0,0 +1,42 @@
+#include "pipeline_benchmark/alloc_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<int64_t> allocation_count{0};
+
+void* CountedAlloc(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+  throw std::bad_alloc();
+}
+
+}  // namespace
+
+// Replacements of the global allocation functions. The aligned overloads are
+// left alone, nothing on the measured paths uses them per frame.
+void* operator new(size_t size) { return CountedAlloc(size); }
+void* operator new[](size_t size) { return CountedAlloc(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+namespace flight_panel {
+namespace pipeline_benchmark {
+
+int64_t AllocationCount() {
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+void ReportAllocations(benchmark::State& state, int64_t start) {
+  state.counters["allocs_per_frame"] =
+      benchmark::Counter(static_cast<double>(AllocationCount() - start),
+                         benchmark::Counter::kAvgIterations);
+}
+
+}  // namespace pipeline_benchmark
+}  // namespace flight_panel
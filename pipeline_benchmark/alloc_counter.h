@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+#include "benchmark/benchmark.h"
+
+namespace flight_panel {
+namespace pipeline_benchmark {
+
+// Heap allocations made by the process so far, from any thread. The
+// benchmark binary replaces the global operator new to count them.
+int64_t AllocationCount();
+
+// Reports the allocations made since `start` (an AllocationCount() value) as
+// the "allocs_per_frame" counter, averaged over the benchmark iterations.
+void ReportAllocations(benchmark::State& state, int64_t start);
+
+}  // namespace pipeline_benchmark
+}  // namespace flight_panel
@@ -0,0 +1,13 @@
+#include "benchmark/benchmark.h"
+#include "spdlog/spdlog.h"
+
+int main(int argc, char** argv) {
+  // The pipeline logs on the hot path. Keep it quiet so the numbers measure
+  // the pipeline rather than the console.
+  spdlog::set_level(spdlog::level::warn);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include <cstring>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "data_def/proto/sim_data.pb.h"
+#include "data_def/sim_vars.h"
+#include "data_def/util.h"
+#include "pipeline_benchmark/alloc_counter.h"
+
+namespace flight_panel {
+namespace data {
+namespace {
+
+using pipeline_benchmark::AllocationCount;
+using pipeline_benchmark::ReportAllocations;
+
+// A frame with every kind of field set.
+SimVars SampleFrame() {
+  SimVars vars;
+  vars.adiBank = 12.5;
+  vars.asiAirspeed = 110;
+  vars.altAltitude = 4500;
+  vars.transponderCode = 4660;
+  return vars;
+}
+
+SimIdentity SampleIdentity() {
+  SimIdentity identity;
+  strncpy(identity.atcCallSign, "HAPPY", sizeof(identity.atcCallSign));
+  strncpy(identity.aircraft, "Cessna Skyhawk G1000", sizeof(identity.aircraft));
+  return identity;
+}
+
+void BM_ToSimData(benchmark::State& state) {
+  const SimVars vars = SampleFrame();
+  const SimIdentity identity = SampleIdentity();
+  const int64_t allocs_start = AllocationCount();
+  for (auto _ : state) {
+    SimData data = ToSimData(vars, identity);
+    benchmark::DoNotOptimize(data);
+  }
+  ReportAllocations(state, allocs_start);
+}
+BENCHMARK(BM_ToSimData);
+
+// The dispatcher's path: refills the same message every frame.
+void BM_ToSimDataInPlace(benchmark::State& state) {
+  const SimVars vars = SampleFrame();
+  const SimIdentity identity = SampleIdentity();
+  SimData data;
+  ToSimData(vars, identity, &data);
+  const int64_t allocs_start = AllocationCount();
+  for (auto _ : state) {
+    ToSimData(vars, identity, &data);
+    benchmark::DoNotOptimize(data);
+  }
+  ReportAllocations(state, allocs_start);
+}
+BENCHMARK(BM_ToSimDataInPlace);
+
+void BM_SerializeAsString(benchmark::State& state) {
+  const SimData data = ToSimData(SampleFrame(), SampleIdentity());
+  const int64_t allocs_start = AllocationCount();
+  for (auto _ : state) {
+    std::string serialized = data.SerializeAsString();
+    benchmark::DoNotOptimize(serialized);
+  }
+  ReportAllocations(state, allocs_start);
+  state.SetBytesProcessed(state.iterations() * data.ByteSizeLong());
+}
+BENCHMARK(BM_SerializeAsString);
+
+}  // namespace
+}  // namespace data
+}  // namespace flight_panel
@@ -0,0 +1,97 @@
+#include <memory>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "benchmark/benchmark.h"
+#include "data_def/sim_vars.h"
+#include "data_dispatcher/data_dispatcher.h"
+#include "data_reader/data_reader.h"
+#include "pipeline_benchmark/alloc_counter.h"
+#include "sim_bridge/sim_bridge.h"
+
+namespace flight_panel {
+namespace {
+
+using data_dispatcher::CreateDispatcher;
+using data_dispatcher::DispatcherOptions;
+using data_dispatcher::QueueMode;
+using pipeline_benchmark::AllocationCount;
+using pipeline_benchmark::ReportAllocations;
+using sim_bridge::DispatchHandler;
+using sim_bridge::RefreshPeriod;
+
+// Accepts the data definitions of the reader and reports the SimConnect size
+// of each, so the reader computes the real frame length.
+class FakeSimBridge : public sim_bridge::SimBridge {
+ public:
+  absl::Status Connect() override { return absl::OkStatus(); }
+  bool WaitForDispatch(absl::Duration timeout) override { return false; }
+  absl::Status CallDispatch(DispatchHandler* handler) override {
+    return absl::OkStatus();
+  }
+  absl::Status RequestData(int req_id, int def_id, RefreshPeriod period,
+                           int flags) override {
+    return absl::OkStatus();
+  }
+  absl::StatusOr<int> AddDataDef(int def_id, absl::string_view name,
+                                 absl::string_view unit_or_type) override {
+    int length;
+    if (absl::ConsumePrefix(&unit_or_type, "string") &&
+        absl::SimpleAtoi(unit_or_type, &length)) {
+      return length;
+    }
+    return static_cast<int>(sizeof(double));
+  }
+  absl::Status MapClientEvent(int event_id, absl::string_view name) override {
+    return absl::OkStatus();
+  }
+  absl::Status SubscribeSystemEvent(int event_id,
+                                    absl::string_view event_name) override {
+    return absl::OkStatus();
+  }
+  absl::Status TransmitClientEvent(int event_id, double value) override {
+    return absl::OkStatus();
+  }
+  absl::Status TransmitClientEvents(
+      absl::Span<const data::WriteData> events) override {
+    return absl::OkStatus();
+  }
+  absl::Status Close() override { return absl::OkStatus(); }
+};
+
+// DataReaderImpl::OnData as called from the SimConnect dispatch thread: copy
+// the frame out of the SimConnect buffer, stamp it and notify the dispatcher.
+// The dispatcher runs without recipients, so its worker only drains the queue.
+//
+// Args: queue mode.
+void BM_DataReaderOnData(benchmark::State& state) {
+  DispatcherOptions options;
+  options.queue_mode = static_cast<QueueMode>(state.range(0));
+  auto dispatcher = CreateDispatcher(options);
+  FakeSimBridge bridge;
+  auto reader = CreateDataReader(0, 0, &bridge, dispatcher.get());
+  if (!reader->RegisterDataDef().ok()) {
+    state.SkipWithError("RegisterDataDef failed");
+    return;
+  }
+  dispatcher->Start();
+
+  data::SimVars buffer;
+  const int64_t allocs_start = AllocationCount();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(reader->OnData(0, &buffer));
+  }
+  ReportAllocations(state, allocs_start);
+  dispatcher->Stop();
+  state.SetBytesProcessed(state.iterations() * reader->DataLength());
+}
+BENCHMARK(BM_DataReaderOnData)
+    ->ArgName("mode")
+    ->Arg(static_cast<int>(QueueMode::kLatestOnly))
+    ->Arg(static_cast<int>(QueueMode::kSpscRing));
+
+}  // namespace
+}  // namespace flight_panel
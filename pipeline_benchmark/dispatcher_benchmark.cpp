@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "benchmark/benchmark.h"
+#include "data_def/proto/sim_data.pb.h"
+#include "data_def/sim_vars.h"
+#include "data_dispatcher/data_dispatcher.h"
+#include "pipeline_benchmark/alloc_counter.h"
+#include "trace/latency.h"
+
+namespace flight_panel {
+namespace data_dispatcher {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using data::SimVars;
+using pipeline_benchmark::AllocationCount;
+using pipeline_benchmark::ReportAllocations;
+
+constexpr int kFramesPerRun = 300;
+
+int64_t NanosSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              start)
+      .count();
+}
+
+// Feeds the dispatcher at a fixed frame rate, like SimConnect does.
+// The iteration time is the cost of Notify() on the producer thread, which is
+// the SimConnect dispatch thread in production. "delivery_us" is the average
+// time from Notify() to the recipient callback.
+//
+// Args: queue mode, frame rate in Hz.
+void BM_DispatcherNotify(benchmark::State& state) {
+  DispatcherOptions options;
+  options.queue_mode = static_cast<QueueMode>(state.range(0));
+  const absl::Duration period = absl::Seconds(1) / state.range(1);
+  auto dispatcher = CreateDispatcher(options);
+
+  const Clock::time_point start = Clock::now();
+  std::atomic<int64_t> delivery_ns{0};
+  std::atomic<int64_t> delivered{0};
+  dispatcher->AddRecepient([&](const SimData& data) {
+    // The send time travels in the altitude field.
+    delivery_ns += NanosSince(start) -
+                   static_cast<int64_t>(data.instruments().indicated_altitude());
+    ++delivered;
+    return absl::OkStatus();
+  });
+  dispatcher->Start();
+
+  SimVars frame;
+  absl::Time next_frame = absl::Now();
+  for (auto _ : state) {
+    next_frame += period;
+    absl::SleepFor(next_frame - absl::Now());
+    const Clock::time_point notify_start = Clock::now();
+    frame.altAltitude = static_cast<double>(NanosSince(start));
+    dispatcher->Notify(frame);
+    state.SetIterationTime(
+        std::chrono::duration<double>(Clock::now() - notify_start).count());
+  }
+  while (dispatcher->QueueSize() > 0) {
+    ;
+  }
+  dispatcher->Stop();
+
+  if (delivered > 0) {
+    state.counters["delivery_us"] = delivery_ns / delivered / 1000.0;
+  }
+  state.counters["dropped"] = dispatcher->Stats().dropped;
+}
+BENCHMARK(BM_DispatcherNotify)
+    ->ArgNames({"mode", "hz"})
+    ->ArgsProduct({{static_cast<int>(QueueMode::kFifo),
+                    static_cast<int>(QueueMode::kSpscRing)},
+                   {60, 250, 1000}})
+    ->Iterations(kFramesPerRun)
+    ->UseManualTime();
+
+// Throughput of one frame fanned out to N recipients. Each iteration notifies
+// a frame and waits until every recipient got it, so the time per iteration
+// is the full trip through the dispatcher. The delivery percentiles are the
+// worst over all recipients, from receipt in Notify() to callback return.
+//
+// Args: number of recipients.
+void BM_DispatcherFanOut(benchmark::State& state) {
+  const int recipients = state.range(0);
+  auto dispatcher = CreateDispatcher();
+  std::atomic<int64_t> delivered{0};
+  std::vector<std::string> names;
+  for (int i = 0; i < recipients; ++i) {
+    RecipientOptions options;
+    options.name = absl::StrCat("fan_out_", recipients, "_", i);
+    names.push_back(options.name);
+    dispatcher->AddFrameRecipient(
+        [&delivered](SimFramePtr frame) {
+          benchmark::DoNotOptimize(frame->data());
+          delivered.fetch_add(1, std::memory_order_relaxed);
+          return absl::OkStatus();
+        },
+        options);
+  }
+  dispatcher->Start();
+  trace::ResetLatency();
+
+  SimVars frame;
+  int64_t expected = 0;
+  const int64_t allocs_start = AllocationCount();
+  for (auto _ : state) {
+    dispatcher->Notify(frame);
+    expected += recipients;
+    while (delivered.load(std::memory_order_relaxed) < expected) {
+      std::this_thread::yield();
+    }
+  }
+  ReportAllocations(state, allocs_start);
+  dispatcher->Stop();
+
+  int64_t p50 = 0, p99 = 0;
+  for (const std::string& name : names) {
+    trace::LatencyHistogram* histogram =
+        trace::GetLatencyHistogram(trace::Stage::kDelivery, name);
+    p50 = std::max(p50, histogram->Percentile(50));
+    p99 = std::max(p99, histogram->Percentile(99));
+  }
+  state.counters["p50_us"] = p50 / 1000.0;
+  state.counters["p99_us"] = p99 / 1000.0;
+  state.counters["frames_per_second"] =
+      benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_DispatcherFanOut)
+    ->ArgName("recipients")
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(16)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace data_dispatcher
+}  // namespace flight_panel
@@ -0,0 +1,81 @@
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "data_dispatcher/data_dispatcher.h"
+#include "sim_bridge/frame_log.h"
+#include "sim_bridge/replay_sim_bridge.h"
+#include "sim_runner/sim_runner.h"
+
+namespace flight_panel {
+namespace {
+
+using sim_bridge::FrameLogReader;
+using sim_bridge::LogRecord;
+using sim_bridge::LogRecordType;
+using sim_bridge::ReplayOptions;
+
+// The flight recorded with CreateRecordingSimBridge() to play back.
+constexpr char kReplayLogEnv[] = "FLIGHT_PANEL_REPLAY_LOG";
+
+// Number of data frames in the log, or -1 when it cannot be read.
+int64_t CountFrames(const std::string& path) {
+  FrameLogReader reader;
+  if (!reader.Open(path).ok()) return -1;
+  int64_t frames = 0;
+  LogRecord record;
+  while (reader.Next(&record)) {
+    if (record.type == LogRecordType::DATA ||
+        record.type == LogRecordType::TAGGED_DATA) {
+      ++frames;
+    }
+  }
+  return frames;
+}
+
+// Plays a recorded flight through SimRunner, DataReader and the dispatcher.
+// The log is named by the FLIGHT_PANEL_REPLAY_LOG environment variable.
+//
+// Args: playback speed, 0 for as fast as possible.
+void BM_ReplayFlight(benchmark::State& state) {
+  const char* path = std::getenv(kReplayLogEnv);
+  if (path == nullptr) {
+    state.SkipWithError("Set FLIGHT_PANEL_REPLAY_LOG to a frame log.");
+    return;
+  }
+  // SimRunner::Init() retries Connect() until it succeeds.
+  const int64_t frames = CountFrames(path);
+  if (frames < 0) {
+    state.SkipWithError("Cannot read the frame log.");
+    return;
+  }
+  ReplayOptions options;
+  options.speed = static_cast<double>(state.range(0));
+  for (auto _ : state) {
+    auto runner =
+        CreateSimRunner(sim_bridge::CreateReplaySimBridge(path, options),
+                        data_dispatcher::CreateDispatcher());
+    if (!runner->Init().ok()) {
+      state.SkipWithError("Init failed");
+      return;
+    }
+    runner->data_dispatcher()->Start();
+    const bool ran = runner->Run().ok();
+    runner->data_dispatcher()->Stop();
+    if (!ran) {
+      state.SkipWithError("Run failed");
+      return;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+}
+BENCHMARK(BM_ReplayFlight)
+    ->ArgName("speed")
+    ->Arg(0)
+    ->Arg(10)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace flight_panel
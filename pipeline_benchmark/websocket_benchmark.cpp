@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "benchmark/benchmark.h"
+#include "data_def/proto/sim_data.pb.h"
+#include "data_dispatcher/data_dispatcher.h"
+#include "pipeline_benchmark/alloc_counter.h"
+#include "sim_bridge/load_sim_bridge.h"
+#include "sim_runner/sim_runner.h"
+#include "websocket_server/websocket_server.h"
+#include <websocketpp/client.hpp>
+#include <websocketpp/config/asio_no_tls_client.hpp>
+
+namespace flight_panel {
+namespace ws {
+namespace {
+
+using Client = websocketpp::client<websocketpp::config::asio_client>;
+using data_dispatcher::DataDispatcher;
+using data_dispatcher::DispatcherStats;
+using data_dispatcher::RecipientOptions;
+using data_dispatcher::SimFramePtr;
+using pipeline_benchmark::AllocationCount;
+using pipeline_benchmark::ReportAllocations;
+
+constexpr uint16_t kPort = 18080;
+
+// Port of the server with `io_threads` I/O threads.
+uint16_t ServerPort(int io_threads) { return kPort + io_threads - 1; }
+
+// There is one server per I/O thread count, shared by all runs. Servers
+// have no way to stop, so their threads are left running until the
+// benchmark exits.
+WebSocketServer* GetServer(int io_threads = 1) {
+  static auto* const servers = new std::map<int, WebSocketServer*>();
+  WebSocketServer*& server = (*servers)[io_threads];
+  if (server == nullptr) {
+    ServerOptions options;
+    options.io_threads = io_threads;
+    server = new WebSocketServer(options);
+    std::thread(&WebSocketServer::Run, server, ServerPort(io_threads))
+        .detach();
+    std::thread(&WebSocketServer::ProcessEvents, server).detach();
+  }
+  return server;
+}
+
+void WaitForConnections(WebSocketServer* server, int count) {
+  while (server->ConnectionCount() != count) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+}
+
+// In-process clients that count the messages they receive. The first
+// `stalled` clients stop reading once connected, like a tablet on bad Wi-Fi.
+// They connect to the server with `io_threads` threads, and run as many
+// threads themselves so they are not what limits it.
+class Clients {
+ public:
+  explicit Clients(int count, int stalled = 0, int io_threads = 1)
+      : io_threads_(io_threads) {
+    client_.clear_access_channels(websocketpp::log::alevel::all);
+    client_.clear_error_channels(websocketpp::log::elevel::all);
+    client_.init_asio();
+    client_.set_message_handler(
+        [this](websocketpp::connection_hdl, Client::message_ptr) {
+          received_.fetch_add(1, std::memory_order_relaxed);
+        });
+    for (int i = 0; i < count; ++i) {
+      websocketpp::lib::error_code error;
+      Client::connection_ptr connection =
+          client_.get_connection(
+              absl::StrCat("ws://localhost:", ServerPort(io_threads)), error);
+      if (error) continue;
+      if (i < stalled) {
+        connection->set_open_handler([this](websocketpp::connection_hdl hdl) {
+          websocketpp::lib::error_code error;
+          client_.get_con_from_hdl(hdl, error)->pause_reading();
+        });
+        stalled_.push_back(connection);
+      }
+      client_.connect(connection);
+      connections_.push_back(connection->get_handle());
+    }
+    for (int i = 0; i < io_threads; ++i) {
+      threads_.emplace_back([this] { client_.run(); });
+    }
+  }
+
+  ~Clients() {
+    for (auto& connection : stalled_) connection->resume_reading();
+    for (auto& connection : connections_) {
+      websocketpp::lib::error_code error;
+      client_.close(connection, websocketpp::close::status::going_away, "",
+                    error);
+    }
+    // Let the server drop the connections before the next run.
+    WaitForConnections(GetServer(io_threads_), 0);
+    client_.stop();
+    for (std::thread& thread : threads_) thread.join();
+  }
+
+  int64_t received() const { return received_.load(std::memory_order_relaxed); }
+
+ private:
+  const int io_threads_;
+  Client client_;
+  std::vector<websocketpp::connection_hdl> connections_;
+  std::vector<Client::connection_ptr> stalled_;
+  std::atomic<int64_t> received_{0};
+  std::vector<std::thread> threads_;
+};
+
+// WebSocketServer::Broadcast of one serialized frame to N local clients. Each
+// iteration waits until every client received the frame.
+//
+// Args: number of clients.
+void BM_WebSocketBroadcast(benchmark::State& state) {
+  const int client_count = state.range(0);
+  WebSocketServer* server = GetServer();
+  Clients clients(client_count);
+  WaitForConnections(server, client_count);
+
+  SimData data;
+  data.mutable_instruments()->set_bank_angle(12.5);
+  data.mutable_aircraft_info()->set_call_sign("HAPPY");
+  const std::string payload = data.SerializeAsString();
+  int64_t expected = 0;
+  const int64_t allocs_start = AllocationCount();
+  for (auto _ : state) {
+    server->Broadcast(payload);
+    expected += client_count;
+    while (clients.received() < expected) {
+      std::this_thread::yield();
+    }
+  }
+  ReportAllocations(state, allocs_start);
+  state.SetBytesProcessed(state.iterations() * client_count * payload.size());
+}
+BENCHMARK(BM_WebSocketBroadcast)
+    ->ArgName("clients")
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(16)
+    ->Arg(50)
+    ->UseRealTime();
+
+// The time of one Broadcast() of a 64 KB message to N clients that read
+// everything and one that stopped reading. Broadcasts are paced 1 ms apart.
+// The stalled client's queue drops messages instead of holding up the
+// others, so the time should match BM_WebSocketBroadcast's without it.
+// "stalled_dropped" is the share of messages the stalled client lost,
+// "stalled_backlog" what it had queued at the end.
+//
+// Args: number of clients that keep up.
+void BM_BroadcastWithStalledClient(benchmark::State& state) {
+  const int client_count = state.range(0);
+  WebSocketServer* server = GetServer();
+  Clients clients(client_count + 1, /*stalled=*/1);
+  WaitForConnections(server, client_count + 1);
+
+  const std::string payload(64 << 10, 'x');
+  for (auto _ : state) {
+    const absl::Time start = absl::Now();
+    server->Broadcast(payload);
+    state.SetIterationTime(absl::ToDoubleSeconds(absl::Now() - start));
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  const std::vector<ConnectionStats> stats = server->GetConnectionStats();
+  const auto stalled =
+      std::max_element(stats.begin(), stats.end(),
+                       [](const ConnectionStats& a, const ConnectionStats& b) {
+                         return a.dropped < b.dropped;
+                       });
+  if (stalled != stats.end()) {
+    state.counters["stalled_dropped"] =
+        static_cast<double>(stalled->dropped) / state.iterations();
+    state.counters["stalled_backlog"] = stalled->backlog;
+  }
+  state.SetBytesProcessed(state.iterations() * (client_count + 1) *
+                          payload.size());
+}
+BENCHMARK(BM_BroadcastWithStalledClient)
+    ->ArgName("clients")
+    ->Arg(1)
+    ->Arg(4)
+    ->UseManualTime();
+
+// Fan-out throughput of a server with N I/O threads: each iteration
+// broadcasts a burst of 16 KB messages to 16 clients and waits until every
+// client received all of them. The payload is framed once, the writes to
+// the sockets are what the threads share.
+//
+// Args: server I/O threads.
+void BM_BroadcastFanOut(benchmark::State& state) {
+  constexpr int kClientCount = 16;
+  // Within the default outbound limits, so nothing is dropped.
+  constexpr int kBurst = 8;
+  const int io_threads = state.range(0);
+  WebSocketServer* server = GetServer(io_threads);
+  Clients clients(kClientCount, /*stalled=*/0, io_threads);
+  WaitForConnections(server, kClientCount);
+
+  const std::string payload(16 << 10, 'x');
+  int64_t expected = 0;
+  for (auto _ : state) {
+    for (int i = 0; i < kBurst; ++i) server->Broadcast(payload);
+    expected += kBurst * kClientCount;
+    while (clients.received() < expected) {
+      std::this_thread::yield();
+    }
+  }
+  state.SetItemsProcessed(expected);
+  state.SetBytesProcessed(expected * payload.size());
+}
+BENCHMARK(BM_BroadcastFanOut)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->UseRealTime();
+
+// The whole pipeline under synthetic load: frames from LoadSimBridge go
+// through SimRunner, DataReader, the dispatcher and the server to local
+// clients. Each iteration plays one second of frames.
+// "dispatched" is the share of the reader's frames the dispatcher sent on,
+// "received" the share of those that reached every client, and
+// "peak_backlog" the most frames waiting in the dispatcher at once.
+//
+// Args: frame rate in Hz, frames per burst.
+void BM_LoadPipeline(benchmark::State& state) {
+  constexpr int kClientCount = 4;
+  WebSocketServer* server = GetServer();
+  Clients clients(kClientCount);
+  WaitForConnections(server, kClientCount);
+
+  sim_bridge::LoadOptions load;
+  load.rate_hz = static_cast<double>(state.range(0));
+  load.burst_frames = static_cast<int>(state.range(1));
+  load.string_churn_hz = 1;
+  load.frame_count = state.range(0);
+  DispatcherStats totals;
+  int64_t expected = 0;
+  int peak_backlog = 0;
+  for (auto _ : state) {
+    auto runner = CreateSimRunner(sim_bridge::CreateLoadSimBridge(load),
+                                  data_dispatcher::CreateDispatcher());
+    DataDispatcher* dispatcher = runner->data_dispatcher();
+    RecipientOptions options;
+    options.name = "server";
+    const absl::Status added = dispatcher->AddFrameRecipient(
+        [server](SimFramePtr frame) {
+          return server->Broadcast(frame->SerializedData());
+        },
+        options);
+    if (!added.ok() || !runner->Init().ok()) {
+      state.SkipWithError("Setup failed");
+      return;
+    }
+    dispatcher->Start();
+    std::atomic<bool> running{true};
+    std::thread sampler([&] {
+      while (running.load()) {
+        peak_backlog = std::max(peak_backlog, dispatcher->QueueSize());
+        absl::SleepFor(absl::Milliseconds(1));
+      }
+    });
+    const bool ran = runner->Run().ok();
+    while (dispatcher->QueueSize() > 0) absl::SleepFor(absl::Milliseconds(1));
+    running = false;
+    sampler.join();
+    dispatcher->Stop();
+    if (!ran) {
+      state.SkipWithError("Run failed");
+      return;
+    }
+    const DispatcherStats stats = dispatcher->Stats();
+    totals.notified += stats.notified;
+    totals.dispatched += stats.dispatched;
+    expected += stats.dispatched * kClientCount;
+  }
+  // Let the last broadcasts arrive.
+  const absl::Time deadline = absl::Now() + absl::Seconds(1);
+  while (clients.received() < expected && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  const double notified = static_cast<double>(std::max<int64_t>(
+      totals.notified, 1));
+  const double sent = static_cast<double>(std::max<int64_t>(expected, 1));
+  state.counters["dispatched"] = totals.dispatched / notified;
+  state.counters["received"] = clients.received() / sent;
+  state.counters["peak_backlog"] = peak_backlog;
+  state.SetItemsProcessed(totals.notified);
+}
+BENCHMARK(BM_LoadPipeline)
+    ->ArgNames({"hz", "burst"})
+    ->Args({60, 1})
+    ->Args({500, 1})
+    ->Args({2000, 1})
+    ->Args({2000, 20})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace ws
+}  // namespace flight_panel
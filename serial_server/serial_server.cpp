@@ -7,6 +7,7 @@
 #include "absl/time/clock.h"
 #include "serial_server/serial_port.h"
 #include "data_def/proto/sim_data.pb.h"
+#include "trace/latency.h"
 // #define TEST_LED
 
 namespace flight_panel {
@@ -29,6 +30,8 @@ class SerialServerImpl : public SerialServer {
   int bufSize_ = 0;
   std::unique_ptr<SerialPort> serial_;
   const absl::Duration sendInterval_;
+  trace::LatencyHistogram* const write_latency_ =
+      trace::GetLatencyHistogram(trace::Stage::kSerialWrite);
   void UpdateData(const SimData& data);
   void ProcessRead(int bytesRead);
 };
@@ -54,9 +57,11 @@ void SerialServerImpl::Run() {
 #else
     //UpdateData();
 #endif
+    const int64_t write_start = trace::MonotonicNanos();
     if (!serial_->writeSerialPort((char*)&instrumentData_,
                                   sizeof(InstrumentData)))
       Log("Failed to write to serial port!");
+    write_latency_->Record(trace::MonotonicNanos() - write_start);
     absl::SleepFor(sendInterval_);
     bytesRead = serial_->readSerialPort(rBuf_, kBufSize);
     if (bytesRead > 0) {
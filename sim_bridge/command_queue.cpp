@@ -0,0 +1,87 @@
+#include "sim_bridge/command_queue.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "absl/time/clock.h"
+#include "data_def/util.h"
+#include "spdlog/spdlog.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+namespace {
+// Values are sent as integers, a reported value this close to the one sent
+// is the one sent.
+constexpr double kReportedTolerance = 0.5;
+}  // namespace
+
+absl::Status CommandQueue::Push(const data::WriteData& command) {
+  if (!ring_.TryPush(command)) {
+    return absl::ResourceExhaustedError("Command queue is full.");
+  }
+  return absl::OkStatus();
+}
+
+void CommandQueue::Drain(const CurrentValue& current,
+                         std::vector<data::WriteData>* batch) {
+  batch->clear();
+  const absl::Time now = absl::Now();
+  ForgetReportedValues(current, now);
+  data::WriteData command;
+  for (size_t i = 0; i < ring_.Capacity() && ring_.TryPop(&command); ++i) {
+    if (!command.relative) {
+      batch->push_back(command);
+      continue;
+    }
+    auto set = std::find_if(batch->rbegin(), batch->rend(),
+                            [&command](const data::WriteData& queued) {
+                              return queued.eventId == command.eventId;
+                            });
+    if (set != batch->rend()) {
+      // Summed steps can run past the end of an axis.
+      set->value = data::ClampEventValue(command.eventId,
+                                         set->value + command.value);
+      continue;
+    }
+    double value;
+    if (!BaseValue(current, command.eventId, &value)) {
+      SPDLOG_WARN("Dropped relative command of event {}: no current value.",
+                  command.eventId);
+      continue;
+    }
+    command.value = data::ClampEventValue(command.eventId,
+                                          command.value + value);
+    command.relative = false;
+    batch->push_back(command);
+  }
+  for (const data::WriteData& sent : *batch) {
+    sent_[sent.eventId] = {std::round(sent.value), now};
+  }
+}
+
+void CommandQueue::ForgetReportedValues(const CurrentValue& current,
+                                        absl::Time now) {
+  for (auto it = sent_.begin(); it != sent_.end();) {
+    double reported;
+    const bool caught_up =
+        current(it->first, &reported) &&
+        std::abs(data::ClampEventValue(it->first, reported) -
+                 it->second.value) <= kReportedTolerance;
+    if (caught_up || now - it->second.time > sent_value_timeout_) {
+      sent_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool CommandQueue::BaseValue(const CurrentValue& current, data::EVENT_ID id,
+                             double* value) const {
+  auto it = sent_.find(id);
+  if (it == sent_.end()) return current(id, value);
+  *value = it->second.value;
+  return true;
+}
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "data_def/sim_vars.h"
+#include "sim_bridge/mpsc_ring.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+
+// Commands to the sim, queued from any thread and sent by the sim thread in
+// one batch per dispatch cycle.
+//
+// Push() is lock-free and may be called from any number of threads, e.g. the
+// serial port and the WebSocket server. Drain() must only be called from the
+// sim thread, which sends the batch with SimBridge::TransmitClientEvents().
+class CommandQueue {
+ public:
+  // Sets `value` to the current value of the setting an event sets, see
+  // data::CurrentEventValue(). Returns false if it is unknown.
+  using CurrentValue = std::function<bool(data::EVENT_ID id, double* value)>;
+
+  // `sent_value_timeout` is how long a value sent to the sim is used as the
+  // base of relative commands while the sim reports something else.
+  explicit CommandQueue(
+      size_t capacity = 256,
+      absl::Duration sent_value_timeout = absl::Milliseconds(500))
+      : ring_(capacity), sent_value_timeout_(sent_value_timeout) {}
+
+  // Returns ResourceExhausted if the queue is full.
+  absl::Status Push(const data::WriteData& command);
+
+  // Replaces `batch` by the queued commands, in order, with relative commands
+  // coalesced: a relative command is added to the last absolute command of
+  // the same event in the batch, or else becomes one, set to the current
+  // value plus the change, limited to the event's range, see
+  // data::ClampEventValue(). Absolute commands are kept as they are, so
+  // repeated toggles are not lost. Relative commands without a current value
+  // are dropped. Takes at most the capacity of the queue, so producers cannot
+  // keep the sim thread here.
+  //
+  // The sim reports a new setting a frame or more after it was sent, so the
+  // current value of an event sent in an earlier batch is the value sent,
+  // until the sim reports it or sent_value_timeout passed.
+  void Drain(const CurrentValue& current, std::vector<data::WriteData>* batch);
+
+ private:
+  // A value sent to the sim, as the sim receives it.
+  struct SentValue {
+    double value;
+    absl::Time time;
+  };
+
+  // Forgets the sent values the sim reports, or that it never took.
+  void ForgetReportedValues(const CurrentValue& current, absl::Time now);
+  // The value relative commands of `id` are added to.
+  bool BaseValue(const CurrentValue& current, data::EVENT_ID id,
+                 double* value) const;
+
+  MpscRing<data::WriteData> ring_;
+  const absl::Duration sent_value_timeout_;
+  // The last value sent for each event. Only used by Drain().
+  absl::flat_hash_map<data::EVENT_ID, SentValue> sent_;
+};
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
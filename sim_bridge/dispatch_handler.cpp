@@ -25,5 +25,13 @@ absl::Status GroupedDispatchHandler::OnData(int req_id, void* pData) {
   }
   return absl::OkStatus();
 }
+
+absl::Status GroupedDispatchHandler::OnTaggedData(int req_id, int datum_count,
+                                                  void* pData) {
+  for (auto handler : handlers_) {
+    RETURN_IF_ERROR(handler->OnTaggedData(req_id, datum_count, pData));
+  }
+  return absl::OkStatus();
+}
 }  // namespace sim_bridge
 }  // namespace flight_panel
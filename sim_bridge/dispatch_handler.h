@@ -9,12 +9,17 @@ namespace sim_bridge {
 // The data handler interface, uesd in dispatch callback.
 class DispatchHandler {
  public:
+  virtual ~DispatchHandler() = default;
   virtual absl::Status OnStart() = 0;
   virtual absl::Status OnStop() = 0;
   // The caller who setup the data request should know the layout of data type
   // and is responsible for converting the data pointer to correct type and
   // size.
   virtual absl::Status OnData(int req_id, void* pData) = 0;
+  // Data of a REQUEST_TAGGED request: `datum_count` entries of a DWORD datum
+  // ID followed by the var, sized as it was added to the data def.
+  virtual absl::Status OnTaggedData(int req_id, int datum_count,
+                                    void* pData) = 0;
 };
 
 // A handler that groups other handlers.
@@ -29,6 +34,7 @@ class GroupedDispatchHandler : DispatchHandler {
   absl::Status OnStart();
   absl::Status OnStop();
   absl::Status OnData(int req_id, void* pData);
+  absl::Status OnTaggedData(int req_id, int datum_count, void* pData);
 
  private:
   std::vector<DispatchHandler*> handlers_;
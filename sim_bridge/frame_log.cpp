@@ -0,0 +1,209 @@
+#include "sim_bridge/frame_log.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl_helper/status_macros.h"
+#include "spdlog/spdlog.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+namespace {
+
+struct LogFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+constexpr char kLogMagic[8] = {'F', 'P', 'F', 'R', 'M', 'L', 'O', 'G'};
+constexpr uint32_t kLogVersion = 1;
+constexpr size_t kLogAlignment = 8;
+
+size_t Padded(size_t size) {
+  return (size + kLogAlignment - 1) / kLogAlignment * kLogAlignment;
+}
+
+}  // namespace
+
+FrameLogWriter::~FrameLogWriter() { Close().IgnoreError(); }
+
+absl::Status FrameLogWriter::Open(const std::string& path) {
+  RETURN_IF_ERROR(Close());
+  file_ = std::fopen(path.c_str(), "wb");
+  if (file_ == nullptr) {
+    return absl::UnavailableError(absl::StrCat("Failed to create ", path));
+  }
+  LogFileHeader header = {};
+  std::memcpy(header.magic, kLogMagic, sizeof(kLogMagic));
+  header.version = kLogVersion;
+  if (std::fwrite(&header, sizeof(header), 1, file_) != 1) {
+    Close().IgnoreError();
+    return absl::InternalError(absl::StrCat("Failed to write ", path));
+  }
+  start_ = absl::Now();
+  return absl::OkStatus();
+}
+
+absl::Status FrameLogWriter::Append(LogRecordType type, int id, int count,
+                                    absl::string_view payload) {
+  if (file_ == nullptr) {
+    return absl::FailedPreconditionError("Frame log is not open.");
+  }
+  LogRecordHeader header;
+  header.type = static_cast<uint32_t>(type);
+  header.size = static_cast<uint32_t>(payload.size());
+  header.time_ns = absl::ToInt64Nanoseconds(absl::Now() - start_);
+  header.id = id;
+  header.count = count;
+  static const char kPadding[kLogAlignment] = {};
+  const size_t padding = Padded(payload.size()) - payload.size();
+  if (std::fwrite(&header, sizeof(header), 1, file_) != 1 ||
+      std::fwrite(payload.data(), 1, payload.size(), file_) !=
+          payload.size() ||
+      std::fwrite(kPadding, 1, padding, file_) != padding) {
+    return absl::InternalError("Failed to append to frame log.");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FrameLogWriter::Flush() {
+  if (file_ != nullptr && std::fflush(file_) != 0) {
+    return absl::InternalError("Failed to flush frame log.");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FrameLogWriter::Close() {
+  if (file_ == nullptr) return absl::OkStatus();
+  const int result = std::fclose(file_);
+  file_ = nullptr;
+  if (result != 0) return absl::InternalError("Failed to close frame log.");
+  return absl::OkStatus();
+}
+
+FrameLogReader::~FrameLogReader() { Close(); }
+
+absl::Status FrameLogReader::Open(const std::string& path) {
+  Close();
+#ifdef _WIN32
+  file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    file_ = nullptr;
+    return absl::NotFoundError(absl::StrCat("Failed to open ", path));
+  }
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file_, &file_size)) {
+    Close();
+    return absl::InternalError(absl::StrCat("Failed to stat ", path));
+  }
+  mapped_size_ = static_cast<size_t>(file_size.QuadPart);
+  if (mapped_size_ >= sizeof(LogFileHeader)) {
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_ != nullptr) {
+      data_ = static_cast<const char*>(
+          MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (data_ == nullptr) {
+      Close();
+      return absl::InternalError(absl::StrCat("Failed to map ", path));
+    }
+  }
+#else
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::NotFoundError(absl::StrCat("Failed to open ", path));
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return absl::InternalError(absl::StrCat("Failed to stat ", path));
+  }
+  mapped_size_ = static_cast<size_t>(file_stat.st_size);
+  if (mapped_size_ >= sizeof(LogFileHeader)) {
+    void* data = mmap(nullptr, mapped_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      mapped_size_ = 0;
+      return absl::InternalError(absl::StrCat("Failed to map ", path));
+    }
+    data_ = static_cast<const char*>(data);
+  }
+  // The mapping keeps the file.
+  close(fd);
+#endif
+  LogFileHeader header = {};
+  if (data_ != nullptr) std::memcpy(&header, data_, sizeof(header));
+  if (std::memcmp(header.magic, kLogMagic, sizeof(kLogMagic)) != 0) {
+    Close();
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " is not a frame log."));
+  }
+  if (header.version != kLogVersion) {
+    Close();
+    return absl::InvalidArgumentError(absl::StrCat(
+        path, " has frame log version ", header.version, ", expected ",
+        kLogVersion, "."));
+  }
+  // Keep the complete records only.
+  size_ = sizeof(LogFileHeader);
+  while (mapped_size_ - size_ >= sizeof(LogRecordHeader)) {
+    LogRecordHeader record;
+    std::memcpy(&record, data_ + size_, sizeof(record));
+    const size_t record_size = sizeof(record) + Padded(record.size);
+    if (mapped_size_ - size_ < record_size) break;
+    size_ += record_size;
+  }
+  if (size_ != mapped_size_) {
+    SPDLOG_WARN("Frame log {} ends with an incomplete record.", path);
+  }
+  offset_ = sizeof(LogFileHeader);
+  return absl::OkStatus();
+}
+
+bool FrameLogReader::Next(LogRecord* record) {
+  if (offset_ >= size_) return false;
+  // Headers are 8 byte aligned in the mapping.
+  const LogRecordHeader* header =
+      reinterpret_cast<const LogRecordHeader*>(data_ + offset_);
+  record->type = static_cast<LogRecordType>(header->type);
+  record->time = absl::Nanoseconds(header->time_ns);
+  record->id = header->id;
+  record->count = header->count;
+  record->payload =
+      absl::string_view(data_ + offset_ + sizeof(*header), header->size);
+  offset_ += sizeof(*header) + Padded(header->size);
+  return true;
+}
+
+void FrameLogReader::Rewind() { offset_ = sizeof(LogFileHeader); }
+
+void FrameLogReader::Close() {
+#ifdef _WIN32
+  if (data_ != nullptr) UnmapViewOfFile(data_);
+  if (mapping_ != nullptr) CloseHandle(mapping_);
+  if (file_ != nullptr) CloseHandle(file_);
+  mapping_ = nullptr;
+  file_ = nullptr;
+#else
+  if (data_ != nullptr) munmap(const_cast<char*>(data_), mapped_size_);
+#endif
+  data_ = nullptr;
+  size_ = 0;
+  mapped_size_ = 0;
+  offset_ = 0;
+}
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
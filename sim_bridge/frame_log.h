@@ -0,0 +1,102 @@
+// A compact binary log of what a SimBridge saw: the data defs, the sim events
+// and the data frames, each with the time it arrived. RecordingSimBridge
+// writes it and ReplaySimBridge plays it back.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+
+enum class LogRecordType : uint32_t {
+  // `id` is the def ID and `count` the data length. The payload is the var
+  // name and its unit or type, each followed by '\0'.
+  DATA_DEF = 1,
+  START = 2,
+  STOP = 3,
+  // `id` is the request ID. The payload is the data block.
+  DATA = 4,
+  // `id` is the request ID and `count` the datum count. The payload is the
+  // tagged data block.
+  TAGGED_DATA = 5,
+};
+
+// A record as stored in the log. The payload follows it, padded to 8 bytes so
+// the next header and every payload stay aligned.
+struct LogRecordHeader {
+  uint32_t type;
+  // Payload size without the padding.
+  uint32_t size;
+  // Time since the log was opened.
+  int64_t time_ns;
+  int32_t id;
+  int32_t count;
+};
+
+struct LogRecord {
+  LogRecordType type;
+  absl::Duration time;
+  int id;
+  int count;
+  absl::string_view payload;
+};
+
+// Appends records to a new log file.
+class FrameLogWriter {
+ public:
+  FrameLogWriter() = default;
+  FrameLogWriter(const FrameLogWriter&) = delete;
+  FrameLogWriter& operator=(const FrameLogWriter&) = delete;
+  ~FrameLogWriter();
+
+  // Replaces the file at `path` by an empty log. Record times count from here.
+  absl::Status Open(const std::string& path);
+  bool is_open() const { return file_ != nullptr; }
+  absl::Status Append(LogRecordType type, int id, int count,
+                      absl::string_view payload);
+  absl::Status Flush();
+  absl::Status Close();
+
+ private:
+  std::FILE* file_ = nullptr;
+  absl::Time start_;
+};
+
+// Maps a log into memory and walks its records. The payloads point into the
+// mapping and stay valid until the reader is closed.
+class FrameLogReader {
+ public:
+  FrameLogReader() = default;
+  FrameLogReader(const FrameLogReader&) = delete;
+  FrameLogReader& operator=(const FrameLogReader&) = delete;
+  ~FrameLogReader();
+
+  // Maps the log at `path`. A record cut short, as left by a recording that
+  // did not close, ends the log.
+  absl::Status Open(const std::string& path);
+  // Reads the next record. Returns false at the end of the log.
+  bool Next(LogRecord* record);
+  // Goes back to the first record.
+  void Rewind();
+  void Close();
+
+ private:
+  const char* data_ = nullptr;
+  // End of the last complete record.
+  size_t size_ = 0;
+  size_t mapped_size_ = 0;
+  size_t offset_ = 0;
+#ifdef _WIN32
+  void* file_ = nullptr;
+  void* mapping_ = nullptr;
+#endif
+};
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
@@ -0,0 +1,295 @@
+#include "sim_bridge/load_sim_bridge.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
+#include "absl/time/clock.h"
+#include "sim_bridge/dispatch_handler.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+namespace {
+
+constexpr double kMinRateHz = 1;
+constexpr double kMaxRateHz = 2000;
+
+LoadOptions Clamped(LoadOptions options) {
+  options.rate_hz = std::min(std::max(options.rate_hz, kMinRateHz), kMaxRateHz);
+  options.burst_frames = std::max(options.burst_frames, 1);
+  options.volatility = std::min(std::max(options.volatility, 0.0), 1.0);
+  return options;
+}
+
+class LoadSimBridge : public SimBridge {
+ public:
+  explicit LoadSimBridge(LoadOptions options);
+
+  // Inherited via SimBridge
+  absl::Status Connect() override;
+  bool WaitForDispatch(absl::Duration timeout) override;
+  absl::Status CallDispatch(DispatchHandler* handler) override;
+  absl::Status RequestData(int req_id, int def_id, RefreshPeriod period,
+                           int flags) override;
+  absl::StatusOr<int> AddDataDef(int def_id, absl::string_view name,
+                                 absl::string_view unit_or_type) override;
+  absl::Status MapClientEvent(int event_id, absl::string_view name) override {
+    return absl::OkStatus();
+  }
+  absl::Status SubscribeSystemEvent(int event_id,
+                                    absl::string_view event_name) override {
+    return absl::OkStatus();
+  }
+  absl::Status TransmitClientEvent(int event_id, double value) override {
+    return absl::OkStatus();
+  }
+  absl::Status TransmitClientEvents(
+      absl::Span<const data::WriteData> events) override {
+    return absl::OkStatus();
+  }
+  absl::Status Close() override { return absl::OkStatus(); }
+
+ private:
+  struct Var {
+    size_t offset;
+    size_t size;
+    bool is_string;
+  };
+  struct DataDef {
+    std::vector<Var> vars;
+    // The current values, laid out as SimConnect sends them.
+    std::vector<char> block;
+  };
+  struct Request {
+    int def_id;
+    RefreshPeriod period;
+    int flags;
+    // The block as last sent, for changed-only requests.
+    std::vector<char> last_sent;
+    bool sent = false;
+    // The second of the last frame, for SECOND requests.
+    int64_t second = -1;
+  };
+
+  // When the next burst is due.
+  absl::Time DueTime() const;
+  // Moves the vars to the next frame.
+  void Update();
+  void UpdateString(DataDef* def, const Var& var);
+  absl::Status SendFrame(DispatchHandler* handler);
+  absl::Status Send(int req_id, Request* request, DispatchHandler* handler);
+
+  const LoadOptions options_;
+  std::mt19937 random_;
+  absl::flat_hash_map<int, DataDef> defs_;
+  absl::flat_hash_map<int, Request> requests_;
+  // Every string var, as def ID and var index.
+  std::vector<std::pair<int, int>> strings_;
+  // Scratch buffer of tagged blocks.
+  std::vector<char> tagged_;
+  absl::Time start_;
+  int64_t frame_ = 0;
+  int64_t bursts_ = 0;
+  int64_t string_changes_ = 0;
+  // Fractional string changes carried to the next frame.
+  double churn_ = 0;
+  bool started_ = false;
+  bool stopped_ = false;
+};
+
+LoadSimBridge::LoadSimBridge(LoadOptions options)
+    : options_(Clamped(options)), random_(options.seed) {}
+
+absl::Status LoadSimBridge::Connect() {
+  // Data defs do not outlive the connection.
+  defs_.clear();
+  requests_.clear();
+  strings_.clear();
+  start_ = absl::Now();
+  frame_ = 0;
+  bursts_ = 0;
+  started_ = false;
+  stopped_ = false;
+  return absl::OkStatus();
+}
+
+bool LoadSimBridge::WaitForDispatch(absl::Duration timeout) {
+  if (stopped_) {
+    absl::SleepFor(timeout);
+    return false;
+  }
+  const absl::Duration wait = DueTime() - absl::Now();
+  if (wait > timeout) {
+    absl::SleepFor(timeout);
+    return false;
+  }
+  if (wait > absl::ZeroDuration()) absl::SleepFor(wait);
+  return true;
+}
+
+absl::Status LoadSimBridge::CallDispatch(DispatchHandler* handler) {
+  if (stopped_) return absl::OkStatus();
+  absl::Status status;
+  if (!started_) {
+    started_ = true;
+    status.Update(handler->OnStart());
+  }
+  const absl::Time now = absl::Now();
+  while (DueTime() <= now) {
+    for (int i = 0; i < options_.burst_frames; ++i) {
+      if (options_.frame_count > 0 && frame_ >= options_.frame_count) {
+        stopped_ = true;
+        status.Update(handler->OnStop());
+        return status;
+      }
+      status.Update(SendFrame(handler));
+    }
+    ++bursts_;
+  }
+  return status;
+}
+
+absl::Status LoadSimBridge::RequestData(int req_id, int def_id,
+                                        RefreshPeriod period, int flags) {
+  if (!defs_.contains(def_id)) {
+    return absl::NotFoundError(absl::StrCat("Unknown data def: ", def_id));
+  }
+  Request& request = requests_[req_id];
+  request = Request();
+  request.def_id = def_id;
+  request.period = period;
+  request.flags = flags;
+  return absl::OkStatus();
+}
+
+absl::StatusOr<int> LoadSimBridge::AddDataDef(int def_id,
+                                              absl::string_view name,
+                                              absl::string_view unit_or_type) {
+  int length = sizeof(double);
+  const bool is_string = absl::ConsumePrefix(&unit_or_type, "string");
+  if (is_string && !absl::SimpleAtoi(unit_or_type, &length)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid data def type: ", name, " string",
+                     unit_or_type));
+  }
+  DataDef& def = defs_[def_id];
+  def.vars.push_back(Var{def.block.size(), static_cast<size_t>(length),
+                         is_string});
+  def.block.resize(def.block.size() + length);
+  if (is_string) {
+    strings_.emplace_back(def_id, static_cast<int>(def.vars.size() - 1));
+    UpdateString(&def, def.vars.back());
+  }
+  return length;
+}
+
+absl::Time LoadSimBridge::DueTime() const {
+  return start_ + absl::Seconds(bursts_ * options_.burst_frames /
+                                options_.rate_hz);
+}
+
+void LoadSimBridge::Update() {
+  std::bernoulli_distribution changes(options_.volatility);
+  const double time = frame_ / options_.rate_hz;
+  for (auto& entry : defs_) {
+    DataDef& def = entry.second;
+    for (size_t i = 0; i < def.vars.size(); ++i) {
+      const Var& var = def.vars[i];
+      if (var.is_string || !changes(random_)) continue;
+      // A slow wave per var, so values look like instruments moving.
+      const double value = 100 * std::sin(time * (1 + i % 7) + i) + i;
+      std::memcpy(def.block.data() + var.offset, &value, sizeof(value));
+    }
+  }
+  if (strings_.empty()) return;
+  churn_ += options_.string_churn_hz / options_.rate_hz;
+  std::uniform_int_distribution<size_t> pick(0, strings_.size() - 1);
+  for (; churn_ >= 1; churn_ -= 1) {
+    const std::pair<int, int>& string = strings_[pick(random_)];
+    DataDef& def = defs_[string.first];
+    UpdateString(&def, def.vars[string.second]);
+  }
+}
+
+void LoadSimBridge::UpdateString(DataDef* def, const Var& var) {
+  const std::string value = absl::StrCat("LOAD", string_changes_++);
+  char* data = def->block.data() + var.offset;
+  std::memset(data, 0, var.size);
+  std::memcpy(data, value.data(), std::min(value.size(), var.size - 1));
+}
+
+absl::Status LoadSimBridge::SendFrame(DispatchHandler* handler) {
+  Update();
+  absl::Status status;
+  for (auto& entry : requests_) {
+    status.Update(Send(entry.first, &entry.second, handler));
+  }
+  ++frame_;
+  return status;
+}
+
+absl::Status LoadSimBridge::Send(int req_id, Request* request,
+                                 DispatchHandler* handler) {
+  switch (request->period) {
+    case RefreshPeriod::NEVER:
+      return absl::OkStatus();
+    case RefreshPeriod::ONCE:
+      if (request->sent) return absl::OkStatus();
+      break;
+    case RefreshPeriod::SECOND: {
+      const int64_t second =
+          static_cast<int64_t>(frame_ / options_.rate_hz);
+      if (second == request->second) return absl::OkStatus();
+      request->second = second;
+      break;
+    }
+    case RefreshPeriod::VISUAL_FRAME:
+    case RefreshPeriod::SIM_FRAME:
+      break;
+  }
+  DataDef& def = defs_[request->def_id];
+  const bool first = !request->sent;
+  request->sent = true;
+  if (request->flags & REQUEST_TAGGED) {
+    tagged_.clear();
+    int datum_count = 0;
+    for (size_t i = 0; i < def.vars.size(); ++i) {
+      const Var& var = def.vars[i];
+      const char* value = def.block.data() + var.offset;
+      if (!first && std::memcmp(value, request->last_sent.data() + var.offset,
+                                var.size) == 0) {
+        continue;
+      }
+      const uint32_t datum_id = static_cast<uint32_t>(i);
+      const char* id = reinterpret_cast<const char*>(&datum_id);
+      tagged_.insert(tagged_.end(), id, id + sizeof(datum_id));
+      tagged_.insert(tagged_.end(), value, value + var.size);
+      ++datum_count;
+    }
+    request->last_sent = def.block;
+    if (datum_count == 0) return absl::OkStatus();
+    return handler->OnTaggedData(req_id, datum_count, tagged_.data());
+  }
+  if (request->flags & REQUEST_CHANGED) {
+    if (!first && request->last_sent == def.block) return absl::OkStatus();
+    request->last_sent = def.block;
+  }
+  return handler->OnData(req_id, def.block.data());
+}
+
+}  // namespace
+
+std::unique_ptr<SimBridge> CreateLoadSimBridge(LoadOptions options) {
+  return absl::make_unique<LoadSimBridge>(options);
+}
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "sim_bridge/sim_bridge.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+
+struct LoadOptions {
+  // Frames per second on average, from 1 to 2000.
+  double rate_hz = 60;
+  // Frames sent back to back at each wakeup. Wakeups are spaced so the
+  // average rate stays rate_hz.
+  int burst_frames = 1;
+  // Share of the numeric vars that change in a frame, from 0 to 1.
+  double volatility = 1;
+  // String changes per second, spread over all string vars.
+  double string_churn_hz = 0;
+  // Frames sent before the sim stops. 0 never stops.
+  int64_t frame_count = 0;
+  uint32_t seed = 1;
+};
+
+// Returns a SimBridge that generates sim data without a sim, to load the
+// pipeline behind it. The data blocks follow the registered data defs and
+// honor the period and flags of each request, like SimConnect: changed-only
+// requests skip unchanged blocks and tagged requests only carry the changed
+// vars. Frames are generated on a clock started by Connect(). When the
+// handler falls behind, every overdue frame is sent at the next dispatch, as
+// SimConnect queues them.
+std::unique_ptr<SimBridge> CreateLoadSimBridge(LoadOptions options);
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
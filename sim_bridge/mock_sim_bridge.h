@@ -8,10 +8,12 @@ namespace sim_bridge {
 class MockSimBridge : public SimBridge {
  public:
   MOCK_METHOD(absl::Status, Connect, (), (override));
+  MOCK_METHOD(bool, WaitForDispatch, (absl::Duration timeout), (override));
   MOCK_METHOD(absl::Status, CallDispatch, (DispatchHandler * handler),
               (override));
   MOCK_METHOD(absl::Status, RequestData,
-              (int req_id, int def_id, RefreshPeriod period), (override));
+              (int req_id, int def_id, RefreshPeriod period, int flags),
+              (override));
   MOCK_METHOD(absl::StatusOr<int>, AddDataDef,
               (int def_id, absl::string_view name,
                absl::string_view unit_or_type),
@@ -22,6 +24,8 @@ class MockSimBridge : public SimBridge {
   MOCK_METHOD(absl::Status, SubscribeSystemEvent, (int, absl::string_view));
   MOCK_METHOD(absl::Status, TransmitClientEvent, (int event_id, double value),
               (override));
+  MOCK_METHOD(absl::Status, TransmitClientEvents,
+              (absl::Span<const data::WriteData> events), (override));
   MOCK_METHOD(absl::Status, Close, (), (override));
 };
 }  // namespace sim_bridge
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace flight_panel {
+namespace sim_bridge {
+
+// A bounded multi-producer/single-consumer ring buffer.
+//
+// All slots are allocated when the ring is created. TryPush() may be called
+// from any number of threads, TryPop() only from one consumer thread. Neither
+// takes a lock or allocates. Each slot carries a sequence number that tells
+// whose turn it is, so producers only contend on the claim of a position.
+template <typename T>
+class MpscRing {
+ public:
+  // The capacity is rounded up to a power of two.
+  explicit MpscRing(size_t capacity)
+      : slots_(RoundUpToPowerOfTwo(capacity)), mask_(slots_.size() - 1) {
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpscRing(const MpscRing&) = delete;
+  MpscRing& operator=(const MpscRing&) = delete;
+
+  // Copies the item into the next free slot. Returns false if the ring is
+  // full, in which case the item is not added.
+  bool TryPush(const T& item) {
+    size_t position = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots_[position & mask_];
+      const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const intptr_t lag = static_cast<intptr_t>(sequence) -
+                           static_cast<intptr_t>(position);
+      if (lag == 0) {
+        // The slot is free. Claim the position, or retry with the one another
+        // producer left.
+        if (tail_.compare_exchange_weak(position, position + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (lag < 0) {
+        // The consumer has not freed the slot yet.
+        return false;
+      } else {
+        position = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->item = item;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Moves the oldest item out of the ring. Returns false if it is empty, or
+  // if the producer of the oldest item has not finished writing it.
+  bool TryPop(T* item) {
+    Slot& slot = slots_[head_ & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+    *item = std::move(slot.item);
+    slot.sequence.store(head_ + slots_.size(), std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  size_t Capacity() const { return slots_.size(); }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T item;
+  };
+
+  static size_t RoundUpToPowerOfTwo(size_t n) {
+    size_t result = 1;
+    while (result < n) result <<= 1;
+    return result;
+  }
+
+  std::vector<Slot> slots_;
+  const size_t mask_;
+  // Only touched by the consumer.
+  alignas(64) size_t head_ = 0;
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
@@ -0,0 +1,159 @@
+#include "sim_bridge/reconnecting_sim_bridge.h"
+
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl_helper/status_macros.h"
+#include "spdlog/spdlog.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+namespace {
+
+class ReconnectingSimBridge : public SimBridge {
+ public:
+  explicit ReconnectingSimBridge(std::unique_ptr<SimBridge> bridge)
+      : bridge_(std::move(bridge)) {}
+
+  // Inherited via SimBridge
+  absl::Status Connect() override;
+  bool WaitForDispatch(absl::Duration timeout) override {
+    return bridge_->WaitForDispatch(timeout);
+  }
+  absl::Status CallDispatch(DispatchHandler* handler) override {
+    return bridge_->CallDispatch(handler);
+  }
+  absl::Status RequestData(int req_id, int def_id, RefreshPeriod period,
+                           int flags) override;
+  absl::StatusOr<int> AddDataDef(int def_id, absl::string_view name,
+                                 absl::string_view unit_or_type) override;
+  absl::Status MapClientEvent(int event_id, absl::string_view name) override;
+  absl::Status SubscribeSystemEvent(int event_id,
+                                    absl::string_view event_name) override;
+  absl::Status TransmitClientEvent(int event_id, double value) override {
+    return bridge_->TransmitClientEvent(event_id, value);
+  }
+  absl::Status TransmitClientEvents(
+      absl::Span<const data::WriteData> events) override {
+    return bridge_->TransmitClientEvents(events);
+  }
+  absl::Status Close() override { return bridge_->Close(); }
+
+ private:
+  struct DataDef {
+    int def_id;
+    std::string name;
+    std::string unit_or_type;
+  };
+  struct Event {
+    int event_id;
+    std::string name;
+  };
+  struct Request {
+    int req_id;
+    int def_id;
+    RefreshPeriod period;
+    int flags;
+  };
+
+  // Makes every recorded registration again on the new connection.
+  absl::Status Replay();
+
+  std::unique_ptr<SimBridge> bridge_;
+  // Whether Connect() succeeded before, so the registrations were made.
+  bool connected_before_ = false;
+  std::vector<DataDef> defs_;
+  std::vector<Event> client_events_;
+  std::vector<Event> system_events_;
+  // The latest request of each request ID.
+  std::vector<Request> requests_;
+};
+
+absl::Status ReconnectingSimBridge::Connect() {
+  RETURN_IF_ERROR(bridge_->Connect());
+  if (!connected_before_) {
+    connected_before_ = true;
+    return absl::OkStatus();
+  }
+  absl::Status status = Replay();
+  if (!status.ok()) {
+    // A half registered connection would send partial data. Start over on
+    // the next Connect().
+    bridge_->Close().IgnoreError();
+    return status;
+  }
+  SPDLOG_INFO("Reconnected: {} data vars, {} events and {} requests made again",
+              defs_.size(), client_events_.size() + system_events_.size(),
+              requests_.size());
+  return absl::OkStatus();
+}
+
+absl::Status ReconnectingSimBridge::Replay() {
+  for (const DataDef& def : defs_) {
+    RETURN_IF_ERROR(
+        bridge_->AddDataDef(def.def_id, def.name, def.unit_or_type).status());
+  }
+  for (const Event& event : client_events_) {
+    RETURN_IF_ERROR(bridge_->MapClientEvent(event.event_id, event.name));
+  }
+  for (const Event& event : system_events_) {
+    RETURN_IF_ERROR(bridge_->SubscribeSystemEvent(event.event_id, event.name));
+  }
+  for (const Request& request : requests_) {
+    RETURN_IF_ERROR(bridge_->RequestData(request.req_id, request.def_id,
+                                         request.period, request.flags));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ReconnectingSimBridge::RequestData(int req_id, int def_id,
+                                                RefreshPeriod period,
+                                                int flags) {
+  RETURN_IF_ERROR(bridge_->RequestData(req_id, def_id, period, flags));
+  for (auto it = requests_.begin(); it != requests_.end(); ++it) {
+    if (it->req_id == req_id) {
+      requests_.erase(it);
+      break;
+    }
+  }
+  // A stopped request needs nothing on the next connection.
+  if (period != RefreshPeriod::NEVER) {
+    requests_.push_back(Request{req_id, def_id, period, flags});
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<int> ReconnectingSimBridge::AddDataDef(
+    int def_id, absl::string_view name, absl::string_view unit_or_type) {
+  absl::StatusOr<int> length = bridge_->AddDataDef(def_id, name, unit_or_type);
+  if (length.ok()) {
+    defs_.push_back(
+        DataDef{def_id, std::string(name), std::string(unit_or_type)});
+  }
+  return length;
+}
+
+absl::Status ReconnectingSimBridge::MapClientEvent(int event_id,
+                                                   absl::string_view name) {
+  RETURN_IF_ERROR(bridge_->MapClientEvent(event_id, name));
+  client_events_.push_back(Event{event_id, std::string(name)});
+  return absl::OkStatus();
+}
+
+absl::Status ReconnectingSimBridge::SubscribeSystemEvent(
+    int event_id, absl::string_view event_name) {
+  RETURN_IF_ERROR(bridge_->SubscribeSystemEvent(event_id, event_name));
+  system_events_.push_back(Event{event_id, std::string(event_name)});
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+std::unique_ptr<SimBridge> CreateReconnectingSimBridge(
+    std::unique_ptr<SimBridge> bridge) {
+  return absl::make_unique<ReconnectingSimBridge>(std::move(bridge));
+}
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <memory>
+
+#include "sim_bridge/sim_bridge.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+
+// Returns a SimBridge that forwards every call to `bridge` and records the
+// data defs, events and data requests that succeed. SimConnect forgets them
+// when the connection drops, so every successful Connect() after the first
+// makes them all again in one batch, in the order they were first made,
+// before it returns. Callers register once and only need to call Connect()
+// to recover from a sim restart.
+std::unique_ptr<SimBridge> CreateReconnectingSimBridge(
+    std::unique_ptr<SimBridge> bridge);
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
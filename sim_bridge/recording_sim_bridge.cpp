@@ -0,0 +1,194 @@
+#include "sim_bridge/recording_sim_bridge.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl_helper/status_macros.h"
+#include "sim_bridge/dispatch_handler.h"
+#include "sim_bridge/frame_log.h"
+#include "spdlog/spdlog.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+namespace {
+
+class RecordingSimBridge : public SimBridge {
+ public:
+  RecordingSimBridge(std::unique_ptr<SimBridge> bridge, absl::string_view path)
+      : bridge_(std::move(bridge)), path_(std::string(path)) {}
+
+  // Inherited via SimBridge
+  absl::Status Connect() override;
+  bool WaitForDispatch(absl::Duration timeout) override {
+    return bridge_->WaitForDispatch(timeout);
+  }
+  absl::Status CallDispatch(DispatchHandler* handler) override;
+  absl::Status RequestData(int req_id, int def_id, RefreshPeriod period,
+                           int flags) override;
+  absl::StatusOr<int> AddDataDef(int def_id, absl::string_view name,
+                                 absl::string_view unit_or_type) override;
+  absl::Status MapClientEvent(int event_id, absl::string_view name) override {
+    return bridge_->MapClientEvent(event_id, name);
+  }
+  absl::Status SubscribeSystemEvent(int event_id,
+                                    absl::string_view event_name) override {
+    return bridge_->SubscribeSystemEvent(event_id, event_name);
+  }
+  absl::Status TransmitClientEvent(int event_id, double value) override {
+    return bridge_->TransmitClientEvent(event_id, value);
+  }
+  absl::Status TransmitClientEvents(
+      absl::Span<const data::WriteData> events) override {
+    return bridge_->TransmitClientEvents(events);
+  }
+  absl::Status Close() override;
+
+  // Appends a record, logging failures so they do not stop the sim.
+  void Record(LogRecordType type, int id, int count,
+              absl::string_view payload);
+  // Size of the data block of a request, or -1 when it is unknown.
+  int DataSize(int req_id) const;
+  int TaggedDataSize(int req_id, int datum_count, const void* data) const;
+
+ private:
+  std::unique_ptr<SimBridge> bridge_;
+  const std::string path_;
+  FrameLogWriter log_;
+  // Sizes of the vars of each data def, indexed by datum ID.
+  absl::flat_hash_map<int, std::vector<int>> def_sizes_;
+  // Data length of each data def.
+  absl::flat_hash_map<int, int> def_lengths_;
+  // Data def of each request.
+  absl::flat_hash_map<int, int> request_defs_;
+};
+
+// Records what the sim sends before handing it to the real handler.
+class RecordingDispatchHandler : public DispatchHandler {
+ public:
+  RecordingDispatchHandler(RecordingSimBridge* bridge,
+                           DispatchHandler* handler)
+      : bridge_(bridge), handler_(handler) {}
+
+  absl::Status OnStart() override {
+    bridge_->Record(LogRecordType::START, 0, 0, absl::string_view());
+    return handler_->OnStart();
+  }
+  absl::Status OnStop() override {
+    bridge_->Record(LogRecordType::STOP, 0, 0, absl::string_view());
+    return handler_->OnStop();
+  }
+  absl::Status OnData(int req_id, void* pData) override {
+    const int size = bridge_->DataSize(req_id);
+    if (size >= 0) {
+      bridge_->Record(LogRecordType::DATA, req_id, 0,
+                      absl::string_view(static_cast<char*>(pData), size));
+    }
+    return handler_->OnData(req_id, pData);
+  }
+  absl::Status OnTaggedData(int req_id, int datum_count,
+                            void* pData) override {
+    const int size = bridge_->TaggedDataSize(req_id, datum_count, pData);
+    if (size >= 0) {
+      bridge_->Record(LogRecordType::TAGGED_DATA, req_id, datum_count,
+                      absl::string_view(static_cast<char*>(pData), size));
+    }
+    return handler_->OnTaggedData(req_id, datum_count, pData);
+  }
+
+ private:
+  RecordingSimBridge* bridge_;
+  DispatchHandler* handler_;
+};
+
+absl::Status RecordingSimBridge::Connect() {
+  RETURN_IF_ERROR(bridge_->Connect());
+  // Data defs do not outlive the connection.
+  def_sizes_.clear();
+  def_lengths_.clear();
+  request_defs_.clear();
+  if (!log_.is_open()) RETURN_IF_ERROR(log_.Open(path_));
+  return absl::OkStatus();
+}
+
+absl::Status RecordingSimBridge::CallDispatch(DispatchHandler* handler) {
+  RecordingDispatchHandler recording_handler(this, handler);
+  return bridge_->CallDispatch(&recording_handler);
+}
+
+absl::Status RecordingSimBridge::RequestData(int req_id, int def_id,
+                                             RefreshPeriod period,
+                                             int flags) {
+  RETURN_IF_ERROR(bridge_->RequestData(req_id, def_id, period, flags));
+  request_defs_[req_id] = def_id;
+  return absl::OkStatus();
+}
+
+absl::StatusOr<int> RecordingSimBridge::AddDataDef(
+    int def_id, absl::string_view name, absl::string_view unit_or_type) {
+  absl::StatusOr<int> length = bridge_->AddDataDef(def_id, name, unit_or_type);
+  if (!length.ok()) return length;
+  def_sizes_[def_id].push_back(*length);
+  def_lengths_[def_id] += *length;
+  Record(LogRecordType::DATA_DEF, def_id, *length,
+         absl::StrCat(name, absl::string_view("\0", 1), unit_or_type,
+                      absl::string_view("\0", 1)));
+  return length;
+}
+
+absl::Status RecordingSimBridge::Close() {
+  absl::Status flushed = log_.Flush();
+  RETURN_IF_ERROR(bridge_->Close());
+  return flushed;
+}
+
+void RecordingSimBridge::Record(LogRecordType type, int id, int count,
+                                absl::string_view payload) {
+  absl::Status status = log_.Append(type, id, count, payload);
+  if (!status.ok()) {
+    SPDLOG_ERROR("Failed to record to {}: {}", path_, status.ToString());
+  }
+}
+
+int RecordingSimBridge::DataSize(int req_id) const {
+  auto request = request_defs_.find(req_id);
+  if (request == request_defs_.end()) return -1;
+  auto length = def_lengths_.find(request->second);
+  if (length == def_lengths_.end()) return -1;
+  return length->second;
+}
+
+int RecordingSimBridge::TaggedDataSize(int req_id, int datum_count,
+                                       const void* data) const {
+  auto request = request_defs_.find(req_id);
+  if (request == request_defs_.end()) return -1;
+  auto sizes = def_sizes_.find(request->second);
+  if (sizes == def_sizes_.end()) return -1;
+  const char* bytes = static_cast<const char*>(data);
+  int size = 0;
+  for (int i = 0; i < datum_count; ++i) {
+    uint32_t datum_id;
+    std::memcpy(&datum_id, bytes + size, sizeof(datum_id));
+    if (datum_id >= sizes->second.size()) {
+      SPDLOG_ERROR("Unknown datum {} in request {}, not recorded.", datum_id,
+                   req_id);
+      return -1;
+    }
+    size += sizeof(datum_id) + sizes->second[datum_id];
+  }
+  return size;
+}
+
+}  // namespace
+
+std::unique_ptr<SimBridge> CreateRecordingSimBridge(
+    std::unique_ptr<SimBridge> bridge, absl::string_view path) {
+  return absl::make_unique<RecordingSimBridge>(std::move(bridge), path);
+}
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <memory>
+
+#include "absl/strings/string_view.h"
+#include "sim_bridge/sim_bridge.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+
+// Returns a SimBridge that forwards every call to `bridge` and appends the
+// data defs, sim events and data frames it sees to a frame log at `path`, see
+// frame_log.h. The first successful Connect() creates the log, Close()
+// flushes it, and the log is closed with the bridge.
+std::unique_ptr<SimBridge> CreateRecordingSimBridge(
+    std::unique_ptr<SimBridge> bridge, absl::string_view path);
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
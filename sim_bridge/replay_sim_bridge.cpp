@@ -0,0 +1,187 @@
+#include "sim_bridge/replay_sim_bridge.h"
+
+#include <string>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+#include "absl_helper/status_macros.h"
+#include "sim_bridge/dispatch_handler.h"
+#include "sim_bridge/frame_log.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+namespace {
+
+class ReplaySimBridge : public SimBridge {
+ public:
+  ReplaySimBridge(absl::string_view path, ReplayOptions options)
+      : path_(std::string(path)), options_(options) {}
+
+  // Inherited via SimBridge
+  absl::Status Connect() override;
+  bool WaitForDispatch(absl::Duration timeout) override;
+  absl::Status CallDispatch(DispatchHandler* handler) override;
+  absl::Status RequestData(int req_id, int def_id, RefreshPeriod period,
+                           int flags) override;
+  absl::StatusOr<int> AddDataDef(int def_id, absl::string_view name,
+                                 absl::string_view unit_or_type) override;
+  absl::Status MapClientEvent(int event_id, absl::string_view name) override {
+    return absl::OkStatus();
+  }
+  absl::Status SubscribeSystemEvent(int event_id,
+                                    absl::string_view event_name) override {
+    return absl::OkStatus();
+  }
+  absl::Status TransmitClientEvent(int event_id, double value) override {
+    return absl::OkStatus();
+  }
+  absl::Status TransmitClientEvents(
+      absl::Span<const data::WriteData> events) override {
+    return absl::OkStatus();
+  }
+  absl::Status Close() override;
+
+ private:
+  // Moves to the next record to play. Returns false at the end of the log.
+  bool Advance();
+  // When the next record is due.
+  absl::Time DueTime() const;
+  absl::Status Play(const LogRecord& record, DispatchHandler* handler);
+
+  const std::string path_;
+  const ReplayOptions options_;
+  FrameLogReader log_;
+  // Recorded data length of each var, by data def and var name.
+  absl::flat_hash_map<std::pair<int, std::string>, int> var_lengths_;
+  absl::flat_hash_set<int> active_requests_;
+  absl::Time start_;
+  LogRecord next_;
+  bool has_next_ = false;
+  // Whether the handler was stopped at the end of the log.
+  bool stopped_ = false;
+};
+
+absl::Status ReplaySimBridge::Connect() {
+  RETURN_IF_ERROR(log_.Open(path_));
+  var_lengths_.clear();
+  active_requests_.clear();
+  LogRecord record;
+  while (log_.Next(&record)) {
+    if (record.type != LogRecordType::DATA_DEF) continue;
+    std::pair<absl::string_view, absl::string_view> var =
+        absl::StrSplit(record.payload, absl::ByChar('\0'));
+    var_lengths_[std::make_pair(record.id, std::string(var.first))] =
+        record.count;
+  }
+  log_.Rewind();
+  start_ = absl::Now();
+  stopped_ = false;
+  has_next_ = Advance();
+  return absl::OkStatus();
+}
+
+bool ReplaySimBridge::WaitForDispatch(absl::Duration timeout) {
+  if (!has_next_) {
+    if (!stopped_) return true;
+    absl::SleepFor(timeout);
+    return false;
+  }
+  const absl::Duration wait = DueTime() - absl::Now();
+  if (wait > timeout) {
+    absl::SleepFor(timeout);
+    return false;
+  }
+  if (wait > absl::ZeroDuration()) absl::SleepFor(wait);
+  return true;
+}
+
+absl::Status ReplaySimBridge::CallDispatch(DispatchHandler* handler) {
+  if (!has_next_) {
+    if (stopped_) return absl::OkStatus();
+    stopped_ = true;
+    return handler->OnStop();
+  }
+  // As fast as possible plays one record per call, like a sim that sends the
+  // next frame once the last one was handled.
+  const absl::Time now = absl::Now();
+  absl::Status status;
+  while (has_next_ && DueTime() <= now) {
+    status.Update(Play(next_, handler));
+    has_next_ = Advance();
+    if (options_.speed <= 0) break;
+  }
+  return status;
+}
+
+absl::Status ReplaySimBridge::RequestData(int req_id, int def_id,
+                                          RefreshPeriod period, int flags) {
+  if (period == RefreshPeriod::NEVER) {
+    active_requests_.erase(req_id);
+  } else {
+    active_requests_.insert(req_id);
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<int> ReplaySimBridge::AddDataDef(
+    int def_id, absl::string_view name, absl::string_view unit_or_type) {
+  auto length = var_lengths_.find(std::make_pair(def_id, std::string(name)));
+  if (length == var_lengths_.end()) {
+    return absl::NotFoundError(
+        absl::StrCat(name, " of data def ", def_id, " is not in ", path_));
+  }
+  return length->second;
+}
+
+absl::Status ReplaySimBridge::Close() {
+  log_.Close();
+  has_next_ = false;
+  return absl::OkStatus();
+}
+
+bool ReplaySimBridge::Advance() {
+  while (log_.Next(&next_)) {
+    if (next_.type != LogRecordType::DATA_DEF) return true;
+  }
+  return false;
+}
+
+absl::Time ReplaySimBridge::DueTime() const {
+  if (options_.speed <= 0) return absl::InfinitePast();
+  return start_ + next_.time / options_.speed;
+}
+
+absl::Status ReplaySimBridge::Play(const LogRecord& record,
+                                   DispatchHandler* handler) {
+  // The handlers only read the data, the mapping is read only.
+  void* data = const_cast<char*>(record.payload.data());
+  switch (record.type) {
+    case LogRecordType::START:
+      return handler->OnStart();
+    case LogRecordType::STOP:
+      return handler->OnStop();
+    case LogRecordType::DATA:
+      if (!active_requests_.contains(record.id)) return absl::OkStatus();
+      return handler->OnData(record.id, data);
+    case LogRecordType::TAGGED_DATA:
+      if (!active_requests_.contains(record.id)) return absl::OkStatus();
+      return handler->OnTaggedData(record.id, record.count, data);
+    default:
+      return absl::OkStatus();
+  }
+}
+
+}  // namespace
+
+std::unique_ptr<SimBridge> CreateReplaySimBridge(absl::string_view path,
+                                                 ReplayOptions options) {
+  return absl::make_unique<ReplaySimBridge>(path, options);
+}
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
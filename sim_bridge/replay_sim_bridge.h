@@ -0,0 +1,26 @@
+#pragma once
+
+#include <memory>
+
+#include "absl/strings/string_view.h"
+#include "sim_bridge/sim_bridge.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+
+struct ReplayOptions {
+  // Playback speed relative to the recording, 10 plays ten times as fast.
+  // 0 plays every record as soon as the previous one was handled.
+  double speed = 1;
+};
+
+// Returns a SimBridge that plays back a frame log written by
+// CreateRecordingSimBridge(), without a sim. Connect() maps the log and starts
+// the clock. AddDataDef() returns the recorded data lengths, and only vars
+// that were recorded can be added. Data is played for the requests that are
+// active, and the end of the log stops the handler like the sim quitting.
+std::unique_ptr<SimBridge> CreateReplaySimBridge(
+    absl::string_view path, ReplayOptions options = ReplayOptions());
+
+}  // namespace sim_bridge
+}  // namespace flight_panel
@@ -1,5 +1,8 @@
 #include "sim_bridge/sim_bridge.h"
 
+#include <cmath>
+#include <cstdint>
+
 #include "SimConnect.h"
 #include "absl/status/status.h"
 #include "absl/strings/match.h"
@@ -8,6 +11,7 @@
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "absl_helper/status_macros.h"
 #include "data_def/sim_vars.h"
 #include "sim_bridge/dispatch_handler.h"
 #include "spdlog/spdlog.h"
@@ -16,11 +20,21 @@ namespace flight_panel {
 namespace sim_bridge {
 namespace {
 
+// The context of a SimConnect_CallDispatch call.
+struct DispatchContext {
+  DispatchHandler* handler;
+  // Set when the sim quits. The connection is gone, but SimStop and the
+  // handler's OnStop() are about the flight, so the quit is reported by
+  // CallDispatch() instead.
+  bool quit;
+};
+
 // Dispatch callback function.
-// The context is a DispatchHandler pointer, which is used to handle SIM_START,
+// The context is a DispatchContext, whose handler handles SIM_START,
 // SIM_STOP and data events.
 void MyDispatchProcRd(SIMCONNECT_RECV* pData, DWORD cbData, void* pContext) {
-  DispatchHandler* handler = static_cast<DispatchHandler*>(pContext);
+  DispatchContext* context = static_cast<DispatchContext*>(pContext);
+  DispatchHandler* handler = context->handler;
   switch (pData->dwID) {
     case SIMCONNECT_RECV_ID_EVENT: {
       SIMCONNECT_RECV_EVENT* evt = (SIMCONNECT_RECV_EVENT*)pData;
@@ -40,11 +54,16 @@ void MyDispatchProcRd(SIMCONNECT_RECV* pData, DWORD cbData, void* pContext) {
     case SIMCONNECT_RECV_ID_SIMOBJECT_DATA: {
       SIMCONNECT_RECV_SIMOBJECT_DATA* pObjData =
           (SIMCONNECT_RECV_SIMOBJECT_DATA*)pData;
-      handler->OnData(pObjData->dwRequestID, &pObjData->dwData);
+      if (pObjData->dwFlags & SIMCONNECT_DATA_REQUEST_FLAG_TAGGED) {
+        handler->OnTaggedData(pObjData->dwRequestID, pObjData->dwDefineCount,
+                              &pObjData->dwData);
+      } else {
+        handler->OnData(pObjData->dwRequestID, &pObjData->dwData);
+      }
       break;
     }
     case SIMCONNECT_RECV_ID_QUIT: {
-      handler->OnStop();
+      context->quit = true;
       break;
     }
   }
@@ -53,11 +72,13 @@ void MyDispatchProcRd(SIMCONNECT_RECV* pData, DWORD cbData, void* pContext) {
 class SimBridgeImpl : public SimBridge {
  public:
   SimBridgeImpl();
+  ~SimBridgeImpl() override;
   // Inherited via SimBridge
   virtual absl::Status Connect() override;
+  virtual bool WaitForDispatch(absl::Duration timeout) override;
   virtual absl::Status CallDispatch(DispatchHandler* handler) override;
-  virtual absl::Status RequestData(int req_id, int def_id,
-                                   RefreshPeriod period) override;
+  virtual absl::Status RequestData(int req_id, int def_id, RefreshPeriod period,
+                                   int flags) override;
   virtual absl::StatusOr<int> AddDataDef(
       int def_id, absl::string_view name,
       absl::string_view unit_or_type) override;
@@ -67,11 +88,17 @@ class SimBridgeImpl : public SimBridge {
   virtual absl::Status SubscribeSystemEvent(int event_id,
                                             absl::string_view event_name) override;
   virtual absl::Status TransmitClientEvent(int event_id, double value) override;
+  virtual absl::Status TransmitClientEvents(
+      absl::Span<const data::WriteData> events) override;
   virtual absl::Status Close() override;
 
  private:
   // SimConnect related objects.
   HANDLE hSimConnect_ = NULL;
+  // Signaled by SimConnect when messages arrive. Auto reset.
+  HANDLE message_event_ = NULL;
+  // Number of vars added to each data def, the datum ID of the next one.
+  absl::flat_hash_map<int, int> datum_counts_;
   // pContext is "this" pointer
   static void DispatchProcRd(SIMCONNECT_RECV* pData, DWORD cbData,
                              void* pContext) {
@@ -80,11 +107,19 @@ class SimBridgeImpl : public SimBridge {
   }
 };
 
-SimBridgeImpl::SimBridgeImpl() {}
+SimBridgeImpl::SimBridgeImpl()
+    : message_event_(CreateEvent(NULL, FALSE, FALSE, NULL)) {}
+
+SimBridgeImpl::~SimBridgeImpl() {
+  if (message_event_ != NULL) CloseHandle(message_event_);
+}
 
 
 absl::Status SimBridgeImpl::Connect() {
-  HRESULT result = SimConnect_Open(&hSimConnect_, "Sim Bridge", NULL, 0, 0, 0);
+  // Data defs do not outlive the connection.
+  datum_counts_.clear();
+  HRESULT result = SimConnect_Open(&hSimConnect_, "Sim Bridge", NULL, 0,
+                                   message_event_, 0);
   if (result < 0) {
     return absl::UnavailableError("Failed to connect to Sim");
   } else {
@@ -92,18 +127,27 @@ absl::Status SimBridgeImpl::Connect() {
   }
 }
 
+bool SimBridgeImpl::WaitForDispatch(absl::Duration timeout) {
+  const DWORD timeout_ms =
+      static_cast<DWORD>(absl::ToInt64Milliseconds(timeout));
+  return WaitForSingleObject(message_event_, timeout_ms) == WAIT_OBJECT_0;
+}
+
+// SimConnect_CallDispatch calls back once for each queued message.
 absl::Status SimBridgeImpl::CallDispatch(DispatchHandler* handler) {
   SPDLOG_INFO("Call dispatch started");
-  if (SimConnect_CallDispatch(hSimConnect_, MyDispatchProcRd, handler) < 0) {
-    return absl::InternalError("Failed to call dispatch callback.");
-  } else {
-    SPDLOG_INFO("Call dispatch done");
-    return absl::OkStatus();
+  DispatchContext context{handler, false};
+  if (SimConnect_CallDispatch(hSimConnect_, MyDispatchProcRd, &context) < 0) {
+    // SimConnect fails every call once the sim is gone.
+    return absl::UnavailableError("Failed to call dispatch callback.");
   }
+  if (context.quit) return absl::UnavailableError("The sim quit.");
+  SPDLOG_INFO("Call dispatch done");
+  return absl::OkStatus();
 }
 
 absl::Status SimBridgeImpl::RequestData(int req_id, int def_id,
-                                        RefreshPeriod period) {
+                                        RefreshPeriod period, int flags) {
   SIMCONNECT_PERIOD fs_period = SIMCONNECT_PERIOD_SIM_FRAME;
   switch (period) {
     case RefreshPeriod::NEVER:
@@ -122,12 +166,18 @@ absl::Status SimBridgeImpl::RequestData(int req_id, int def_id,
       fs_period = SIMCONNECT_PERIOD_ONCE;
       break;
   }
+  SIMCONNECT_DATA_REQUEST_FLAG fs_flags = SIMCONNECT_DATA_REQUEST_FLAG_DEFAULT;
+  if (flags & (REQUEST_CHANGED | REQUEST_TAGGED)) {
+    fs_flags |= SIMCONNECT_DATA_REQUEST_FLAG_CHANGED;
+  }
+  if (flags & REQUEST_TAGGED) fs_flags |= SIMCONNECT_DATA_REQUEST_FLAG_TAGGED;
   if (SimConnect_RequestDataOnSimObject(hSimConnect_, req_id, def_id,
-                                        SIMCONNECT_OBJECT_ID_USER, fs_period, 0,
-                                        0, 0, 0) < 0) {
+                                        SIMCONNECT_OBJECT_ID_USER, fs_period,
+                                        fs_flags, 0, 0, 0) < 0) {
     return absl::InternalError(absl::StrFormat(
-        "Failed to request data. Request ID: %d, Def ID: %d, Period: %d",
-        req_id, def_id, fs_period));
+        "Failed to request data. Request ID: %d, Def ID: %d, Period: %d, "
+        "Flags: %d",
+        req_id, def_id, fs_period, flags));
   } else {
     return absl::OkStatus();
   }
@@ -138,12 +188,14 @@ absl::StatusOr<int> SimBridgeImpl::AddDataDef(int def_id,
                                               absl::string_view unit_or_type) {
   HRESULT result;
   int data_length = sizeof(double);
+  const int datum_id = datum_counts_[def_id];
   // First find the data type.
   if (!absl::StrContains(unit_or_type, "string")) {
     // Type is not string. simply use name as unit. And data type is float64.
-    result = SimConnect_AddToDataDefinition(hSimConnect_, def_id,
-                                            std::string(name).c_str(),
-                                            std::string(unit_or_type).c_str());
+    result = SimConnect_AddToDataDefinition(
+        hSimConnect_, def_id, std::string(name).c_str(),
+        std::string(unit_or_type).c_str(), SIMCONNECT_DATATYPE_FLOAT64, 0,
+        datum_id);
 
   } else {
     std::vector<std::string> num = absl::StrSplit(unit_or_type, "string");
@@ -167,15 +219,16 @@ absl::StatusOr<int> SimBridgeImpl::AddDataDef(int def_id,
       return absl::InvalidArgumentError(
           absl::StrCat(message, "| invalid length: ", data_length));
     }
-    result = SimConnect_AddToDataDefinition(hSimConnect_, def_id,
-                                            std::string(name).c_str(), NULL,
-                                            type_map[data_length]);
+    result = SimConnect_AddToDataDefinition(
+        hSimConnect_, def_id, std::string(name).c_str(), NULL,
+        type_map[data_length], 0, datum_id);
   }
   if (result != 0) {
     std::string msg = absl::StrCat("Failed to add data def: ", name);
     SPDLOG_ERROR(msg);
     return absl::InternalError(msg);
   }
+  datum_counts_[def_id] = datum_id + 1;
   return data_length;
 }
 
@@ -204,8 +257,12 @@ absl::Status SimBridgeImpl::SubscribeSystemEvent(int event_id,
 }
 
 absl::Status SimBridgeImpl::TransmitClientEvent(int event_id, double value) {
+  // Values can be negative, e.g. axes. SimConnect takes them as DWORD and
+  // reads them back as signed.
+  const DWORD data =
+      static_cast<DWORD>(static_cast<int32_t>(std::lround(value)));
   auto result =
-      SimConnect_TransmitClientEvent(hSimConnect_, 0, event_id, (DWORD)value,
+      SimConnect_TransmitClientEvent(hSimConnect_, 0, event_id, data,
                                      SIMCONNECT_GROUP_PRIORITY_HIGHEST,
                                      SIMCONNECT_EVENT_FLAG_GROUPID_IS_PRIORITY);
   if (result != 0) {
@@ -216,6 +273,16 @@ absl::Status SimBridgeImpl::TransmitClientEvent(int event_id, double value) {
   }
 }
 
+// SimConnect has no batch call, so this is one call per command. Coalescing in
+// CommandQueue is what keeps batches short.
+absl::Status SimBridgeImpl::TransmitClientEvents(
+    absl::Span<const data::WriteData> events) {
+  for (const data::WriteData& event : events) {
+    RETURN_IF_ERROR(TransmitClientEvent(event.eventId, event.value));
+  }
+  return absl::OkStatus();
+}
+
 absl::Status SimBridgeImpl::Close() {
   auto result = SimConnect_Close(hSimConnect_);
   if (result != 0) {
@@ -1,12 +1,16 @@
 // This class is a wrapper of the SimConnect API.
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "data_def/sim_vars.h"
 #include "sim_bridge/dispatch_handler.h"
 
@@ -15,6 +19,15 @@ namespace sim_bridge {
 
 // Refresh period used when request data.
 enum class RefreshPeriod { NEVER, ONCE, VISUAL_FRAME, SIM_FRAME, SECOND };
+// Flags of a data request, combined with |.
+enum RequestFlag {
+  REQUEST_DEFAULT = 0,
+  // Only send the data block when a var in it changed.
+  REQUEST_CHANGED = 1,
+  // Only send the vars that changed, each preceded by its datum ID. The block
+  // is delivered to DispatchHandler::OnTaggedData(). Implies REQUEST_CHANGED.
+  REQUEST_TAGGED = 2,
+};
 class SimBridge;
 class DispatchHandler;
 
@@ -22,14 +35,23 @@ class DispatchHandler;
 // It provides a C++ style interface to the Sim.
 class SimBridge {
  public:
+  virtual ~SimBridge() = default;
   virtual absl::Status Connect() = 0;
+  // Blocks until messages are pending or `timeout` passes, and returns
+  // whether messages are pending.
+  virtual bool WaitForDispatch(absl::Duration timeout) = 0;
+  // Handles every pending message. Returns Unavailable once the connection
+  // is lost, e.g. when the sim quit. Connect() again to resume.
   virtual absl::Status CallDispatch(DispatchHandler* handler) = 0;
-  virtual absl::Status RequestData(int req_id, int def_id,
-                                   RefreshPeriod period) = 0;
+  // `flags` is a combination of RequestFlag.
+  virtual absl::Status RequestData(int req_id, int def_id, RefreshPeriod period,
+                                   int flags) = 0;
 
   // The unit or type field can accept "string{8|64}", or a unit string.
   // When the type is not string, default(float64) type is used.
-  // Returns data length of the added def.
+  // Returns data length of the added def. The vars of a def get the datum IDs
+  // 0, 1, 2... in the order they are added, which identify them in tagged
+  // data.
   virtual absl::StatusOr<int> AddDataDef(int def_id, absl::string_view name,
                                   absl::string_view unit_or_type) = 0;
 
@@ -37,6 +59,10 @@ class SimBridge {
   virtual absl::Status SubscribeSystemEvent(int event_id,
                                             absl::string_view event_name) = 0;
   virtual absl::Status TransmitClientEvent(int event_id, double value) = 0;
+  // Transmits absolute commands in order, e.g. a batch drained from a
+  // CommandQueue. Stops at the first failure.
+  virtual absl::Status TransmitClientEvents(
+      absl::Span<const data::WriteData> events) = 0;
   virtual absl::Status Close()=0;
 };
 std::unique_ptr<SimBridge> CreateSimBridge();
@@ -0,0 +1,175 @@
+#include "sim_bridge/command_queue.h"
+
+#include <thread>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+namespace {
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::SizeIs;
+
+using data::EVENT_ID;
+using data::WriteData;
+
+MATCHER_P2(IsCommand, event_id, value, "") {
+  return arg.eventId == event_id && arg.value == value && !arg.relative;
+}
+
+// The heading bug is at 100, nothing else is known.
+bool HeadingAt100(EVENT_ID id, double* value) {
+  if (id != data::KEY_HEADING_BUG_SET) return false;
+  *value = 100;
+  return true;
+}
+
+TEST(CommandQueueTest, TestRelativeCommandsAreCoalesced) {
+  CommandQueue queue;
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, -5, true}).ok());
+  std::vector<WriteData> batch;
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_HEADING_BUG_SET, 97)));
+}
+
+TEST(CommandQueueTest, TestRelativeCommandsAddToLastSet) {
+  CommandQueue queue;
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 180}).ok());
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 10, true}).ok());
+  EXPECT_TRUE(queue.Push({data::KEY_AP_MASTER, 0}).ok());
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 10, true}).ok());
+  std::vector<WriteData> batch;
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_HEADING_BUG_SET, 200),
+                                 IsCommand(data::KEY_AP_MASTER, 0)));
+}
+
+TEST(CommandQueueTest, TestRelativeCommandsStartFromValueSent) {
+  CommandQueue queue;
+  std::vector<WriteData> batch;
+  // The sim still reports 100 in the following cycles.
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_HEADING_BUG_SET, 101)));
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_HEADING_BUG_SET, 102)));
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, -5, true}).ok());
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_HEADING_BUG_SET, 97)));
+}
+
+TEST(CommandQueueTest, TestReportedValueReplacesValueSent) {
+  CommandQueue queue;
+  double heading = 100;
+  auto current = [&heading](EVENT_ID id, double* value) {
+    *value = heading;
+    return id == data::KEY_HEADING_BUG_SET;
+  };
+  std::vector<WriteData> batch;
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+  queue.Drain(current, &batch);
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_HEADING_BUG_SET, 101)));
+  // The sim took it.
+  heading = 101;
+  queue.Drain(current, &batch);
+  EXPECT_THAT(batch, IsEmpty());
+  // Then the pilot turned the knob in the sim.
+  heading = 50;
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+  queue.Drain(current, &batch);
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_HEADING_BUG_SET, 51)));
+}
+
+TEST(CommandQueueTest, TestValueSentTimesOut) {
+  CommandQueue queue(256, absl::Milliseconds(10));
+  std::vector<WriteData> batch;
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_HEADING_BUG_SET, 101)));
+  // The sim never took it.
+  absl::SleepFor(absl::Milliseconds(20));
+  EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_HEADING_BUG_SET, 101)));
+}
+
+TEST(CommandQueueTest, TestCoalescedTrimStaysOnTheAxis) {
+  CommandQueue queue;
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(queue.Push({data::KEY_AXIS_ELEV_TRIM_SET, -8000, true}).ok());
+  }
+  EXPECT_TRUE(queue.Push({data::KEY_AXIS_ELEV_TRIM_SET, 1000, true}).ok());
+  std::vector<WriteData> batch;
+  // The trim starts half way down.
+  queue.Drain(
+      [](EVENT_ID id, double* value) {
+        *value = -8000;
+        return true;
+      },
+      &batch);
+  // Each step stops at the end of the axis, like the sim would.
+  EXPECT_THAT(batch,
+              ElementsAre(IsCommand(data::KEY_AXIS_ELEV_TRIM_SET, -15383)));
+}
+
+TEST(CommandQueueTest, TestAbsoluteCommandsAreKept) {
+  CommandQueue queue;
+  EXPECT_TRUE(queue.Push({data::KEY_AP_MASTER, 0}).ok());
+  EXPECT_TRUE(queue.Push({data::KEY_AP_MASTER, 0}).ok());
+  std::vector<WriteData> batch;
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_AP_MASTER, 0),
+                                 IsCommand(data::KEY_AP_MASTER, 0)));
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, IsEmpty());
+}
+
+TEST(CommandQueueTest, TestRelativeCommandWithoutValueIsDropped) {
+  CommandQueue queue;
+  EXPECT_TRUE(queue.Push({data::KEY_VOR1_SET, 1, true}).ok());
+  std::vector<WriteData> batch;
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, IsEmpty());
+}
+
+TEST(CommandQueueTest, TestFullQueueRejectsCommands) {
+  CommandQueue queue(2);
+  EXPECT_TRUE(queue.Push({data::KEY_AP_MASTER, 0}).ok());
+  EXPECT_TRUE(queue.Push({data::KEY_AP_MASTER, 0}).ok());
+  EXPECT_EQ(queue.Push({data::KEY_AP_MASTER, 0}).code(),
+            absl::StatusCode::kResourceExhausted);
+  std::vector<WriteData> batch;
+  queue.Drain(HeadingAt100, &batch);
+  EXPECT_THAT(batch, SizeIs(2));
+  EXPECT_TRUE(queue.Push({data::KEY_AP_MASTER, 0}).ok());
+}
+
+TEST(CommandQueueTest, TestConcurrentProducers) {
+  constexpr int kProducers = 4;
+  constexpr int kCommands = 1000;
+  CommandQueue queue(kProducers * kCommands);
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kProducers; ++i) {
+    producers.emplace_back([&queue] {
+      for (int j = 0; j < kCommands; ++j) {
+        EXPECT_TRUE(queue.Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+      }
+    });
+  }
+  for (std::thread& producer : producers) producer.join();
+  std::vector<WriteData> batch;
+  queue.Drain(HeadingAt100, &batch);
+  // 100 + 4000 degrees, wrapped around the compass.
+  EXPECT_THAT(batch, ElementsAre(IsCommand(data::KEY_HEADING_BUG_SET, 140)));
+}
+
+}  // namespace
+}  // namespace sim_bridge
+}  // namespace flight_panel
@@ -0,0 +1,209 @@
+#include "sim_bridge/frame_log.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "sim_bridge/dispatch_handler.h"
+#include "sim_bridge/mock_sim_bridge.h"
+#include "sim_bridge/recording_sim_bridge.h"
+#include "sim_bridge/replay_sim_bridge.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+namespace {
+using ::testing::_;
+using ::testing::ElementsAre;
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::Return;
+
+std::string LogPath(absl::string_view name) {
+  return absl::StrCat(::testing::TempDir(), name, ".fplog");
+}
+
+// Keeps what it is handed as strings, so tests can compare the calls.
+class CallLog : public DispatchHandler {
+ public:
+  absl::Status OnStart() override { return Add("start"); }
+  absl::Status OnStop() override { return Add("stop"); }
+  absl::Status OnData(int req_id, void* pData) override {
+    double value;
+    std::memcpy(&value, pData, sizeof(value));
+    return Add(absl::StrCat("data ", req_id, " ", value));
+  }
+  absl::Status OnTaggedData(int req_id, int datum_count,
+                            void* pData) override {
+    uint32_t datum_id;
+    std::memcpy(&datum_id, pData, sizeof(datum_id));
+    return Add(absl::StrCat("tagged ", req_id, " ", datum_count, " ",
+                            datum_id));
+  }
+  const std::vector<std::string>& calls() const { return calls_; }
+
+ private:
+  absl::Status Add(std::string call) {
+    calls_.push_back(std::move(call));
+    return absl::OkStatus();
+  }
+  std::vector<std::string> calls_;
+};
+
+// A tagged block with one double var.
+struct TaggedDouble {
+  uint32_t datum_id;
+  double value;
+};
+
+// Records a sim that starts, sends a frame of two doubles on request 0 and a
+// tagged var on request 1.
+void Record(const std::string& path, absl::Duration frame_gap) {
+  auto sim = new NiceMock<MockSimBridge>();
+  ON_CALL(*sim, Connect()).WillByDefault(Return(absl::OkStatus()));
+  ON_CALL(*sim, RequestData(_, _, _, _))
+      .WillByDefault(Return(absl::OkStatus()));
+  ON_CALL(*sim, AddDataDef(_, _, _)).WillByDefault(Return(8));
+  ON_CALL(*sim, Close()).WillByDefault(Return(absl::OkStatus()));
+  double frame[2] = {1.5, 2.5};
+  TaggedDouble tagged = {1, 3.5};
+  EXPECT_CALL(*sim, CallDispatch(_))
+      .WillOnce(Invoke([&](DispatchHandler* handler) {
+        EXPECT_TRUE(handler->OnStart().ok());
+        return handler->OnData(0, frame);
+      }))
+      .WillOnce(Invoke([&](DispatchHandler* handler) {
+        return handler->OnTaggedData(1, 1, &tagged);
+      }));
+
+  auto bridge = CreateRecordingSimBridge(absl::WrapUnique(sim), path);
+  ASSERT_TRUE(bridge->Connect().ok());
+  ASSERT_TRUE(bridge->AddDataDef(0, "A", "feet").ok());
+  ASSERT_TRUE(bridge->AddDataDef(0, "B", "knots").ok());
+  ASSERT_TRUE(bridge->AddDataDef(1, "C", "feet").ok());
+  ASSERT_TRUE(bridge->AddDataDef(1, "D", "feet").ok());
+  ASSERT_TRUE(bridge->RequestData(0, 0, RefreshPeriod::VISUAL_FRAME, 0).ok());
+  ASSERT_TRUE(
+      bridge->RequestData(1, 1, RefreshPeriod::SECOND, REQUEST_TAGGED).ok());
+  CallLog live;
+  ASSERT_TRUE(bridge->CallDispatch(&live).ok());
+  absl::SleepFor(frame_gap);
+  ASSERT_TRUE(bridge->CallDispatch(&live).ok());
+  ASSERT_TRUE(bridge->Close().ok());
+  EXPECT_THAT(live.calls(),
+              ElementsAre("start", "data 0 1.5", "tagged 1 1 1"));
+}
+
+// Plays the whole log, the way SimRunner does.
+std::vector<std::string> Replay(SimBridge* bridge) {
+  CallLog replayed;
+  bool stopped = false;
+  while (!stopped) {
+    if (!bridge->WaitForDispatch(absl::Seconds(1))) break;
+    EXPECT_TRUE(bridge->CallDispatch(&replayed).ok());
+    stopped = !replayed.calls().empty() && replayed.calls().back() == "stop";
+  }
+  return replayed.calls();
+}
+
+TEST(FrameLogTest, TestReplayPlaysRecordedSession) {
+  const std::string path = LogPath("replay");
+  Record(path, absl::ZeroDuration());
+
+  ReplayOptions options;
+  options.speed = 0;
+  auto replay = CreateReplaySimBridge(path, options);
+  ASSERT_TRUE(replay->Connect().ok());
+  EXPECT_EQ(*replay->AddDataDef(0, "A", "feet"), 8);
+  EXPECT_EQ(*replay->AddDataDef(1, "D", "feet"), 8);
+  EXPECT_EQ(replay->AddDataDef(0, "E", "feet").status().code(),
+            absl::StatusCode::kNotFound);
+  ASSERT_TRUE(replay->RequestData(0, 0, RefreshPeriod::VISUAL_FRAME, 0).ok());
+  ASSERT_TRUE(
+      replay->RequestData(1, 1, RefreshPeriod::SECOND, REQUEST_TAGGED).ok());
+
+  // The end of the log stops the handler.
+  EXPECT_THAT(Replay(replay.get()),
+              ElementsAre("start", "data 0 1.5", "tagged 1 1 1", "stop"));
+  EXPECT_TRUE(replay->Close().ok());
+}
+
+TEST(FrameLogTest, TestReplaySkipsInactiveRequests) {
+  const std::string path = LogPath("inactive");
+  Record(path, absl::ZeroDuration());
+
+  ReplayOptions options;
+  options.speed = 0;
+  auto replay = CreateReplaySimBridge(path, options);
+  ASSERT_TRUE(replay->Connect().ok());
+  ASSERT_TRUE(replay->RequestData(1, 1, RefreshPeriod::SECOND, 0).ok());
+  EXPECT_THAT(Replay(replay.get()),
+              ElementsAre("start", "tagged 1 1 1", "stop"));
+}
+
+TEST(FrameLogTest, TestReplayKeepsRecordedPace) {
+  const std::string path = LogPath("pace");
+  Record(path, absl::Milliseconds(200));
+
+  auto replay = CreateReplaySimBridge(path);
+  ASSERT_TRUE(replay->Connect().ok());
+  ASSERT_TRUE(
+      replay->RequestData(1, 1, RefreshPeriod::SECOND, REQUEST_TAGGED).ok());
+  CallLog replayed;
+  ASSERT_TRUE(replay->WaitForDispatch(absl::Milliseconds(100)));
+  ASSERT_TRUE(replay->CallDispatch(&replayed).ok());
+  EXPECT_THAT(replayed.calls(), ElementsAre("start"));
+  // The tagged frame came 200 ms later.
+  EXPECT_FALSE(replay->WaitForDispatch(absl::Milliseconds(10)));
+  ASSERT_TRUE(replay->WaitForDispatch(absl::Seconds(1)));
+  ASSERT_TRUE(replay->CallDispatch(&replayed).ok());
+  EXPECT_THAT(replayed.calls(), ElementsAre("start", "tagged 1 1 1"));
+}
+
+TEST(FrameLogTest, TestReaderIgnoresIncompleteRecord) {
+  const std::string path = LogPath("incomplete");
+  FrameLogWriter writer;
+  ASSERT_TRUE(writer.Open(path).ok());
+  ASSERT_TRUE(writer.Append(LogRecordType::START, 0, 0, "").ok());
+  ASSERT_TRUE(writer.Append(LogRecordType::DATA, 3, 0, "abc").ok());
+  ASSERT_TRUE(writer.Close().ok());
+  // Cut the last record short, as a crash while recording would.
+  std::FILE* file = std::fopen(path.c_str(), "ab");
+  ASSERT_NE(file, nullptr);
+  LogRecordHeader header = {static_cast<uint32_t>(LogRecordType::DATA), 64};
+  std::fwrite(&header, sizeof(header), 1, file);
+  std::fclose(file);
+
+  FrameLogReader reader;
+  ASSERT_TRUE(reader.Open(path).ok());
+  LogRecord record;
+  ASSERT_TRUE(reader.Next(&record));
+  EXPECT_EQ(record.type, LogRecordType::START);
+  ASSERT_TRUE(reader.Next(&record));
+  EXPECT_EQ(record.type, LogRecordType::DATA);
+  EXPECT_EQ(record.id, 3);
+  EXPECT_EQ(record.payload, "abc");
+  EXPECT_FALSE(reader.Next(&record));
+}
+
+TEST(FrameLogTest, TestReaderRejectsOtherFiles) {
+  const std::string path = LogPath("other");
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  std::fputs("not a frame log at all", file);
+  std::fclose(file);
+
+  FrameLogReader reader;
+  EXPECT_EQ(reader.Open(path).code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(reader.Open(LogPath("missing")).code(),
+            absl::StatusCode::kNotFound);
+}
+
+}  // namespace
+}  // namespace sim_bridge
+}  // namespace flight_panel
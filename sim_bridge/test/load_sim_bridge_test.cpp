@@ -0,0 +1,140 @@
+#include "sim_bridge/load_sim_bridge.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "sim_bridge/dispatch_handler.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+namespace {
+using ::testing::Each;
+using ::testing::ElementsAre;
+using ::testing::SizeIs;
+
+// Keeps the blocks it is handed. Data blocks are two doubles and a string8.
+class FrameLog : public DispatchHandler {
+ public:
+  absl::Status OnStart() override {
+    ++starts;
+    return absl::OkStatus();
+  }
+  absl::Status OnStop() override {
+    ++stops;
+    return absl::OkStatus();
+  }
+  absl::Status OnData(int req_id, void* pData) override {
+    const char* data = static_cast<const char*>(pData);
+    frames.emplace_back(data, data + kBlockSize);
+    return absl::OkStatus();
+  }
+  absl::Status OnTaggedData(int req_id, int datum_count,
+                            void* pData) override {
+    const char* data = static_cast<const char*>(pData);
+    std::vector<uint32_t> ids;
+    for (int i = 0; i < datum_count; ++i) {
+      uint32_t id;
+      std::memcpy(&id, data, sizeof(id));
+      ids.push_back(id);
+      data += sizeof(id) + (id == 2 ? 8 : sizeof(double));
+    }
+    tagged.push_back(ids);
+    return absl::OkStatus();
+  }
+
+  static constexpr size_t kBlockSize = 2 * sizeof(double) + 8;
+  int starts = 0;
+  int stops = 0;
+  std::vector<std::vector<char>> frames;
+  std::vector<std::vector<uint32_t>> tagged;
+};
+
+std::unique_ptr<SimBridge> Connect(LoadOptions options, int flags) {
+  auto bridge = CreateLoadSimBridge(options);
+  EXPECT_TRUE(bridge->Connect().ok());
+  EXPECT_EQ(*bridge->AddDataDef(0, "A", "feet"), 8);
+  EXPECT_EQ(*bridge->AddDataDef(0, "B", "knots"), 8);
+  EXPECT_EQ(*bridge->AddDataDef(0, "C", "string8"), 8);
+  EXPECT_TRUE(
+      bridge->RequestData(0, 0, RefreshPeriod::VISUAL_FRAME, flags).ok());
+  return bridge;
+}
+
+// Runs the bridge until the sim stops, the way SimRunner does.
+void RunToStop(SimBridge* bridge, FrameLog* log) {
+  while (log->stops == 0) {
+    if (!bridge->WaitForDispatch(absl::Seconds(1))) break;
+    EXPECT_TRUE(bridge->CallDispatch(log).ok());
+  }
+}
+
+TEST(LoadSimBridgeTest, TestSendsFrameCountThenStops) {
+  LoadOptions options;
+  options.rate_hz = 2000;
+  options.frame_count = 20;
+  auto bridge = Connect(options, REQUEST_DEFAULT);
+  FrameLog log;
+  RunToStop(bridge.get(), &log);
+  EXPECT_EQ(log.starts, 1);
+  EXPECT_EQ(log.stops, 1);
+  EXPECT_THAT(log.frames, SizeIs(20));
+  EXPECT_NE(log.frames[0], log.frames[1]);
+}
+
+TEST(LoadSimBridgeTest, TestSendsBursts) {
+  LoadOptions options;
+  options.rate_hz = 100;
+  options.burst_frames = 4;
+  auto bridge = Connect(options, REQUEST_DEFAULT);
+  FrameLog log;
+  ASSERT_TRUE(bridge->WaitForDispatch(absl::Seconds(1)));
+  ASSERT_TRUE(bridge->CallDispatch(&log).ok());
+  EXPECT_THAT(log.frames, SizeIs(4));
+  // The next burst comes 40 ms later.
+  EXPECT_FALSE(bridge->WaitForDispatch(absl::Milliseconds(10)));
+}
+
+TEST(LoadSimBridgeTest, TestChangedRequestSkipsStillFrames) {
+  LoadOptions options;
+  options.rate_hz = 2000;
+  options.frame_count = 10;
+  options.volatility = 0;
+  auto bridge = Connect(options, REQUEST_CHANGED);
+  FrameLog log;
+  RunToStop(bridge.get(), &log);
+  EXPECT_THAT(log.frames, SizeIs(1));
+}
+
+TEST(LoadSimBridgeTest, TestTaggedRequestCarriesChangedVars) {
+  LoadOptions options;
+  options.rate_hz = 2000;
+  options.frame_count = 5;
+  options.string_churn_hz = 2000;
+  auto bridge = Connect(options, REQUEST_TAGGED);
+  FrameLog log;
+  RunToStop(bridge.get(), &log);
+  ASSERT_THAT(log.tagged, SizeIs(5));
+  // Every var changes in every frame.
+  EXPECT_THAT(log.tagged, Each(ElementsAre(0, 1, 2)));
+}
+
+TEST(LoadSimBridgeTest, TestStringsWithoutChurnStayTheSame) {
+  LoadOptions options;
+  options.rate_hz = 2000;
+  options.frame_count = 5;
+  auto bridge = Connect(options, REQUEST_TAGGED);
+  FrameLog log;
+  RunToStop(bridge.get(), &log);
+  ASSERT_THAT(log.tagged, SizeIs(5));
+  EXPECT_THAT(log.tagged[0], ElementsAre(0, 1, 2));
+  EXPECT_THAT(log.tagged[4], ElementsAre(0, 1));
+}
+
+}  // namespace
+}  // namespace sim_bridge
+}  // namespace flight_panel
@@ -0,0 +1,117 @@
+#include "sim_bridge/reconnecting_sim_bridge.h"
+
+#include <memory>
+
+#include "absl/memory/memory.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "sim_bridge/mock_sim_bridge.h"
+
+namespace flight_panel {
+namespace sim_bridge {
+namespace {
+using ::testing::_;
+using ::testing::InSequence;
+using ::testing::Return;
+using ::testing::StrictMock;
+
+// Matches a string_view argument.
+absl::string_view Sv(const char* text) { return text; }
+
+// Connects a bridge and registers a data def, an event and two requests.
+std::unique_ptr<SimBridge> Register(MockSimBridge* mock_bridge) {
+  auto bridge = CreateReconnectingSimBridge(absl::WrapUnique(mock_bridge));
+  EXPECT_CALL(*mock_bridge, Connect()).WillOnce(Return(absl::OkStatus()));
+  EXPECT_CALL(*mock_bridge, AddDataDef(0, Sv("A"), Sv("feet")))
+      .WillOnce(Return(8));
+  EXPECT_CALL(*mock_bridge, AddDataDef(0, Sv("B"), Sv("string8")))
+      .WillOnce(Return(8));
+  EXPECT_CALL(*mock_bridge, SubscribeSystemEvent(1, Sv("SimStart")))
+      .WillOnce(Return(absl::OkStatus()));
+  EXPECT_CALL(*mock_bridge, RequestData(_, 0, _, _))
+      .Times(3)
+      .WillRepeatedly(Return(absl::OkStatus()));
+  EXPECT_TRUE(bridge->Connect().ok());
+  EXPECT_TRUE(bridge->AddDataDef(0, "A", "feet").ok());
+  EXPECT_TRUE(bridge->AddDataDef(0, "B", "string8").ok());
+  EXPECT_TRUE(bridge->SubscribeSystemEvent(1, "SimStart").ok());
+  EXPECT_TRUE(bridge->RequestData(0, 0, RefreshPeriod::SECOND, 0).ok());
+  EXPECT_TRUE(bridge->RequestData(1, 0, RefreshPeriod::SECOND, 0).ok());
+  // Only the latest request of an ID is made again.
+  EXPECT_TRUE(
+      bridge->RequestData(0, 0, RefreshPeriod::VISUAL_FRAME, REQUEST_CHANGED)
+          .ok());
+  ::testing::Mock::VerifyAndClearExpectations(mock_bridge);
+  return bridge;
+}
+
+TEST(ReconnectingSimBridgeTest, TestReconnectMakesRegistrationsAgain) {
+  auto mock_bridge = new StrictMock<MockSimBridge>();
+  auto bridge = Register(mock_bridge);
+
+  InSequence in_order;
+  EXPECT_CALL(*mock_bridge, Connect()).WillOnce(Return(absl::OkStatus()));
+  EXPECT_CALL(*mock_bridge, AddDataDef(0, Sv("A"), Sv("feet")))
+      .WillOnce(Return(8));
+  EXPECT_CALL(*mock_bridge, AddDataDef(0, Sv("B"), Sv("string8")))
+      .WillOnce(Return(8));
+  EXPECT_CALL(*mock_bridge, SubscribeSystemEvent(1, Sv("SimStart")))
+      .WillOnce(Return(absl::OkStatus()));
+  EXPECT_CALL(*mock_bridge, RequestData(1, 0, RefreshPeriod::SECOND, 0))
+      .WillOnce(Return(absl::OkStatus()));
+  EXPECT_CALL(*mock_bridge, RequestData(0, 0, RefreshPeriod::VISUAL_FRAME,
+                                        REQUEST_CHANGED))
+      .WillOnce(Return(absl::OkStatus()));
+  EXPECT_TRUE(bridge->Connect().ok());
+}
+
+TEST(ReconnectingSimBridgeTest, TestStoppedRequestIsNotMadeAgain) {
+  auto mock_bridge = new StrictMock<MockSimBridge>();
+  auto bridge = Register(mock_bridge);
+  EXPECT_CALL(*mock_bridge, RequestData(_, 0, RefreshPeriod::NEVER, 0))
+      .Times(2)
+      .WillRepeatedly(Return(absl::OkStatus()));
+  EXPECT_TRUE(bridge->RequestData(0, 0, RefreshPeriod::NEVER, 0).ok());
+  EXPECT_TRUE(bridge->RequestData(1, 0, RefreshPeriod::NEVER, 0).ok());
+
+  EXPECT_CALL(*mock_bridge, Connect()).WillOnce(Return(absl::OkStatus()));
+  EXPECT_CALL(*mock_bridge, AddDataDef(_, _, _)).WillRepeatedly(Return(8));
+  EXPECT_CALL(*mock_bridge, SubscribeSystemEvent(_, _))
+      .WillOnce(Return(absl::OkStatus()));
+  EXPECT_TRUE(bridge->Connect().ok());
+}
+
+TEST(ReconnectingSimBridgeTest, TestFailedRegistrationIsNotRecorded) {
+  auto mock_bridge = new StrictMock<MockSimBridge>();
+  auto bridge = CreateReconnectingSimBridge(absl::WrapUnique(mock_bridge));
+  EXPECT_CALL(*mock_bridge, Connect())
+      .Times(2)
+      .WillRepeatedly(Return(absl::OkStatus()));
+  EXPECT_CALL(*mock_bridge, AddDataDef(0, Sv("A"), Sv("string3")))
+      .WillOnce(Return(absl::InvalidArgumentError("Bad type")));
+  EXPECT_TRUE(bridge->Connect().ok());
+  EXPECT_FALSE(bridge->AddDataDef(0, "A", "string3").ok());
+  EXPECT_TRUE(bridge->Connect().ok());
+}
+
+TEST(ReconnectingSimBridgeTest, TestFailedReplayClosesConnection) {
+  auto mock_bridge = new StrictMock<MockSimBridge>();
+  auto bridge = Register(mock_bridge);
+  EXPECT_CALL(*mock_bridge, Connect()).WillOnce(Return(absl::OkStatus()));
+  EXPECT_CALL(*mock_bridge, AddDataDef(0, Sv("A"), Sv("feet")))
+      .WillOnce(Return(absl::InternalError("Sim went away")));
+  EXPECT_CALL(*mock_bridge, Close()).WillOnce(Return(absl::OkStatus()));
+  EXPECT_EQ(bridge->Connect().code(), absl::StatusCode::kInternal);
+}
+
+TEST(ReconnectingSimBridgeTest, TestFailedConnectReplaysNothing) {
+  auto mock_bridge = new StrictMock<MockSimBridge>();
+  auto bridge = Register(mock_bridge);
+  EXPECT_CALL(*mock_bridge, Connect())
+      .WillOnce(Return(absl::UnavailableError("No sim")));
+  EXPECT_EQ(bridge->Connect().code(), absl::StatusCode::kUnavailable);
+}
+
+}  // namespace
+}  // namespace sim_bridge
+}  // namespace flight_panel
@@ -1,25 +1,33 @@
 #include "sim_runner/sim_runner.h"
 
+#include <algorithm>
 #include <memory>
+#include <vector>
 
 #include "absl/synchronization/notification.h"
 #include "absl/time/clock.h"
 #include "absl_helper/status_macros.h"
+#include "data_def/util.h"
 #include "data_dispatcher/data_dispatcher.h"
 #include "data_reader/data_reader.h"
+#include "sim_bridge/command_queue.h"
 #include "sim_bridge/dispatch_handler.h"
+#include "sim_bridge/reconnecting_sim_bridge.h"
 #include "sim_bridge/sim_bridge.h"
 #include "spdlog/spdlog.h"
 
 namespace flight_panel {
 namespace {
 using data_dispatcher::DataDispatcher;
+using sim_bridge::CommandQueue;
 using sim_bridge::DispatchHandler;
 using sim_bridge::SimBridge;
 
-// Sim events to subscribe to.
-constexpr absl::Duration kRetryInterval = absl::Seconds(10);
-constexpr absl::Duration kLoopInterval = absl::Milliseconds(10);
+// Waits between connection attempts, doubled after each failure.
+constexpr absl::Duration kFirstRetryDelay = absl::Milliseconds(250);
+constexpr absl::Duration kMaxRetryDelay = absl::Seconds(10);
+// Longest wait for sim messages. Bounds how long Run() takes to see Stop().
+constexpr absl::Duration kDispatchTimeout = absl::Milliseconds(100);
 
 // Add a handler to quite on stop.
 class RunnerDispatchHandler : public DispatchHandler {
@@ -33,6 +41,10 @@ class RunnerDispatchHandler : public DispatchHandler {
   virtual absl::Status OnData(int req_id, void* pData) override {
     return absl::OkStatus();
   }
+  virtual absl::Status OnTaggedData(int req_id, int datum_count,
+                                    void* pData) override {
+    return absl::OkStatus();
+  }
 
  private:
   SimRunner* runner_;
@@ -40,6 +52,7 @@ class RunnerDispatchHandler : public DispatchHandler {
 
 class SimRunnerImpl : public SimRunner {
  public:
+  // The reader also uses the IDs after these, see CreateDataReader().
   static constexpr int kDataReadRequestID = 0;
   static constexpr int kDataReadDefID = 0;
   SimRunnerImpl(std::unique_ptr<SimBridge> bridge,
@@ -55,27 +68,59 @@ class SimRunnerImpl : public SimRunner {
   virtual data_dispatcher::DataDispatcher* data_dispatcher() override {
     return dispatcher_.get();
   }
+  virtual CommandQueue* command_queue() override { return &commands_; }
 
  private:
   absl::Status SubscribeEvents();
+  // Tries to connect once. Registers the data defs and events on the first
+  // connection, the bridge makes them again on the next ones. Schedules the
+  // next attempt if the sim is not there. Only fails if the registration
+  // fails.
+  absl::Status TryConnect();
+  // Waits for the next connection attempt, or Stop(), then tries it.
+  absl::Status Reconnect();
+  // Closes the lost connection and keeps serving the last frame, marked
+  // disconnected, until the sim is back.
+  void OnDisconnected(const absl::Status& status);
+  // Starts the data requests, once Run() started and the defs are
+  // registered.
+  absl::Status StartRequests();
+  // Sends the queued commands in one batch.
+  void SendCommands();
 
   bool ShouldQuit();
+  bool initialized_ = false;
   bool connected_;
+  // Whether the reader registered its data defs with the bridge.
+  bool registered_ = false;
+  bool running_ = false;
+  bool requested_ = false;
+  absl::Duration retry_delay_ = kFirstRetryDelay;
+  absl::Time next_connect_time_ = absl::InfinitePast();
   std::unique_ptr<sim_bridge::GroupedDispatchHandler> dispatch_handler_;
   std::unique_ptr<RunnerDispatchHandler> runner_dispatch_handler_;
   std::unique_ptr<absl::Notification> stop_notification_;
-  std::unique_ptr<DataReader> reader_;
+  // Declared before reader_, which points to both.
   std::unique_ptr<sim_bridge::SimBridge> bridge_;
   std::unique_ptr<data_dispatcher::DataDispatcher> dispatcher_;
+  std::unique_ptr<DataReader> reader_;
+  CommandQueue commands_;
+  // Relative commands start from the latest frame.
+  const CommandQueue::CurrentValue current_value_;
+  // Reused by every SendCommands().
+  std::vector<data::WriteData> command_batch_;
 };
 
 SimRunnerImpl::SimRunnerImpl(std::unique_ptr<SimBridge> bridge,
                              std::unique_ptr<DataDispatcher> dispatcher)
-    : bridge_(std::move(bridge)),
-      dispatcher_(std::move(dispatcher_)),
-      connected_(false),
-      reader_(CreateDataReader(kDataReadRequestID, kDataReadDefID, bridge.get(),
-                               dispatcher.get())) {
+    : connected_(false),
+      bridge_(sim_bridge::CreateReconnectingSimBridge(std::move(bridge))),
+      dispatcher_(std::move(dispatcher)),
+      reader_(CreateDataReader(kDataReadRequestID, kDataReadDefID,
+                               bridge_.get(), dispatcher_.get())),
+      current_value_([this](data::EVENT_ID id, double* value) {
+        return data::CurrentEventValue(id, reader_->LatestVars(), value);
+      }) {
   // Initialize dispatch handler
   dispatch_handler_ = absl::make_unique<sim_bridge::GroupedDispatchHandler>();
   // This is the handler to stop the runner when stop signal is received from
@@ -88,36 +133,39 @@ SimRunnerImpl::SimRunnerImpl(std::unique_ptr<SimBridge> bridge,
 }
 
 absl::Status SimRunnerImpl::Init() {
-  // Retry to connect
-  while (!bridge_->Connect().ok()) {
-    absl::SleepFor(kRetryInterval);
-  }
-  connected_ = true;
-  RETURN_IF_ERROR(reader_->RegisterDataDef());
-  RETURN_IF_ERROR(SubscribeEvents());
-  return absl::OkStatus();
+  initialized_ = true;
+  return TryConnect();
 }
 
 absl::Status SimRunnerImpl::Run() {
-  if (!connected_) {
-    return absl::FailedPreconditionError(
-        "Must connect to SimConnect before running.");
+  if (!initialized_) {
+    return absl::FailedPreconditionError("Must call Init() before running.");
   }
   stop_notification_ = absl::make_unique<absl::Notification>();
-  // Start request data.
-  bridge_->RequestData(kDataReadRequestID, kDataReadDefID,
-                       sim_bridge::RefreshPeriod::VISUAL_FRAME);
+  running_ = true;
+  absl::Status status = StartRequests();
   // Start a loop to read data.
-  while (!ShouldQuit()) {
-    // Process incoming data with dispatch handler.
-    bridge_->CallDispatch(
-        (sim_bridge::DispatchHandler*)dispatch_handler_.get());
-    absl::SleepFor(kLoopInterval);
+  while (status.ok() && !ShouldQuit()) {
+    if (!connected_) {
+      status = Reconnect();
+      continue;
+    }
+    // Sleep until the sim sends something, then handle all of it at once.
+    if (bridge_->WaitForDispatch(kDispatchTimeout)) {
+      absl::Status dispatched = bridge_->CallDispatch(
+          (sim_bridge::DispatchHandler*)dispatch_handler_.get());
+      if (absl::IsUnavailable(dispatched)) {
+        OnDisconnected(dispatched);
+        continue;
+      }
+    }
+    SendCommands();
   }
+  running_ = false;
 
   // Clean up before finishing.
-  CleanUp();
-  return absl::OkStatus();
+  if (connected_) CleanUp();
+  return status;
 }
 
 // Stops the loop.
@@ -128,13 +176,72 @@ absl::Status SimRunnerImpl::Stop() {
 
 absl::Status SimRunnerImpl::CleanUp() {
   // Stop requesting data.
-  RETURN_IF_ERROR(bridge_->RequestData(kDataReadRequestID, kDataReadDefID,
-                                       sim_bridge::RefreshPeriod::NEVER));
+  RETURN_IF_ERROR(reader_->RequestData(sim_bridge::RefreshPeriod::NEVER));
   RETURN_IF_ERROR(bridge_->Close());
   connected_ = false;
+  requested_ = false;
   return absl::Status();
 }
 
+absl::Status SimRunnerImpl::TryConnect() {
+  absl::Status status = bridge_->Connect();
+  if (!status.ok()) {
+    SPDLOG_INFO("Sim not available, retrying in {}: {}",
+                absl::FormatDuration(retry_delay_), status.ToString());
+    next_connect_time_ = absl::Now() + retry_delay_;
+    retry_delay_ = std::min(retry_delay_ * 2, kMaxRetryDelay);
+    return absl::OkStatus();
+  }
+  if (!registered_) {
+    RETURN_IF_ERROR(reader_->RegisterDataDef());
+    RETURN_IF_ERROR(SubscribeEvents());
+    registered_ = true;
+  }
+  connected_ = true;
+  retry_delay_ = kFirstRetryDelay;
+  SPDLOG_INFO("Connected to the sim");
+  RETURN_IF_ERROR(StartRequests());
+  return reader_->SetConnected(true);
+}
+
+absl::Status SimRunnerImpl::Reconnect() {
+  const absl::Duration wait = next_connect_time_ - absl::Now();
+  if (wait > absl::ZeroDuration() &&
+      stop_notification_->WaitForNotificationWithTimeout(wait)) {
+    return absl::OkStatus();
+  }
+  return TryConnect();
+}
+
+void SimRunnerImpl::OnDisconnected(const absl::Status& status) {
+  SPDLOG_WARN("Lost the sim: {}", status.ToString());
+  bridge_->Close().IgnoreError();
+  connected_ = false;
+  next_connect_time_ = absl::Now() + retry_delay_;
+  absl::Status published = reader_->SetConnected(false);
+  if (!published.ok()) {
+    SPDLOG_ERROR("Failed to publish the disconnect: {}", published.ToString());
+  }
+}
+
+absl::Status SimRunnerImpl::StartRequests() {
+  // After a reconnect, the bridge already made the requests again.
+  if (!running_ || !connected_ || requested_) return absl::OkStatus();
+  RETURN_IF_ERROR(
+      reader_->RequestData(sim_bridge::RefreshPeriod::VISUAL_FRAME));
+  requested_ = true;
+  return absl::OkStatus();
+}
+
+void SimRunnerImpl::SendCommands() {
+  commands_.Drain(current_value_, &command_batch_);
+  if (command_batch_.empty()) return;
+  absl::Status status = bridge_->TransmitClientEvents(command_batch_);
+  if (!status.ok()) {
+    SPDLOG_ERROR("Failed to send commands: {}", status.ToString());
+  }
+}
+
 absl::Status SimRunnerImpl::SubscribeEvents() {
   // Subscribe to start and stop events.
   RETURN_IF_ERROR(bridge_->SubscribeSystemEvent(data::SIM_START, "SimStart"));
@@ -4,17 +4,28 @@
 
 #include "absl/status/status.h"
 #include "data_dispatcher/data_dispatcher.h"
+#include "sim_bridge/command_queue.h"
 #include "sim_bridge/sim_bridge.h"
 
 namespace flight_panel {
 class SimRunner {
  public:
+  virtual ~SimRunner() = default;
+
+  // Connects to the sim if it is running. Does not wait for it: Run() keeps
+  // trying, backing off from a few hundred ms to 10 s.
   virtual absl::Status Init() = 0;
+  // Handles the sim until Stop() or the sim stops. When the connection is
+  // lost, the dispatcher gets the last frame marked disconnected and the
+  // runner reconnects in the background.
   virtual absl::Status Run() = 0;
   virtual absl::Status Stop() = 0;
 
   virtual sim_bridge::SimBridge* sim_bridge() = 0;
   virtual data_dispatcher::DataDispatcher* data_dispatcher() = 0;
+  // Commands for the sim, from any thread. Run() sends them once per
+  // dispatch cycle.
+  virtual sim_bridge::CommandQueue* command_queue() = 0;
 };
 
 std::unique_ptr<SimRunner> CreateSimRunner(
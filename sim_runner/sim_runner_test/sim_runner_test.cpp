@@ -1,6 +1,10 @@
 #include "sim_runner/sim_runner.h"
 
+#include <thread>
+#include <vector>
+
 #include "absl/status/status.h"
+#include "absl/synchronization/notification.h"
 #include "absl/time/clock.h"
 #include "data_def/proto/sim_data.pb.h"
 #include "data_dispatcher/mock_data_dispatcher.h"
@@ -13,12 +17,16 @@ namespace flight_panel {
 namespace {
 using ::testing::_;
 using ::testing::DoubleEq;
+using ::testing::ElementsAre;
 using ::testing::Field;
+using ::testing::Invoke;
+using ::testing::NiceMock;
 using ::testing::Return;
 using ::testing::SaveArg;
 using ::testing::StrictMock;
 
 using data_dispatcher::MockDataDispatcher;
+using sim_bridge::DispatchHandler;
 using sim_bridge::MockSimBridge;
 
 using data::SimVars;
@@ -28,6 +36,36 @@ class MockClient {
   MOCK_METHOD(absl::Status, Dispatch, (const SimData&));
 };
 
+// Lets Init() and the clean up of Run() succeed.
+void ExpectConnect(MockSimBridge* mock_bridge) {
+  ON_CALL(*mock_bridge, Connect()).WillByDefault(Return(absl::OkStatus()));
+  ON_CALL(*mock_bridge, AddDataDef(_, _, _)).WillByDefault(Return(8));
+  ON_CALL(*mock_bridge, SubscribeSystemEvent(_, _))
+      .WillByDefault(Return(absl::OkStatus()));
+  ON_CALL(*mock_bridge, RequestData(_, _, _, _))
+      .WillByDefault(Return(absl::OkStatus()));
+  ON_CALL(*mock_bridge, Close()).WillByDefault(Return(absl::OkStatus()));
+}
+
+// Leases fresh frames to the reader and keeps SimVars::connected of the
+// committed ones.
+void ExpectFrames(MockDataDispatcher* mock_dispatcher,
+                  std::vector<double>* connected = nullptr) {
+  ON_CALL(*mock_dispatcher, LeaseFrame()).WillByDefault(Invoke([] {
+    return std::make_shared<data_dispatcher::FrameBuffer>();
+  }));
+  ON_CALL(*mock_dispatcher, Commit(_))
+      .WillByDefault(Invoke([connected](data_dispatcher::FrameLease frame) {
+        if (connected) connected->push_back(frame->vars.connected);
+        return absl::OkStatus();
+      }));
+}
+
+// Stops the runner, as the sim does when the flight ends.
+absl::Status DispatchStop(DispatchHandler* handler) {
+  return handler->OnStop();
+}
+
 TEST(SimRunnerTest, TestCreateSimRunner) {
   auto mock_bridge = absl::make_unique<MockSimBridge>();
   auto mock_dispatcher = absl::make_unique<MockDataDispatcher>();
@@ -43,8 +81,12 @@ TEST(SimRunnerTest, TestInit_SuccessConnect_WillAddDataRef) {
                       absl::WrapUnique<MockDataDispatcher>(mock_dispatcher));
 
   // Setup mocks
+  ExpectFrames(mock_dispatcher);
   EXPECT_CALL(*mock_bridge, Connect()).WillOnce(Return(absl::OkStatus()));
+  // One block per refresh group.
   EXPECT_CALL(*mock_bridge, AddDataDef(0, _, _)).WillRepeatedly(Return(8));
+  EXPECT_CALL(*mock_bridge, AddDataDef(1, _, _)).WillRepeatedly(Return(8));
+  EXPECT_CALL(*mock_bridge, AddDataDef(2, _, _)).WillRepeatedly(Return(8));
   EXPECT_CALL(*mock_bridge, SubscribeSystemEvent(0, _))
       .WillOnce(Return(absl::OkStatus()));
   EXPECT_CALL(*mock_bridge, SubscribeSystemEvent(1, _))
@@ -64,5 +106,147 @@ TEST(SimRunnerTest, TestRunWithoutInit_Fail) {
   EXPECT_EQ(runner->Run().code(), absl::StatusCode::kFailedPrecondition);
 }
 
+TEST(SimRunnerTest, TestRun_DispatchesOnlyWhenReady) {
+  auto mock_bridge = new NiceMock<MockSimBridge>();
+  auto mock_dispatcher = new NiceMock<MockDataDispatcher>();
+  auto runner = CreateSimRunner(absl::WrapUnique(mock_bridge),
+                                absl::WrapUnique(mock_dispatcher));
+  ExpectConnect(mock_bridge);
+  ExpectFrames(mock_dispatcher);
+  ASSERT_TRUE(runner->Init().ok());
+
+  // A wait that times out must not dispatch.
+  EXPECT_CALL(*mock_bridge, WaitForDispatch(_))
+      .WillOnce(Return(false))
+      .WillOnce(Return(false))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*mock_bridge, CallDispatch(_)).WillOnce(Invoke(DispatchStop));
+  EXPECT_TRUE(runner->Run().ok());
+}
+
+TEST(SimRunnerTest, TestRun_WakesWhenBridgeSignals) {
+  auto mock_bridge = new NiceMock<MockSimBridge>();
+  auto mock_dispatcher = new NiceMock<MockDataDispatcher>();
+  auto runner = CreateSimRunner(absl::WrapUnique(mock_bridge),
+                                absl::WrapUnique(mock_dispatcher));
+  ExpectConnect(mock_bridge);
+  ExpectFrames(mock_dispatcher);
+  ASSERT_TRUE(runner->Init().ok());
+
+  // The sim signals from its own thread.
+  absl::Notification ready;
+  EXPECT_CALL(*mock_bridge, WaitForDispatch(_))
+      .WillRepeatedly(Invoke([&ready](absl::Duration timeout) {
+        return ready.WaitForNotificationWithTimeout(timeout);
+      }));
+  EXPECT_CALL(*mock_bridge, CallDispatch(_)).WillOnce(Invoke(DispatchStop));
+  std::thread sim([&ready] {
+    absl::SleepFor(absl::Milliseconds(20));
+    ready.Notify();
+  });
+  EXPECT_TRUE(runner->Run().ok());
+  sim.join();
+}
+
+TEST(SimRunnerTest, TestRun_SendsQueuedCommandsOnceAsOneBatch) {
+  auto mock_bridge = new NiceMock<MockSimBridge>();
+  auto mock_dispatcher = new NiceMock<MockDataDispatcher>();
+  auto runner = CreateSimRunner(absl::WrapUnique(mock_bridge),
+                                absl::WrapUnique(mock_dispatcher));
+  ExpectConnect(mock_bridge);
+  ExpectFrames(mock_dispatcher);
+  ASSERT_TRUE(runner->Init().ok());
+
+  // No frame yet, so the heading bug is at 0.
+  sim_bridge::CommandQueue* commands = runner->command_queue();
+  EXPECT_TRUE(commands->Push({data::KEY_AP_MASTER, 0}).ok());
+  EXPECT_TRUE(commands->Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+  EXPECT_TRUE(commands->Push({data::KEY_HEADING_BUG_SET, 1, true}).ok());
+  std::vector<std::pair<data::EVENT_ID, double>> sent;
+  EXPECT_CALL(*mock_bridge, TransmitClientEvents(_))
+      .WillOnce(Invoke([&sent](absl::Span<const data::WriteData> events) {
+        for (const data::WriteData& event : events) {
+          sent.emplace_back(event.eventId, event.value);
+        }
+        return absl::OkStatus();
+      }));
+  EXPECT_CALL(*mock_bridge, WaitForDispatch(_))
+      .WillOnce(Return(false))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*mock_bridge, CallDispatch(_)).WillOnce(Invoke(DispatchStop));
+  EXPECT_TRUE(runner->Run().ok());
+  EXPECT_THAT(sent,
+              ElementsAre(std::make_pair(data::KEY_AP_MASTER, 0.0),
+                          std::make_pair(data::KEY_HEADING_BUG_SET, 2.0)));
+}
+
+TEST(SimRunnerTest, TestInit_SimNotRunning_DoesNotWait) {
+  auto mock_bridge = new NiceMock<MockSimBridge>();
+  auto runner =
+      CreateSimRunner(absl::WrapUnique(mock_bridge),
+                      absl::make_unique<NiceMock<MockDataDispatcher>>());
+  EXPECT_CALL(*mock_bridge, Connect())
+      .WillOnce(Return(absl::UnavailableError("No sim")));
+  EXPECT_CALL(*mock_bridge, AddDataDef(_, _, _)).Times(0);
+  const absl::Time start = absl::Now();
+  EXPECT_TRUE(runner->Init().ok());
+  EXPECT_LT(absl::Now() - start, absl::Seconds(1));
+}
+
+TEST(SimRunnerTest, TestRun_RetriesConnectWithBackoff) {
+  auto mock_bridge = new NiceMock<MockSimBridge>();
+  auto mock_dispatcher = new NiceMock<MockDataDispatcher>();
+  auto runner = CreateSimRunner(absl::WrapUnique(mock_bridge),
+                                absl::WrapUnique(mock_dispatcher));
+  ExpectConnect(mock_bridge);
+  ExpectFrames(mock_dispatcher);
+  std::vector<absl::Time> attempts;
+  EXPECT_CALL(*mock_bridge, Connect())
+      .Times(3)
+      .WillRepeatedly(Invoke([&attempts] {
+        attempts.push_back(absl::Now());
+        return attempts.size() < 3 ? absl::UnavailableError("No sim")
+                                   : absl::OkStatus();
+      }));
+  ASSERT_TRUE(runner->Init().ok());
+  EXPECT_CALL(*mock_bridge, WaitForDispatch(_)).WillOnce(Return(true));
+  EXPECT_CALL(*mock_bridge, CallDispatch(_)).WillOnce(Invoke(DispatchStop));
+  EXPECT_TRUE(runner->Run().ok());
+  ASSERT_EQ(attempts.size(), 3);
+  // The first retry comes soon, the next one later.
+  EXPECT_LT(attempts[1] - attempts[0], absl::Seconds(1));
+  EXPECT_GT(attempts[2] - attempts[1], attempts[1] - attempts[0]);
+}
+
+TEST(SimRunnerTest, TestRun_ReconnectsWhenSimQuits) {
+  auto mock_bridge = new NiceMock<MockSimBridge>();
+  auto mock_dispatcher = new NiceMock<MockDataDispatcher>();
+  auto runner = CreateSimRunner(absl::WrapUnique(mock_bridge),
+                                absl::WrapUnique(mock_dispatcher));
+  ExpectConnect(mock_bridge);
+  std::vector<double> connected;
+  ExpectFrames(mock_dispatcher, &connected);
+  int def_count = 0;
+  EXPECT_CALL(*mock_bridge, AddDataDef(_, _, _))
+      .WillRepeatedly(Invoke([&def_count](int, absl::string_view,
+                                          absl::string_view) {
+        ++def_count;
+        return 8;
+      }));
+  ASSERT_TRUE(runner->Init().ok());
+  const int registered = def_count;
+
+  EXPECT_CALL(*mock_bridge, Connect()).WillOnce(Return(absl::OkStatus()));
+  EXPECT_CALL(*mock_bridge, WaitForDispatch(_)).WillRepeatedly(Return(true));
+  EXPECT_CALL(*mock_bridge, CallDispatch(_))
+      .WillOnce(Return(absl::UnavailableError("The sim quit.")))
+      .WillOnce(Invoke(DispatchStop));
+  EXPECT_TRUE(runner->Run().ok());
+  // The defs were made again, without the reader.
+  EXPECT_EQ(def_count, 2 * registered);
+  // Clients saw the sim go away and come back.
+  EXPECT_THAT(connected, ElementsAre(1, 0, 1));
+}
+
 }  // namespace
 }  // namespace flight_panel
\ No newline at end of file
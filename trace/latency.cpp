@@ -0,0 +1,171 @@
+#include "trace/latency.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+
+namespace flight_panel {
+namespace trace {
+namespace {
+
+// Index of the highest set bit. `value` must be positive.
+int HighestBit(uint64_t value) {
+  int bit = 0;
+  for (int shift = 32; shift > 0; shift /= 2) {
+    if (value >> shift) {
+      value >>= shift;
+      bit += shift;
+    }
+  }
+  return bit;
+}
+
+class LatencyRegistry {
+ public:
+  LatencyHistogram* Get(Stage stage, absl::string_view recipient)
+      LOCKS_EXCLUDED(lock_) {
+    Key key(stage, stage == Stage::kDelivery ? std::string(recipient) : "");
+    absl::MutexLock l(&lock_);
+    std::unique_ptr<LatencyHistogram>& histogram = histograms_[key];
+    if (!histogram) histogram = absl::make_unique<LatencyHistogram>();
+    return histogram.get();
+  }
+
+  std::vector<LatencySummary> Summaries() LOCKS_EXCLUDED(lock_) {
+    std::vector<LatencySummary> summaries;
+    absl::MutexLock l(&lock_);
+    for (const auto& entry : histograms_) {
+      const LatencyHistogram& histogram = *entry.second;
+      if (histogram.Count() == 0) continue;
+      LatencySummary summary;
+      summary.stage = entry.first.first;
+      summary.recipient = entry.first.second;
+      summary.count = histogram.Count();
+      summary.p50 = histogram.Percentile(50);
+      summary.p90 = histogram.Percentile(90);
+      summary.p99 = histogram.Percentile(99);
+      summary.p999 = histogram.Percentile(99.9);
+      summary.max = histogram.Max();
+      summaries.push_back(summary);
+    }
+    return summaries;
+  }
+
+  void Reset() LOCKS_EXCLUDED(lock_) {
+    absl::MutexLock l(&lock_);
+    for (auto& entry : histograms_) entry.second->Reset();
+  }
+
+ private:
+  using Key = std::pair<Stage, std::string>;
+
+  absl::Mutex lock_;
+  std::map<Key, std::unique_ptr<LatencyHistogram>> histograms_
+      GUARDED_BY(lock_);
+};
+
+LatencyRegistry* GetRegistry() {
+  static LatencyRegistry* registry = new LatencyRegistry();
+  return registry;
+}
+
+}  // namespace
+
+int64_t MonotonicNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+const char* StageName(Stage stage) {
+  switch (stage) {
+    case Stage::kEnqueue:
+      return "enqueue";
+    case Stage::kConvert:
+      return "convert";
+    case Stage::kDelivery:
+      return "delivery";
+    case Stage::kWsSend:
+      return "ws_send";
+    case Stage::kSerialWrite:
+      return "serial_write";
+  }
+  return "unknown";
+}
+
+LatencyHistogram::LatencyHistogram() { Reset(); }
+
+int LatencyHistogram::BucketIndex(int64_t value) {
+  // Values below kSubBuckets get a bucket each. Above that, the bucket is
+  // picked by the highest bit, then by the kSubBucketBits bits below it.
+  if (value < kSubBuckets) return static_cast<int>(value);
+  const int shift = HighestBit(value) - kSubBucketBits;
+  const int sub_bucket = (value >> shift) & (kSubBuckets - 1);
+  return (shift + 1) * kSubBuckets + sub_bucket;
+}
+
+int64_t LatencyHistogram::BucketUpperBound(int index) {
+  if (index < kSubBuckets) return index;
+  const int shift = index / kSubBuckets - 1;
+  const int64_t lower = static_cast<int64_t>(kSubBuckets + index % kSubBuckets)
+                        << shift;
+  return lower + (int64_t{1} << shift) - 1;
+}
+
+void LatencyHistogram::Record(int64_t nanos) {
+  nanos = std::max<int64_t>(nanos, 0);
+  counts_[BucketIndex(nanos)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  int64_t max = max_.load(std::memory_order_relaxed);
+  while (nanos > max &&
+         !max_.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {
+  }
+}
+
+int64_t LatencyHistogram::Count() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::Max() const {
+  return max_.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::Percentile(double percentile) const {
+  const int64_t count = Count();
+  if (count == 0) return 0;
+  const int64_t rank = std::max<int64_t>(
+      1, static_cast<int64_t>(std::ceil(percentile / 100 * count)));
+  int64_t seen = 0;
+  for (int i = 0; i < kBucketCount; ++i) {
+    seen += counts_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) return std::min(BucketUpperBound(i), Max());
+  }
+  return Max();
+}
+
+void LatencyHistogram::Reset() {
+  for (auto& count : counts_) count.store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+LatencyHistogram* GetLatencyHistogram(Stage stage,
+                                      absl::string_view recipient) {
+  return GetRegistry()->Get(stage, recipient);
+}
+
+std::vector<LatencySummary> GetLatencySummaries() {
+  return GetRegistry()->Summaries();
+}
+
+void ResetLatency() { GetRegistry()->Reset(); }
+
+}  // namespace trace
+}  // namespace flight_panel
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+// Pipeline latency histograms.
+//
+// DataReader stamps every frame with a FrameStamp when SimConnect hands it
+// over. The stamp travels with the frame through the dispatcher, and each
+// stage records how long it took into a process-wide LatencyHistogram.
+// GetLatencySummaries() reports the percentiles of all stages.
+
+namespace flight_panel {
+namespace trace {
+
+// Monotonic clock, in nanoseconds. Not related to wall time.
+int64_t MonotonicNanos();
+
+// Identifies one frame from the moment it left SimConnect.
+struct FrameStamp {
+  // Increases by one for every frame the reader receives, starting at 1. 0
+  // means the frame was not stamped.
+  int64_t sequence = 0;
+  // MonotonicNanos() when the reader received the frame.
+  int64_t received_ns = 0;
+};
+
+// A stage of the pipeline a histogram measures.
+enum class Stage {
+  // From receipt until the dispatcher worker takes the frame off its queue.
+  kEnqueue,
+  // SimVars to SimData conversion.
+  kConvert,
+  // From receipt until a recipient's callback returned. One histogram per
+  // recipient.
+  kDelivery,
+  // Sending one frame to all WebSocket connections.
+  kWsSend,
+  // Writing one frame to the serial panel.
+  kSerialWrite,
+};
+
+const char* StageName(Stage stage);
+
+// A lock-free histogram of durations in the style of HdrHistogram: values
+// are counted in buckets whose width grows with the value, so every recorded
+// value is kept with about 6% precision from nanoseconds to hours, in a fixed
+// amount of memory. Record() may be called from any thread.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  // Negative values are recorded as 0.
+  void Record(int64_t nanos);
+
+  int64_t Count() const;
+  int64_t Max() const;
+  // The value at percentile `percentile` (0-100), in nanoseconds. This is
+  // the upper end of the bucket the value fell in, never above Max(). 0 if
+  // nothing was recorded.
+  int64_t Percentile(double percentile) const;
+  void Reset();
+
+ private:
+  // Each power of two is split into 2^kSubBucketBits buckets.
+  static constexpr int kSubBucketBits = 4;
+  static constexpr int kSubBuckets = 1 << kSubBucketBits;
+  static constexpr int kBucketCount = (64 - kSubBucketBits) * kSubBuckets;
+
+  static int BucketIndex(int64_t value);
+  static int64_t BucketUpperBound(int index);
+
+  std::atomic<int64_t> counts_[kBucketCount];
+  std::atomic<int64_t> count_{0};
+  std::atomic<int64_t> max_{0};
+};
+
+// The histogram of a stage. For kDelivery, `recipient` names the recipient,
+// the other stages ignore it. Histograms are created on first use and live
+// until the process exits, so callers can keep the pointer.
+LatencyHistogram* GetLatencyHistogram(Stage stage,
+                                      absl::string_view recipient = "");
+
+struct LatencySummary {
+  Stage stage;
+  // Only set for kDelivery.
+  std::string recipient;
+  int64_t count = 0;
+  // Nanoseconds.
+  int64_t p50 = 0;
+  int64_t p90 = 0;
+  int64_t p99 = 0;
+  int64_t p999 = 0;
+  int64_t max = 0;
+};
+
+// Percentiles of every histogram that recorded at least one value, ordered by
+// stage and recipient.
+std::vector<LatencySummary> GetLatencySummaries();
+// Resets every histogram.
+void ResetLatency();
+
+}  // namespace trace
+}  // namespace flight_panel
@@ -0,0 +1,213 @@
+#include "trace/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "trace/latency.h"
+
+namespace flight_panel {
+namespace trace {
+namespace {
+
+// Events kept per thread. The oldest events are overwritten.
+constexpr size_t kRingSize = 4096;
+constexpr uint32_t kDumpMagic = 0x46505452;  // "FPTR"
+constexpr uint32_t kDumpVersion = 1;
+
+std::atomic<bool> enabled{false};
+
+// A single-writer ring. The owning thread writes without any lock; readers
+// copy the slots and then discard the ones the writer may have overwritten
+// while they were copying.
+class ThreadRing {
+ public:
+  explicit ThreadRing(uint32_t thread) : thread_(thread) {}
+
+  void Record(const Event& event) {
+    const uint64_t pos = write_pos_.load(std::memory_order_relaxed);
+    events_[pos % kRingSize] = event;
+    events_[pos % kRingSize].thread = thread_;
+    write_pos_.store(pos + 1, std::memory_order_release);
+  }
+
+  void AppendTo(std::vector<Event>* events) {
+    const uint64_t end = write_pos_.load(std::memory_order_acquire);
+    uint64_t begin = std::max(end, uint64_t{kRingSize}) - kRingSize;
+    begin = std::max(begin, clear_pos_.load(std::memory_order_relaxed));
+    const size_t first = events->size();
+    for (uint64_t pos = begin; pos < end; ++pos) {
+      events->push_back(events_[pos % kRingSize]);
+    }
+    // The writer may have rewritten the slots below `valid_begin` while we
+    // copied, including the one it is writing right now.
+    const uint64_t next = write_pos_.load(std::memory_order_acquire) + 1;
+    const uint64_t valid_begin =
+        std::max(next, uint64_t{kRingSize}) - kRingSize;
+    if (valid_begin > begin) {
+      const size_t torn = std::min(valid_begin - begin, end - begin);
+      events->erase(events->begin() + first, events->begin() + first + torn);
+    }
+  }
+
+  void Clear() {
+    clear_pos_.store(write_pos_.load(std::memory_order_acquire),
+                     std::memory_order_relaxed);
+  }
+
+ private:
+  const uint32_t thread_;
+  Event events_[kRingSize];
+  std::atomic<uint64_t> write_pos_{0};
+  // Events before this position were cleared.
+  std::atomic<uint64_t> clear_pos_{0};
+};
+
+// Owns the rings of all threads that ever recorded an event. Rings outlive
+// their thread, so the events of finished threads can still be collected.
+class Registry {
+ public:
+  ThreadRing* NewRing() LOCKS_EXCLUDED(lock_) {
+    absl::MutexLock l(&lock_);
+    rings_.push_back(absl::make_unique<ThreadRing>(rings_.size()));
+    return rings_.back().get();
+  }
+
+  std::vector<ThreadRing*> Rings() LOCKS_EXCLUDED(lock_) {
+    absl::MutexLock l(&lock_);
+    std::vector<ThreadRing*> rings;
+    for (auto& ring : rings_) rings.push_back(ring.get());
+    return rings;
+  }
+
+ private:
+  absl::Mutex lock_;
+  std::vector<std::unique_ptr<ThreadRing>> rings_ GUARDED_BY(lock_);
+};
+
+Registry* GetRegistry() {
+  // Never destroyed, trace points may run during static destruction.
+  static Registry* registry = new Registry();
+  return registry;
+}
+
+ThreadRing* GetThreadRing() {
+  static thread_local ThreadRing* ring = GetRegistry()->NewRing();
+  return ring;
+}
+
+}  // namespace
+
+void SetEnabled(bool enable) {
+  enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+void Record(Level level, EventId id, int64_t arg0, int64_t arg1) {
+  Event event;
+  event.timestamp_ns = MonotonicNanos();
+  event.arg0 = arg0;
+  event.arg1 = arg1;
+  event.id = id;
+  event.level = level;
+  event.reserved = 0;
+  GetThreadRing()->Record(event);
+}
+
+std::vector<Event> Collect() {
+  std::vector<Event> events;
+  for (ThreadRing* ring : GetRegistry()->Rings()) ring->AppendTo(&events);
+  std::stable_sort(events.begin(), events.end(),
+                   [](const Event& a, const Event& b) {
+                     return a.timestamp_ns < b.timestamp_ns;
+                   });
+  return events;
+}
+
+void Clear() {
+  for (ThreadRing* ring : GetRegistry()->Rings()) ring->Clear();
+}
+
+const char* EventName(EventId id) {
+  switch (id) {
+    case EventId::kNone:
+      return "None";
+    case EventId::kReaderData:
+      return "ReaderData";
+    case EventId::kDispatcherFrameTaken:
+      return "DispatcherFrameTaken";
+    case EventId::kDispatcherFrameSuppressed:
+      return "DispatcherFrameSuppressed";
+    case EventId::kDispatcherFrameSkipped:
+      return "DispatcherFrameSkipped";
+    case EventId::kDispatcherFrameDispatched:
+      return "DispatcherFrameDispatched";
+    case EventId::kLaneDelivered:
+      return "LaneDelivered";
+    case EventId::kLaneDropped:
+      return "LaneDropped";
+    case EventId::kWsBroadcast:
+      return "WsBroadcast";
+    case EventId::kEventIdCount:
+      break;
+  }
+  return "Unknown";
+}
+
+std::string Format(const Event& event) {
+  static const char* const kLevelNames[] = {"D", "I", "W"};
+  const int level = static_cast<int>(event.level);
+  return absl::StrFormat("%d.%09d [%s] t%d %s %d %d",
+                         event.timestamp_ns / 1000000000,
+                         event.timestamp_ns % 1000000000,
+                         level < 3 ? kLevelNames[level] : "?", event.thread,
+                         EventName(event.id), event.arg0, event.arg1);
+}
+
+absl::Status Dump(const std::string& path) {
+  std::vector<Event> events = Collect();
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    return absl::InternalError(absl::StrCat("Cannot open trace file ", path));
+  }
+  const uint32_t header[] = {kDumpMagic, kDumpVersion,
+                             static_cast<uint32_t>(sizeof(Event)),
+                             static_cast<uint32_t>(events.size())};
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(events.data()),
+             events.size() * sizeof(Event));
+  if (!file) {
+    return absl::InternalError(absl::StrCat("Cannot write trace file ", path));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::vector<Event>> Load(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return absl::NotFoundError(absl::StrCat("Cannot open trace file ", path));
+  }
+  uint32_t header[4];
+  if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+      header[0] != kDumpMagic || header[1] != kDumpVersion ||
+      header[2] != sizeof(Event)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " is not a trace dump"));
+  }
+  std::vector<Event> events(header[3]);
+  if (!file.read(reinterpret_cast<char*>(events.data()),
+                 events.size() * sizeof(Event))) {
+    return absl::DataLossError(absl::StrCat(path, " is truncated"));
+  }
+  return events;
+}
+
+}  // namespace trace
+}  // namespace flight_panel
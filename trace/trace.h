@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+// Hot path tracing.
+//
+// Trace points record fixed-size binary events into a lock-free ring owned by
+// the calling thread. Nothing is formatted when an event is recorded, the
+// events are collected and decoded on demand (Collect(), Format()) or dumped
+// to a file and decoded offline (Dump(), Load()).
+//
+//   FP_TRACE(kInfo, kDispatcherFrameDispatched, lane_count, changed_count);
+//   FP_TRACE_SAMPLED(60, kInfo, kReaderData, request_id, length);
+//
+// Trace points below FLIGHT_PANEL_TRACE_LEVEL are compiled out. The others
+// cost one relaxed load when tracing is disabled at runtime, and a 32 byte
+// store when it is enabled.
+
+// Lowest level that is compiled in: 0 debug, 1 info, 2 warning, 3 disables
+// all trace points.
+#ifndef FLIGHT_PANEL_TRACE_LEVEL
+#define FLIGHT_PANEL_TRACE_LEVEL 1
+#endif
+
+namespace flight_panel {
+namespace trace {
+
+enum class Level : uint8_t {
+  kDebug = 0,
+  kInfo = 1,
+  kWarning = 2,
+};
+
+// Every trace point has its own id. The meaning of the two arguments is listed
+// next to each id. Only append to this list, so old dumps still decode.
+enum class EventId : uint16_t {
+  kNone = 0,
+  // Data reader got a frame from the bridge. (request id, data length)
+  kReaderData,
+  // Dispatcher worker took a frame from its queue. (sequence, 0)
+  kDispatcherFrameTaken,
+  // Frame dropped by the change detector. (0, 0)
+  kDispatcherFrameSuppressed,
+  // Frame no recipient was due for. (0, 0)
+  kDispatcherFrameSkipped,
+  // Frame converted and queued on the lanes. (due lanes, changed vars)
+  kDispatcherFrameDispatched,
+  // Recipient callback returned. (frames still queued, 1 if it failed)
+  kLaneDelivered,
+  // Frame dropped from a full lane. (backlog, 0)
+  kLaneDropped,
+  // WebSocket broadcast. (connections, payload bytes)
+  kWsBroadcast,
+  // Number of ids, keep last.
+  kEventIdCount,
+};
+
+// One recorded trace event. Kept at 32 bytes so two fit in a cache line.
+struct Event {
+  // MonotonicNanos() when the event was recorded.
+  int64_t timestamp_ns;
+  int64_t arg0;
+  int64_t arg1;
+  EventId id;
+  Level level;
+  uint8_t reserved;
+  // Small number identifying the recording thread, in registration order.
+  uint32_t thread;
+};
+static_assert(sizeof(Event) == 32, "Trace events must stay 32 bytes.");
+
+// Runtime switch. Tracing starts disabled.
+void SetEnabled(bool enabled);
+bool IsEnabled();
+
+// Records an event on the calling thread's ring. Use the FP_TRACE macros,
+// which compile out disabled levels.
+void Record(Level level, EventId id, int64_t arg0, int64_t arg1);
+
+// Snapshot of the events still held by all rings, ordered by time. Events
+// recorded while collecting may be missing, never torn.
+std::vector<Event> Collect();
+// Empties all rings.
+void Clear();
+
+// The name of an event id, e.g. "DispatcherFrameDispatched".
+const char* EventName(EventId id);
+// One human readable line per event.
+std::string Format(const Event& event);
+
+// Writes Collect() to a binary file, to be decoded later with Load().
+absl::Status Dump(const std::string& path);
+absl::StatusOr<std::vector<Event>> Load(const std::string& path);
+
+// Whether a level is compiled in.
+constexpr bool LevelCompiledIn(Level level) {
+  return static_cast<int>(level) >= FLIGHT_PANEL_TRACE_LEVEL;
+}
+
+}  // namespace trace
+}  // namespace flight_panel
+
+#define FP_TRACE(level, id, arg0, arg1)                                     \
+  do {                                                                      \
+    if (::flight_panel::trace::LevelCompiledIn(                             \
+            ::flight_panel::trace::Level::level) &&                         \
+        ::flight_panel::trace::IsEnabled()) {                               \
+      ::flight_panel::trace::Record(::flight_panel::trace::Level::level,    \
+                                    ::flight_panel::trace::EventId::id,     \
+                                    static_cast<int64_t>(arg0),             \
+                                    static_cast<int64_t>(arg1));            \
+    }                                                                       \
+  } while (0)
+
+// Records only every `every_n`th pass through this trace point on each thread.
+#define FP_TRACE_SAMPLED(every_n, level, id, arg0, arg1)                    \
+  do {                                                                      \
+    if (::flight_panel::trace::LevelCompiledIn(                             \
+            ::flight_panel::trace::Level::level) &&                         \
+        ::flight_panel::trace::IsEnabled()) {                               \
+      static thread_local uint32_t fp_trace_sample_count = 0;               \
+      if (fp_trace_sample_count++ % (every_n) == 0) {                       \
+        ::flight_panel::trace::Record(::flight_panel::trace::Level::level,  \
+                                      ::flight_panel::trace::EventId::id,   \
+                                      static_cast<int64_t>(arg0),           \
+                                      static_cast<int64_t>(arg1));          \
+      }                                                                     \
+    }                                                                       \
+  } while (0)
@@ -0,0 +1,83 @@
+#include "trace/latency.h"
+
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace flight_panel {
+namespace trace {
+namespace {
+
+TEST(LatencyHistogramTest, TestEmpty) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.Count(), 0);
+  EXPECT_EQ(histogram.Percentile(50), 0);
+}
+
+TEST(LatencyHistogramTest, TestSmallValuesAreExact) {
+  LatencyHistogram histogram;
+  for (int i = 1; i <= 10; ++i) histogram.Record(i);
+  EXPECT_EQ(histogram.Count(), 10);
+  EXPECT_EQ(histogram.Percentile(50), 5);
+  EXPECT_EQ(histogram.Percentile(100), 10);
+  EXPECT_EQ(histogram.Max(), 10);
+}
+
+TEST(LatencyHistogramTest, TestPercentilesWithinPrecision) {
+  LatencyHistogram histogram;
+  // 1us to 1000us.
+  for (int i = 1; i <= 1000; ++i) histogram.Record(i * 1000);
+  EXPECT_NEAR(histogram.Percentile(50), 500000, 500000 * 0.07);
+  EXPECT_NEAR(histogram.Percentile(99), 990000, 990000 * 0.07);
+  EXPECT_EQ(histogram.Percentile(100), 1000000);
+  // Never reports more than the largest value recorded.
+  EXPECT_LE(histogram.Percentile(99.9), histogram.Max());
+}
+
+TEST(LatencyHistogramTest, TestLargeAndNegativeValues) {
+  LatencyHistogram histogram;
+  histogram.Record(-5);
+  histogram.Record(int64_t{1} << 62);
+  EXPECT_EQ(histogram.Percentile(50), 0);
+  EXPECT_EQ(histogram.Percentile(100), int64_t{1} << 62);
+}
+
+TEST(LatencyHistogramTest, TestConcurrentRecord) {
+  LatencyHistogram histogram;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&histogram] {
+      for (int i = 0; i < 1000; ++i) histogram.Record(i);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(histogram.Count(), 4000);
+  EXPECT_EQ(histogram.Max(), 999);
+}
+
+TEST(LatencyRegistryTest, TestSummaries) {
+  ResetLatency();
+  GetLatencyHistogram(Stage::kConvert)->Record(100);
+  GetLatencyHistogram(Stage::kDelivery, "serial")->Record(2000);
+  GetLatencyHistogram(Stage::kDelivery, "ws")->Record(3000);
+  // The same histogram is returned for the same stage and recipient.
+  EXPECT_EQ(GetLatencyHistogram(Stage::kDelivery, "ws"),
+            GetLatencyHistogram(Stage::kDelivery, "ws"));
+
+  std::vector<LatencySummary> summaries = GetLatencySummaries();
+  ASSERT_EQ(summaries.size(), 3);
+  EXPECT_EQ(summaries[0].stage, Stage::kConvert);
+  EXPECT_EQ(summaries[0].p50, 100);
+  EXPECT_EQ(summaries[1].recipient, "serial");
+  EXPECT_EQ(summaries[2].recipient, "ws");
+  EXPECT_EQ(summaries[2].max, 3000);
+
+  ResetLatency();
+  EXPECT_TRUE(GetLatencySummaries().empty());
+}
+
+}  // namespace
+}  // namespace trace
+}  // namespace flight_panel
@@ -0,0 +1,100 @@
+#include "trace/trace.h"
+
+#include <cstdio>
+#include <thread>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace flight_panel {
+namespace trace {
+namespace {
+
+class TraceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    Clear();
+    SetEnabled(true);
+  }
+  void TearDown() override { SetEnabled(false); }
+};
+
+TEST_F(TraceTest, TestRecordsEvents) {
+  FP_TRACE(kInfo, kDispatcherFrameDispatched, 2, 5);
+  FP_TRACE(kWarning, kLaneDropped, 7, 0);
+  std::vector<Event> events = Collect();
+  ASSERT_EQ(events.size(), 2);
+  EXPECT_EQ(events[0].id, EventId::kDispatcherFrameDispatched);
+  EXPECT_EQ(events[0].level, Level::kInfo);
+  EXPECT_EQ(events[0].arg0, 2);
+  EXPECT_EQ(events[0].arg1, 5);
+  EXPECT_EQ(events[1].id, EventId::kLaneDropped);
+  EXPECT_LE(events[0].timestamp_ns, events[1].timestamp_ns);
+}
+
+TEST_F(TraceTest, TestDisabledRecordsNothing) {
+  SetEnabled(false);
+  FP_TRACE(kInfo, kDispatcherFrameDispatched, 0, 0);
+  EXPECT_TRUE(Collect().empty());
+}
+
+TEST_F(TraceTest, TestLevelsBelowCompiledLevelAreSkipped) {
+  static_assert(!LevelCompiledIn(Level::kDebug), "Default level is info.");
+  FP_TRACE(kDebug, kLaneDelivered, 0, 0);
+  EXPECT_TRUE(Collect().empty());
+}
+
+TEST_F(TraceTest, TestSampling) {
+  for (int i = 0; i < 10; ++i) {
+    FP_TRACE_SAMPLED(4, kInfo, kReaderData, i, 0);
+  }
+  std::vector<Event> events = Collect();
+  ASSERT_EQ(events.size(), 3);
+  EXPECT_EQ(events[0].arg0, 0);
+  EXPECT_EQ(events[1].arg0, 4);
+  EXPECT_EQ(events[2].arg0, 8);
+}
+
+TEST_F(TraceTest, TestCollectsAllThreads) {
+  std::thread other([] { FP_TRACE(kInfo, kWsBroadcast, 1, 100); });
+  other.join();
+  FP_TRACE(kInfo, kReaderData, 1, 8);
+  std::vector<Event> events = Collect();
+  ASSERT_EQ(events.size(), 2);
+  EXPECT_EQ(events[0].id, EventId::kWsBroadcast);
+  EXPECT_EQ(events[1].id, EventId::kReaderData);
+  EXPECT_NE(events[0].thread, events[1].thread);
+}
+
+TEST_F(TraceTest, TestRingKeepsLatestEvents) {
+  for (int i = 0; i < 10000; ++i) {
+    FP_TRACE(kInfo, kReaderData, i, 0);
+  }
+  std::vector<Event> events = Collect();
+  ASSERT_FALSE(events.empty());
+  EXPECT_LT(events.size(), 10000);
+  EXPECT_EQ(events.back().arg0, 9999);
+  EXPECT_EQ(events.front().arg0, 10000 - events.size());
+}
+
+TEST_F(TraceTest, TestDumpAndLoad) {
+  FP_TRACE(kInfo, kDispatcherFrameDispatched, 3, 4);
+  const std::string path = ::testing::TempDir() + "trace_test.bin";
+  ASSERT_TRUE(Dump(path).ok());
+  absl::StatusOr<std::vector<Event>> events = Load(path);
+  std::remove(path.c_str());
+  ASSERT_TRUE(events.ok());
+  ASSERT_EQ(events->size(), 1);
+  EXPECT_EQ((*events)[0].arg0, 3);
+  EXPECT_THAT(Format((*events)[0]),
+              ::testing::HasSubstr("DispatcherFrameDispatched 3 4"));
+}
+
+TEST(TraceLoadTest, TestRejectsOtherFiles) {
+  EXPECT_EQ(Load("does_not_exist.bin").status().code(),
+            absl::StatusCode::kNotFound);
+}
+
+}  // namespace
+}  // namespace trace
+}  // namespace flight_panel
@@ -0,0 +1,61 @@
+#include "websocket_server/field_subscription.h"
+
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "google/protobuf/util/field_mask_util.h"
+
+namespace flight_panel {
+namespace ws {
+namespace {
+using ::google::protobuf::FieldMask;
+using ::google::protobuf::util::FieldMaskUtil;
+
+constexpr absl::string_view kSubscribe = "subscribe";
+constexpr absl::string_view kAllFields = "*";
+}  // namespace
+
+absl::StatusOr<FieldSubscription> ParseSubscription(
+    absl::string_view message) {
+  const std::vector<absl::string_view> words =
+      absl::StrSplit(message, ' ', absl::SkipWhitespace());
+  if (words.size() < 2 || words.size() > 3 || words[0] != kSubscribe) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Expected \"subscribe <paths> [<max_rate_hz>]\": ",
+                     message));
+  }
+  FieldSubscription subscription;
+  if (words[1] != kAllFields) {
+    FieldMask fields;
+    FieldMaskUtil::FromString(std::string(words[1]), &fields);
+    if (fields.paths_size() == 0 ||
+        !FieldMaskUtil::IsValidFieldMask<SimData>(fields)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Unknown SimData field in: ", words[1]));
+    }
+    FieldMaskUtil::ToCanonicalForm(fields, &subscription.fields);
+    subscription.key = FieldMaskUtil::ToString(subscription.fields);
+  }
+  if (words.size() == 3 &&
+      (!absl::SimpleAtod(words[2], &subscription.max_rate_hz) ||
+       !(subscription.max_rate_hz >= 0))) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid max rate: ", words[2]));
+  }
+  return subscription;
+}
+
+std::string ProjectFrame(const SimData& data,
+                         const FieldSubscription& subscription) {
+  if (subscription.fields.paths_size() == 0) return data.SerializeAsString();
+  // Only copies the subscribed fields, not the whole frame.
+  SimData projection;
+  FieldMaskUtil::MergeMessageTo(data, subscription.fields,
+                                FieldMaskUtil::MergeOptions(), &projection);
+  return projection.SerializeAsString();
+}
+
+}  // namespace ws
+}  // namespace flight_panel
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "data_def/proto/sim_data.pb.h"
+#include "google/protobuf/field_mask.pb.h"
+
+namespace flight_panel {
+namespace ws {
+
+// The part of each frame a WebSocket client asked for, and how often.
+//
+// Clients subscribe with a text message:
+//
+//   subscribe <paths> [<max_rate_hz>]
+//
+// <paths> are comma separated SimData field paths, e.g.
+// "instruments,nav_data.hsi_1.course", or "*" for the whole frame. Without a
+// rate, or with 0, the client gets every frame. Until it subscribes, a client
+// gets every frame in full.
+struct FieldSubscription {
+  // The fields, in canonical form: sorted, without duplicates or paths
+  // covered by another path. Empty means the whole frame.
+  google::protobuf::FieldMask fields;
+  // The canonical paths as one string. Clients whose subscriptions have the
+  // same key get the same projection.
+  std::string key;
+  // Maximum frames per second. 0 means unlimited.
+  double max_rate_hz = 0;
+};
+
+// Parses a subscribe message. Returns InvalidArgument if it is malformed or
+// names a field SimData does not have.
+absl::StatusOr<FieldSubscription> ParseSubscription(absl::string_view message);
+
+// `data` with only the subscribed fields set, in proto wire format.
+std::string ProjectFrame(const SimData& data,
+                         const FieldSubscription& subscription);
+
+}  // namespace ws
+}  // namespace flight_panel
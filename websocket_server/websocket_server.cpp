@@ -3,13 +3,19 @@
 
 #include "websocket_server/websocket_server.h"
 
+#include <algorithm>
 #include <memory>
+#include <thread>
+#include <vector>
 
-#include "absl/random/random.h"
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "spdlog/spdlog.h"
+#include "trace/latency.h"
+#include "trace/trace.h"
 
 namespace flight_panel {
 namespace ws {
@@ -23,44 +29,17 @@ void SendMsg(Server* server, websocketpp::connection_hdl connection,
   }
 }
 
-SimData GenerateFakeSimData(int seed, int rate) {
-  SimData data;
-  double counter = (double)seed / rate;
-  double sinewave = sin(counter);
-  double sinewave_slow = sin(counter / 5);
-
-  data.mutable_aircraft_info()->set_call_sign("AXSGS");
-  auto instruments = data.mutable_instruments();
-  instruments->set_indicated_airspeed(100 * (1 + sinewave));
-  instruments->set_bank_angle(50 * sinewave);
-  instruments->set_pitch_angle(30 * sinewave_slow);
-  instruments->set_kohlsman_setting_hg(29.92 + sinewave_slow);
-  instruments->set_indicated_altitude(100 * counter);
-  instruments->set_heading_indicator_deg(fmod(counter * 10, 360));
-  instruments->set_vertical_speed(20 * sinewave);
-  instruments->set_turn_indicator_rate(30 * sinewave);
-  instruments->set_turn_coordinator_ball(0.5 + 0.5 * sinewave);
-  auto nav_data = data.mutable_nav_data();
-  nav_data->mutable_hsi_1()->set_course(10 * sinewave);
-  nav_data->mutable_hsi_2()->set_course(-20 * sinewave);
-  auto avionics = data.mutable_avionics();
-  avionics->mutable_cdi_1()->set_radial_error(-40 * sinewave);
-  avionics->mutable_cdi_2()->set_radial_error(40 * sinewave);
-  return data;
-}
-
-SimData FakeSimData() {
-  static double cnt = 0;
-  const int kRate = 30;
-  cnt += 1;
-  return GenerateFakeSimData(cnt, kRate);
+// Size of a prepared message on the wire.
+size_t FrameSize(const Server::message_ptr& message) {
+  return message->get_header().size() + message->get_payload().size();
 }
 }  // namespace
 
 using websocketpp::lib::placeholders::_1;
 using websocketpp::lib::placeholders::_2;
 
-WebSocketServer::WebSocketServer() {
+WebSocketServer::WebSocketServer(ServerOptions options)
+    : options_(options) {
   server_.init_asio();
   // server_.set_error_channels(websocketpp::log::elevel::all);
   // server_.set_access_channels(websocketpp::log::alevel::all ^
@@ -75,6 +54,8 @@ WebSocketServer::WebSocketServer() {
       std::bind(&WebSocketServer::OnMessage, this, _1, _2));
   server_.set_open_handler(std::bind(&WebSocketServer::OnOpen, this, _1));
   server_.set_close_handler(std::bind(&WebSocketServer::OnClose, this, _1));
+  server_.set_validate_handler(
+      std::bind(&WebSocketServer::OnValidate, this, _1));
 }
 
 void WebSocketServer::PushNewEvent(const WSEvent& event) {
@@ -98,6 +79,18 @@ void WebSocketServer::OnClose(websocketpp::connection_hdl connection) {
   SPDLOG_INFO("OnClose: UNSUBSCRIBE pushed");
 }
 
+bool WebSocketServer::OnValidate(websocketpp::connection_hdl connection) {
+  websocketpp::lib::error_code error;
+  Server::connection_ptr con = server_.get_con_from_hdl(connection, error);
+  if (error) return false;
+  // hybi00 clients send no version, every later one uses RFC 6455 frames.
+  if (con->get_request_header("Sec-WebSocket-Version").empty()) {
+    SPDLOG_WARN("Refused a hybi00 client: {}", con->get_remote_endpoint());
+    return false;
+  }
+  return true;
+}
+
 void WebSocketServer::ProcessEvents() {
   auto events_not_empty = [this] { return !events_.empty(); };
   while (true) {
@@ -111,7 +104,8 @@ void WebSocketServer::ProcessEvents() {
     switch (event.event_type) {
       case EventType::SUBSCRIBE: {
         absl::MutexLock l(&connections_lock_);
-        connections_.insert(event.connection);
+        connections_.emplace(event.connection,
+                             std::make_shared<Outbound>(event.connection));
         SPDLOG_INFO("New connection added. Connection count: {}",
                     connections_.size());
         break;
@@ -124,53 +118,256 @@ void WebSocketServer::ProcessEvents() {
         break;
       }
       case EventType::MESSAGE: {
-        HandleMessage(event.message);
+        HandleMessage(event.connection, event.message);
         break;
       }
     }
   }
 }
 
-void WebSocketServer::HandleMessage(Server::message_ptr message) {
+void WebSocketServer::HandleMessage(websocketpp::connection_hdl connection,
+                                    Server::message_ptr message) {
   SPDLOG_INFO("Message Received: {}", message->get_payload());
+  absl::StatusOr<FieldSubscription> subscription =
+      ParseSubscription(message->get_payload());
+  if (!subscription.ok()) {
+    SPDLOG_WARN("Ignored message: {}", subscription.status().ToString());
+    return;
+  }
+  std::shared_ptr<Outbound> outbound;
+  {
+    absl::ReaderMutexLock l(&connections_lock_);
+    auto it = connections_.find(connection);
+    if (it == connections_.end()) return;
+    outbound = it->second;
+  }
+  absl::MutexLock l(&outbound->lock);
+  outbound->subscription =
+      std::make_shared<FieldSubscription>(*std::move(subscription));
+  outbound->next_send = absl::InfinitePast();
+  SPDLOG_INFO("Subscribed to \"{}\" at {} Hz",
+              outbound->subscription->key,
+              outbound->subscription->max_rate_hz);
 }
 
 void WebSocketServer::Run(uint16_t port) {
   server_.listen(port);
   server_.start_accept();
+  // Every thread runs the same io_context. config::asio is multithreaded, so
+  // each connection's handlers run on its own strand, one at a time, in
+  // order. Writes started by Broadcast() run on whichever thread is free.
+  std::vector<std::thread> threads;
+  for (int i = 1; i < options_.io_threads; ++i) {
+    threads.emplace_back([this] { server_.run(); });
+  }
   server_.run();
+  for (std::thread& thread : threads) thread.join();
 }
 
 absl::Status WebSocketServer::Broadcast(const std::string& payload) {
-  // Construct the message
+  static trace::LatencyHistogram* const send_latency =
+      trace::GetLatencyHistogram(trace::Stage::kWsSend);
+  const int64_t send_start = trace::MonotonicNanos();
+  const std::vector<std::shared_ptr<Outbound>> outbounds = Outbounds();
+  FP_TRACE(kDebug, kWsBroadcast, outbounds.size(), payload.size());
+  // One framing and one copy of the payload, shared by every queue.
+  const Server::message_ptr message = PrepareMessage(payload);
   absl::Status status;
-  {
-    absl::MutexLock l(&connections_lock_);
-    // SPDLOG_INFO("Broadcasting data: {}", payload);
-    for (auto connection : connections_) {
-      try {
-        server_.send(connection, payload, websocketpp::frame::opcode::binary);
-      } catch (websocketpp::exception const& e) {
-        SPDLOG_ERROR("Send message failed because: {} ", e.what());
-        status = absl::InternalError(
-            absl::StrCat("Failed to send message: ", e.what()));
-      }
+  for (const std::shared_ptr<Outbound>& outbound : outbounds) {
+    Enqueue(outbound.get(), message);
+    status.Update(Flush(outbound));
+  }
+  send_latency->Record(trace::MonotonicNanos() - send_start);
+  return status;
+}
+
+absl::Status WebSocketServer::BroadcastFrame(
+    const data_dispatcher::SimFrame& frame) {
+  static trace::LatencyHistogram* const send_latency =
+      trace::GetLatencyHistogram(trace::Stage::kWsSend);
+  const int64_t send_start = trace::MonotonicNanos();
+  const std::vector<std::shared_ptr<Outbound>> outbounds = Outbounds();
+  FP_TRACE(kDebug, kWsBroadcast, outbounds.size(),
+           frame.SerializedData().size());
+  // One message per distinct subscription, by key.
+  absl::flat_hash_map<std::string, Server::message_ptr> messages;
+  absl::Status status;
+  for (const std::shared_ptr<Outbound>& outbound : outbounds) {
+    std::shared_ptr<const FieldSubscription> subscription;
+    {
+      absl::MutexLock l(&outbound->lock);
+      subscription = outbound->subscription;
+    }
+    Server::message_ptr& message = messages[subscription->key];
+    if (!message) {
+      // The whole frame is serialized once by the frame itself.
+      message = subscription->key.empty()
+                    ? PrepareMessage(frame.SerializedData())
+                    : PrepareMessage(ProjectFrame(frame.data(), *subscription));
     }
+    Enqueue(outbound.get(), message);
+    status.Update(Flush(outbound));
   }
+  send_latency->Record(trace::MonotonicNanos() - send_start);
   return status;
 }
 
-void SimDataBroadcaster::Run(absl::Duration delay) {
-  while (true) {
-    sim_data_ = ConvertSimData();
-    server_->Broadcast(sim_data_.SerializeAsString());
-    // server_->Broadcast("Hello world");
-    absl::SleepFor(delay);
+std::vector<std::shared_ptr<WebSocketServer::Outbound>>
+WebSocketServer::Outbounds() {
+  absl::ReaderMutexLock l(&connections_lock_);
+  std::vector<std::shared_ptr<Outbound>> outbounds;
+  outbounds.reserve(connections_.size());
+  for (const auto& entry : connections_) outbounds.push_back(entry.second);
+  return outbounds;
+}
+
+Server::message_ptr WebSocketServer::PrepareMessage(
+    const std::string& payload) {
+  // What websocketpp's RFC 6455 processor does for each send(): servers do
+  // not mask, so the frame is the same for every connection. The message
+  // has no manager, it is freed when the last connection sent it.
+  auto message = websocketpp::lib::make_shared<Server::message_type>(
+      Server::message_type::con_msg_man_ptr(),
+      websocketpp::frame::opcode::binary, 0);
+  websocketpp::frame::basic_header header(websocketpp::frame::opcode::binary,
+                                          payload.size(), /*fin=*/true,
+                                          /*mask=*/false);
+  websocketpp::frame::extended_header extended_header(payload.size());
+  message->set_header(
+      websocketpp::frame::prepare_header(header, extended_header));
+  message->set_payload(payload);
+  message->set_prepared(true);
+  return message;
+}
+
+void WebSocketServer::Enqueue(Outbound* outbound,
+                              const Server::message_ptr& message) {
+  absl::MutexLock l(&outbound->lock);
+  if (outbound->subscription->max_rate_hz > 0) {
+    // Waiting for its turn. Only the freshest message is worth sending then.
+    outbound->skipped += outbound->queue.size();
+    outbound->queue.clear();
+    outbound->queued_bytes = 0;
+  } else if (options_.outbound.policy == SlowClientPolicy::kKeepLatest) {
+    outbound->dropped += outbound->queue.size();
+    outbound->queue.clear();
+    outbound->queued_bytes = 0;
   }
+  outbound->queue.push_back(message);
+  outbound->queued_bytes += FrameSize(message);
+  // The newest message is always kept, even when it alone is over the limit.
+  while (outbound->queue.size() > 1 &&
+         (outbound->queue.size() > options_.outbound.max_queued_messages ||
+          outbound->queued_bytes > options_.outbound.max_queued_bytes)) {
+    outbound->queued_bytes -= FrameSize(outbound->queue.front());
+    outbound->queue.pop_front();
+    ++outbound->dropped;
+  }
+}
+
+absl::Status WebSocketServer::Flush(const std::shared_ptr<Outbound>& outbound) {
+  absl::MutexLock l(&outbound->lock);
+  websocketpp::lib::error_code error;
+  Server::connection_ptr connection =
+      server_.get_con_from_hdl(outbound->connection, error);
+  if (error) {
+    // Closing. ProcessEvents() removes it.
+    outbound->dropped += outbound->queue.size();
+    outbound->queue.clear();
+    outbound->queued_bytes = 0;
+    return absl::OkStatus();
+  }
+  absl::Status status;
+  const double max_rate_hz = outbound->subscription->max_rate_hz;
+  absl::Time now = absl::InfinitePast();
+  if (max_rate_hz > 0) now = absl::Now();
+  while (!outbound->queue.empty() && now >= outbound->next_send &&
+         connection->get_buffered_amount() <
+             options_.outbound.max_buffered_bytes) {
+    if (max_rate_hz > 0) {
+      outbound->next_send = now + absl::Seconds(1 / max_rate_hz);
+    }
+    const Server::message_ptr message = outbound->queue.front();
+    outbound->queue.pop_front();
+    outbound->queued_bytes -= FrameSize(message);
+    // The prepared message is queued as is, not framed or copied again.
+    error = connection->send(message);
+    if (error) {
+      SPDLOG_ERROR("Send message failed because: {} ", error.message());
+      status = absl::InternalError(
+          absl::StrCat("Failed to send message: ", error.message()));
+      ++outbound->dropped;
+    } else {
+      ++outbound->sent;
+    }
+  }
+  if (!outbound->queue.empty() && !outbound->retry_scheduled) {
+    // websocketpp does not say when the buffer drained, so look again soon.
+    outbound->retry_scheduled = true;
+    absl::Duration delay = options_.outbound.retry_interval;
+    // Or when the rate allows the next one.
+    if (max_rate_hz > 0) delay = std::max(delay, outbound->next_send - now);
+    std::weak_ptr<Outbound> weak_outbound = outbound;
+    server_.set_timer(
+        absl::ToInt64Milliseconds(absl::Ceil(delay, absl::Milliseconds(1))),
+        [this, weak_outbound](const websocketpp::lib::error_code&) {
+          std::shared_ptr<Outbound> outbound = weak_outbound.lock();
+          if (!outbound) return;
+          {
+            absl::MutexLock l(&outbound->lock);
+            outbound->retry_scheduled = false;
+          }
+          Flush(outbound).IgnoreError();
+        });
+  }
+  return status;
 }
-SimData SimDataBroadcaster::ConvertSimData() {
-  // produce fake data for debugging.
-  return FakeSimData();
+
+int WebSocketServer::ConnectionCount() {
+  absl::MutexLock l(&connections_lock_);
+  return connections_.size();
+}
+
+std::vector<ConnectionStats> WebSocketServer::GetConnectionStats() {
+  std::vector<ConnectionStats> all_stats;
+  for (const std::shared_ptr<Outbound>& outbound : Outbounds()) {
+    ConnectionStats stats;
+    websocketpp::lib::error_code error;
+    Server::connection_ptr connection =
+        server_.get_con_from_hdl(outbound->connection, error);
+    if (!error) {
+      stats.name = connection->get_remote_endpoint();
+      stats.buffered_bytes = connection->get_buffered_amount();
+    }
+    absl::MutexLock l(&outbound->lock);
+    stats.sent = outbound->sent;
+    stats.dropped = outbound->dropped;
+    stats.skipped = outbound->skipped;
+    stats.backlog = static_cast<int>(outbound->queue.size());
+    stats.backlog_bytes = outbound->queued_bytes;
+    all_stats.push_back(stats);
+  }
+  return all_stats;
 }
+
+absl::Status SimDataBroadcaster::Attach(
+    data_dispatcher::DataDispatcher* dispatcher, double max_rate_hz) {
+  data_dispatcher::RecipientOptions options;
+  options.name = "websocket";
+  // Clients want the latest snapshot, not every frame they missed.
+  options.overflow_policy = data_dispatcher::OverflowPolicy::kCoalesce;
+  options.max_rate_hz = max_rate_hz;
+  return dispatcher->AddFrameRecipient(
+      [this](data_dispatcher::SimFramePtr frame) {
+        return Broadcast(std::move(frame));
+      },
+      options);
+}
+
+absl::Status SimDataBroadcaster::Broadcast(
+    data_dispatcher::SimFramePtr frame) {
+  return server_->BroadcastFrame(*frame);
+}
+
 }  // namespace ws
 }  // namespace flight_panel
@@ -1,8 +1,14 @@
 #pragma once
 #define ASIO_STANDALONE
 
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
 #include <set>
+#include <string>
+#include <vector>
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
 
@@ -13,6 +19,9 @@
 #include "absl/time/time.h"
 #include "data_def/proto/sim_data.pb.h"
 #include "data_def/sim_vars.h"
+#include "data_dispatcher/data_dispatcher.h"
+#include "data_dispatcher/sim_frame.h"
+#include "websocket_server/field_subscription.h"
 
 namespace flight_panel {
 namespace ws {
@@ -40,15 +49,78 @@ struct WSEvent {
   Server::message_ptr message;
 };
 
+// What a connection's outbound queue does when it is full.
+enum class SlowClientPolicy {
+  // Drop the oldest queued message to make room.
+  kDropOldest,
+  // Keep only the latest message. A newer snapshot makes the older ones
+  // useless, so a slow client only ever gets the freshest one.
+  kKeepLatest,
+};
+
+// Limits of the outbound queue of each connection. Broadcast() hands a
+// message to websocketpp while less than max_buffered_bytes wait in the
+// connection's send buffer. The other messages wait in the queue, which
+// drops by policy past max_queued_messages or max_queued_bytes.
+struct OutboundOptions {
+  SlowClientPolicy policy = SlowClientPolicy::kDropOldest;
+  size_t max_queued_messages = 8;
+  size_t max_queued_bytes = 1 << 20;
+  size_t max_buffered_bytes = 256 << 10;
+  // How soon a connection with queued messages is tried again, when no
+  // broadcast comes first.
+  absl::Duration retry_interval = absl::Milliseconds(5);
+};
+
+struct ServerOptions {
+  // Threads running the server's io_context. Each does accepts, handshakes,
+  // reads and writes for any connection; a connection's handlers are
+  // serialized by its strand.
+  int io_threads = 1;
+  OutboundOptions outbound;
+};
+
+// Counters of a single connection.
+struct ConnectionStats {
+  // The remote endpoint.
+  std::string name;
+  // Messages handed to websocketpp.
+  int64_t sent = 0;
+  // Messages dropped because the client was too slow.
+  int64_t dropped = 0;
+  // Messages replaced by a newer one to keep to the subscribed rate.
+  int64_t skipped = 0;
+  // Messages and bytes waiting in the queue.
+  int backlog = 0;
+  size_t backlog_bytes = 0;
+  // Bytes waiting in websocketpp's send buffer.
+  size_t buffered_bytes = 0;
+};
+
 // A websocket server to broadcast Sim data.
 class WebSocketServer {
  public:
-  WebSocketServer();
+  explicit WebSocketServer(ServerOptions options = ServerOptions());
 
-  // Listen to port and run the Ws server
+  // Listen to port and run the Ws server on ServerOptions::io_threads
+  // threads, this one included. Returns when they all stopped.
   void Run(uint16_t port);
+  // Queues the payload for every connection and sends what their send
+  // buffers have room for. Never waits for a client: the cost does not
+  // depend on how slow the slowest one is. Every connection gets the payload
+  // as is, whatever fields it subscribed to.
   absl::Status Broadcast(const std::string& payload)
       LOCKS_EXCLUDED(connections_lock_);
+  // Like Broadcast(), but each connection gets the fields of the frame it
+  // subscribed to. Each distinct subscription is projected, serialized and
+  // framed once, and shared by the connections that have it.
+  absl::Status BroadcastFrame(const data_dispatcher::SimFrame& frame)
+      LOCKS_EXCLUDED(connections_lock_);
+  // Number of open connections that receive broadcasts.
+  int ConnectionCount() LOCKS_EXCLUDED(connections_lock_);
+  // Stats of every open connection.
+  std::vector<ConnectionStats> GetConnectionStats()
+      LOCKS_EXCLUDED(connections_lock_);
   // Loop that processes incoming connections and messages.
   void ProcessEvents();
 
@@ -57,35 +129,82 @@ class WebSocketServer {
                  Server::message_ptr message);
   void OnOpen(websocketpp::connection_hdl connection);
   void OnClose(websocketpp::connection_hdl connection);
+  // Refuses hybi00 clients. They have no binary frames, and broadcasts are
+  // sent as prepared RFC 6455 frames.
+  bool OnValidate(websocketpp::connection_hdl connection);
 
-  void HandleMessage(Server::message_ptr message);
+  // Applies a subscribe message from the client.
+  void HandleMessage(websocketpp::connection_hdl connection,
+                     Server::message_ptr message)
+      LOCKS_EXCLUDED(connections_lock_);
 
   void PushNewEvent(const WSEvent& evt) LOCKS_EXCLUDED(events_lock_);
 
+  // A connection and the messages waiting for its send buffer to drain.
+  struct Outbound {
+    explicit Outbound(websocketpp::connection_hdl hdl) : connection(hdl) {}
+
+    const websocketpp::connection_hdl connection;
+    absl::Mutex lock;
+    std::deque<Server::message_ptr> queue GUARDED_BY(lock);
+    size_t queued_bytes GUARDED_BY(lock) = 0;
+    int64_t sent GUARDED_BY(lock) = 0;
+    int64_t dropped GUARDED_BY(lock) = 0;
+    int64_t skipped GUARDED_BY(lock) = 0;
+    bool retry_scheduled GUARDED_BY(lock) = false;
+    // Replaced, never changed, so broadcasts can hold on to it after they
+    // let go of the lock.
+    std::shared_ptr<const FieldSubscription> subscription GUARDED_BY(lock) =
+        std::make_shared<FieldSubscription>();
+    // With a max rate, the next message is not sent before this.
+    absl::Time next_send GUARDED_BY(lock) = absl::InfinitePast();
+  };
+  using OutboundMap =
+      std::map<websocketpp::connection_hdl, std::shared_ptr<Outbound>,
+               std::owner_less<websocketpp::connection_hdl>>;
+
+  // The queues of every connection, copied so nothing is sent under
+  // connections_lock_.
+  std::vector<std::shared_ptr<Outbound>> Outbounds()
+      LOCKS_EXCLUDED(connections_lock_);
+  // Frames the payload once into a message every connection can send as is.
+  static Server::message_ptr PrepareMessage(const std::string& payload);
+  // Adds the message to the queue, dropping by policy. A rate limited
+  // connection only keeps the latest message.
+  void Enqueue(Outbound* outbound, const Server::message_ptr& message);
+  // Sends queued messages while the send buffer has room and the subscribed
+  // rate allows. Schedules a retry for the rest.
+  absl::Status Flush(const std::shared_ptr<Outbound>& outbound);
+
+  const ServerOptions options_;
   // The WS server.
   Server server_;
   std::queue<WSEvent> events_ GUARDED_BY(events_lock_);
   // Stores all connections.
-  ConnectionSet connections_ GUARDED_BY(connections_lock_);
+  OutboundMap connections_ GUARDED_BY(connections_lock_);
   // Mutex lock for connections_
   absl::Mutex connections_lock_;
   absl::Mutex events_lock_;
 };
 
+// Broadcasts the frames a DataDispatcher publishes to every WebSocket client,
+// as soon as each one is published. Nothing is sent while the sim is idle.
 class SimDataBroadcaster {
  public:
-  SimDataBroadcaster(std::unique_ptr<WebSocketServer> server,
-                     const data::SimVars* const sim_vars)
-      : server_(std::move(server)), sim_vars_(sim_vars){};
+  // Does not own the server, which must outlive the dispatcher it is
+  // attached to.
+  explicit SimDataBroadcaster(WebSocketServer* server) : server_(server){};
 
-  void Run(absl::Duration delay = absl::Milliseconds(10));
+  // Adds the broadcaster as a recipient of `dispatcher`. With `max_rate_hz`
+  // above 0, frames are skipped so that at most that many are sent per
+  // second, and the one sent is always the latest.
+  absl::Status Attach(data_dispatcher::DataDispatcher* dispatcher,
+                      double max_rate_hz = 0);
 
  private:
-  // Converts simvar struct into SimData proto.
-  SimData ConvertSimData();
-  SimData sim_data_;
-  std::unique_ptr<WebSocketServer> server_;
-  const data::SimVars* const sim_vars_;
+  absl::Status Broadcast(data_dispatcher::SimFramePtr frame);
+
+  WebSocketServer* const server_;
 };
 
 }  // namespace ws
@@ -0,0 +1,85 @@
+#include "websocket_server/field_subscription.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace flight_panel {
+namespace ws {
+namespace {
+using ::testing::ElementsAre;
+
+SimData TestData() {
+  SimData data;
+  data.mutable_instruments()->set_indicated_airspeed(120);
+  data.mutable_instruments()->set_bank_angle(15);
+  data.mutable_nav_data()->mutable_hsi_1()->set_course(90);
+  data.mutable_nav_data()->mutable_hsi_2()->set_course(180);
+  data.mutable_aircraft_info()->set_call_sign("AXSGS");
+  data.mutable_game_data()->set_connected(true);
+  return data;
+}
+
+TEST(FieldSubscriptionTest, TestParseCanonicalizesPaths) {
+  auto subscription = ParseSubscription(
+      "subscribe nav_data.hsi_1,instruments,nav_data.hsi_1.course 30");
+  ASSERT_TRUE(subscription.ok()) << subscription.status();
+  EXPECT_THAT(subscription->fields.paths(),
+              ElementsAre("instruments", "nav_data.hsi_1"));
+  EXPECT_EQ(subscription->key, "instruments,nav_data.hsi_1");
+  EXPECT_EQ(subscription->max_rate_hz, 30);
+}
+
+TEST(FieldSubscriptionTest, TestSameFieldsShareKey) {
+  auto first = ParseSubscription("subscribe instruments,game_data");
+  auto second = ParseSubscription("subscribe  game_data,instruments ");
+  ASSERT_TRUE(first.ok());
+  ASSERT_TRUE(second.ok());
+  EXPECT_EQ(first->key, second->key);
+  EXPECT_EQ(first->max_rate_hz, 0);
+}
+
+TEST(FieldSubscriptionTest, TestParseAllFields) {
+  auto subscription = ParseSubscription("subscribe * 10");
+  ASSERT_TRUE(subscription.ok());
+  EXPECT_EQ(subscription->fields.paths_size(), 0);
+  EXPECT_EQ(subscription->key, "");
+  EXPECT_EQ(subscription->max_rate_hz, 10);
+}
+
+TEST(FieldSubscriptionTest, TestParseRejectsMalformedMessages) {
+  for (const char* message :
+       {"", "hello", "subscribe", "subscribe instruments 10 20",
+        "unsubscribe instruments", "subscribe autopilot",
+        "subscribe instruments.flaps", "subscribe ,",
+        "subscribe instruments fast", "subscribe instruments -1"}) {
+    EXPECT_EQ(ParseSubscription(message).status().code(),
+              absl::StatusCode::kInvalidArgument)
+        << message;
+  }
+}
+
+TEST(FieldSubscriptionTest, TestProjectKeepsSubscribedFields) {
+  auto subscription =
+      ParseSubscription("subscribe instruments.bank_angle,nav_data.hsi_1");
+  ASSERT_TRUE(subscription.ok());
+  SimData projection;
+  ASSERT_TRUE(
+      projection.ParseFromString(ProjectFrame(TestData(), *subscription)));
+  EXPECT_EQ(projection.instruments().bank_angle(), 15);
+  EXPECT_EQ(projection.instruments().indicated_airspeed(), 0);
+  EXPECT_EQ(projection.nav_data().hsi_1().course(), 90);
+  EXPECT_FALSE(projection.nav_data().has_hsi_2());
+  EXPECT_FALSE(projection.has_aircraft_info());
+  EXPECT_FALSE(projection.has_game_data());
+}
+
+TEST(FieldSubscriptionTest, TestProjectAllFieldsIsWholeFrame) {
+  auto subscription = ParseSubscription("subscribe *");
+  ASSERT_TRUE(subscription.ok());
+  const SimData data = TestData();
+  EXPECT_EQ(ProjectFrame(data, *subscription), data.SerializeAsString());
+}
+
+}  // namespace
+}  // namespace ws
+}  // namespace flight_panel
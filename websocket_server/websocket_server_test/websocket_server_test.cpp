@@ -0,0 +1,441 @@
+#include "websocket_server/websocket_server.h"
+
+#include <atomic>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "data_def/sim_vars.h"
+#include "data_dispatcher/data_dispatcher.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include <websocketpp/client.hpp>
+#include <websocketpp/config/asio_no_tls_client.hpp>
+
+namespace flight_panel {
+namespace ws {
+namespace {
+using ::testing::HasSubstr;
+using ::testing::Le;
+using ::testing::Not;
+using ::testing::SizeIs;
+
+using Client = websocketpp::client<websocketpp::config::asio_client>;
+
+// Every test gets its own server, servers have no way to stop.
+uint16_t NextPort() {
+  static std::atomic<int> port{18280};
+  return static_cast<uint16_t>(port++);
+}
+
+// Starts a server on `port`. It and its threads live until the test binary
+// exits.
+WebSocketServer* StartServer(uint16_t port,
+                             ServerOptions options = ServerOptions()) {
+  auto* server = new WebSocketServer(options);
+  std::thread(&WebSocketServer::Run, server, port).detach();
+  std::thread(&WebSocketServer::ProcessEvents, server).detach();
+  return server;
+}
+
+// Polls `done` until it returns true or `timeout` passed.
+bool WaitFor(const std::function<bool()>& done,
+             absl::Duration timeout = absl::Seconds(10)) {
+  const absl::Time deadline = absl::Now() + timeout;
+  while (!done()) {
+    if (absl::Now() > deadline) return false;
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  return true;
+}
+
+bool WaitForConnections(WebSocketServer* server, int count) {
+  return WaitFor(
+      [server, count] { return server->ConnectionCount() == count; });
+}
+
+// In-process clients that keep every message they receive. The first
+// `stalled` clients stop reading once connected, and shrink their receive
+// buffer so the server's send buffer fills up sooner. Clients retry until
+// the server listens.
+class TestClients {
+ public:
+  TestClients(uint16_t port, int count, int stalled = 0)
+      : uri_(absl::StrCat("ws://localhost:", port)), slots_(count) {
+    client_.clear_access_channels(websocketpp::log::alevel::all);
+    client_.clear_error_channels(websocketpp::log::elevel::all);
+    client_.init_asio();
+    client_.start_perpetual();
+    for (int i = 0; i < count; ++i) Connect(i, i < stalled);
+    thread_ = std::thread([this] { client_.run(); });
+  }
+
+  ~TestClients() {
+    for (Slot& slot : slots_) {
+      absl::MutexLock l(&slot.lock);
+      if (!slot.connection) continue;
+      websocketpp::lib::error_code error;
+      slot.connection->close(websocketpp::close::status::going_away, "",
+                             error);
+    }
+    client_.stop_perpetual();
+    client_.stop();
+    thread_.join();
+  }
+
+  // Messages received by client `i`.
+  std::vector<std::string> received(int i) {
+    absl::MutexLock l(&slots_[i].lock);
+    return slots_[i].received;
+  }
+  int received_count(int i) {
+    absl::MutexLock l(&slots_[i].lock);
+    return static_cast<int>(slots_[i].received.size());
+  }
+
+  // Lets a stalled client read again.
+  void Resume(int i) {
+    absl::MutexLock l(&slots_[i].lock);
+    slots_[i].connection->resume_reading();
+  }
+
+ private:
+  struct Slot {
+    absl::Mutex lock;
+    Client::connection_ptr connection GUARDED_BY(lock);
+    std::vector<std::string> received GUARDED_BY(lock);
+  };
+
+  void Connect(int i, bool stalled) {
+    websocketpp::lib::error_code error;
+    Client::connection_ptr connection = client_.get_connection(uri_, error);
+    if (error) return;
+    connection->set_message_handler(
+        [this, i](websocketpp::connection_hdl, Client::message_ptr message) {
+          absl::MutexLock l(&slots_[i].lock);
+          slots_[i].received.push_back(message->get_payload());
+        });
+    connection->set_fail_handler(
+        [this, i, stalled](websocketpp::connection_hdl) {
+          // Not listening yet.
+          client_.set_timer(
+              10, [this, i, stalled](const websocketpp::lib::error_code&) {
+                Connect(i, stalled);
+              });
+        });
+    if (stalled) {
+      connection->set_socket_init_handler(
+          [](websocketpp::connection_hdl,
+             websocketpp::lib::asio::ip::tcp::socket& socket) {
+            socket.set_option(
+                websocketpp::lib::asio::socket_base::receive_buffer_size(
+                    16 << 10));
+          });
+      connection->set_open_handler([this, i](websocketpp::connection_hdl) {
+        absl::MutexLock l(&slots_[i].lock);
+        slots_[i].connection->pause_reading();
+      });
+    }
+    {
+      absl::MutexLock l(&slots_[i].lock);
+      slots_[i].connection = connection;
+    }
+    client_.connect(connection);
+  }
+
+  const std::string uri_;
+  Client client_;
+  std::vector<Slot> slots_;
+  std::thread thread_;
+};
+
+// The status line of the reply to a hybi00 handshake, the example of
+// draft-ietf-hybi-thewebsocketprotocol-00.
+std::string Hybi00Handshake(uint16_t port) {
+  namespace asio = websocketpp::lib::asio;
+  asio::io_service io_service;
+  asio::ip::tcp::socket socket(io_service);
+  const asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(),
+                                         port);
+  asio::error_code error;
+  // Not listening yet.
+  if (!WaitFor([&] {
+        socket.close(error);
+        socket.connect(endpoint, error);
+        return !error;
+      })) {
+    return "";
+  }
+  const std::string request =
+      "GET / HTTP/1.1\r\n"
+      "Host: localhost\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: WebSocket\r\n"
+      "Origin: http://localhost\r\n"
+      "Sec-WebSocket-Key1: 4 @1  46546xW%0l 1 5\r\n"
+      "Sec-WebSocket-Key2: 12998 5 Y3 1  .P00\r\n"
+      "\r\n"
+      "^n:ds[4U";
+  asio::write(socket, asio::buffer(request), error);
+  if (error) return "";
+  asio::streambuf reply;
+  asio::read_until(socket, reply, "\r\n", error);
+  if (error) return "";
+  std::istream stream(&reply);
+  std::string status_line;
+  std::getline(stream, status_line);
+  return status_line;
+}
+
+// A payload of `size` bytes that starts with `index`.
+std::string Payload(int index, size_t size) {
+  std::string payload = absl::StrCat(index, ":");
+  payload.resize(size, static_cast<char>('a' + index % 26));
+  return payload;
+}
+
+constexpr int kReaders = 2;
+constexpr int kBroadcasts = 200;
+constexpr size_t kPayloadSize = 128 << 10;
+// Payload plus the largest RFC 6455 server frame header.
+constexpr size_t kFrameSize = kPayloadSize + 10;
+
+// Stats of the connections with and without drops.
+struct StalledRun {
+  std::vector<ConnectionStats> dropping;
+  std::vector<ConnectionStats> others;
+};
+
+// Broadcasts kBroadcasts payloads to kReaders clients that read everything
+// and one that stopped reading, and checks the readers got every payload in
+// order. Each payload is sent once the readers got the previous one.
+StalledRun RunStalledClient(WebSocketServer* server, TestClients* clients) {
+  StalledRun run;
+  std::vector<std::string> sent;
+  for (int i = 0; i < kBroadcasts; ++i) {
+    sent.push_back(Payload(i, kPayloadSize));
+    EXPECT_TRUE(server->Broadcast(sent.back()).ok());
+    EXPECT_TRUE(WaitFor([clients, i] {
+      for (int reader = 1; reader <= kReaders; ++reader) {
+        if (clients->received_count(reader) <= i) return false;
+      }
+      return true;
+    })) << "Readers missed payload " << i;
+  }
+  for (int reader = 1; reader <= kReaders; ++reader) {
+    // Not EXPECT_EQ, which would print megabytes of payloads.
+    EXPECT_TRUE(clients->received(reader) == sent) << "Reader " << reader;
+  }
+  for (const ConnectionStats& stats : server->GetConnectionStats()) {
+    (stats.dropped > 0 ? run.dropping : run.others).push_back(stats);
+  }
+  return run;
+}
+
+void ExpectDrained(WebSocketServer* server, TestClients* clients,
+                   const ConnectionStats& stalled) {
+  clients->Resume(0);
+  // No more broadcasts come, the retry timer sends the rest.
+  EXPECT_TRUE(WaitFor([server] {
+    for (const ConnectionStats& stats : server->GetConnectionStats()) {
+      if (stats.backlog > 0) return false;
+    }
+    return true;
+  }));
+  EXPECT_TRUE(WaitFor([server, clients] {
+    for (const ConnectionStats& stats : server->GetConnectionStats()) {
+      if (stats.dropped > 0 && clients->received_count(0) == stats.sent) {
+        return true;
+      }
+    }
+    return false;
+  }));
+  EXPECT_GE(clients->received_count(0), stalled.sent);
+}
+
+TEST(WebSocketServerTest, TestStalledClientDropsOldest) {
+  const uint16_t port = NextPort();
+  ServerOptions options;
+  options.outbound.policy = SlowClientPolicy::kDropOldest;
+  options.outbound.max_queued_messages = 4;
+  options.outbound.max_buffered_bytes = 256 << 10;
+  WebSocketServer* server = StartServer(port, options);
+  TestClients clients(port, kReaders + 1, /*stalled=*/1);
+  ASSERT_TRUE(WaitForConnections(server, kReaders + 1));
+
+  const StalledRun run = RunStalledClient(server, &clients);
+  ASSERT_THAT(run.dropping, SizeIs(1));
+  const ConnectionStats& stalled = run.dropping[0];
+  EXPECT_THAT(stalled.backlog, Le(4));
+  EXPECT_THAT(stalled.backlog_bytes, Le(4 * kFrameSize));
+  // A send is only started below the limit, so one frame can go over it.
+  EXPECT_THAT(stalled.buffered_bytes, Le((256 << 10) + kFrameSize));
+  EXPECT_EQ(stalled.sent + stalled.dropped + stalled.backlog, kBroadcasts);
+  for (const ConnectionStats& stats : run.others) {
+    EXPECT_EQ(stats.sent, kBroadcasts);
+    EXPECT_EQ(stats.backlog, 0);
+  }
+  ExpectDrained(server, &clients, stalled);
+}
+
+TEST(WebSocketServerTest, TestStalledClientQueueIsCappedInBytes) {
+  const uint16_t port = NextPort();
+  ServerOptions options;
+  options.outbound.policy = SlowClientPolicy::kDropOldest;
+  options.outbound.max_queued_messages = 100;
+  options.outbound.max_queued_bytes = 3 * kFrameSize;
+  WebSocketServer* server = StartServer(port, options);
+  TestClients clients(port, kReaders + 1, /*stalled=*/1);
+  ASSERT_TRUE(WaitForConnections(server, kReaders + 1));
+
+  const StalledRun run = RunStalledClient(server, &clients);
+  ASSERT_THAT(run.dropping, SizeIs(1));
+  EXPECT_THAT(run.dropping[0].backlog, Le(3));
+  EXPECT_THAT(run.dropping[0].backlog_bytes, Le(3 * kFrameSize));
+  ExpectDrained(server, &clients, run.dropping[0]);
+}
+
+TEST(WebSocketServerTest, TestStalledClientKeepsLatest) {
+  const uint16_t port = NextPort();
+  ServerOptions options;
+  options.outbound.policy = SlowClientPolicy::kKeepLatest;
+  WebSocketServer* server = StartServer(port, options);
+  TestClients clients(port, kReaders + 1, /*stalled=*/1);
+  ASSERT_TRUE(WaitForConnections(server, kReaders + 1));
+
+  const StalledRun run = RunStalledClient(server, &clients);
+  ASSERT_THAT(run.dropping, SizeIs(1));
+  const ConnectionStats& stalled = run.dropping[0];
+  EXPECT_THAT(stalled.backlog, Le(1));
+  EXPECT_EQ(stalled.sent + stalled.dropped + stalled.backlog, kBroadcasts);
+  ExpectDrained(server, &clients, stalled);
+  // The last payload it got is the last one broadcast.
+  const std::vector<std::string> received = clients.received(0);
+  ASSERT_FALSE(received.empty());
+  EXPECT_EQ(received.back(), Payload(kBroadcasts - 1, kPayloadSize));
+}
+
+TEST(WebSocketServerTest, TestBroadcastFramesEveryPayloadLength) {
+  const uint16_t port = NextPort();
+  WebSocketServer* server = StartServer(port);
+  TestClients clients(port, 1);
+  ASSERT_TRUE(WaitForConnections(server, 1));
+
+  // The 7 bit, 16 bit and 64 bit payload lengths of RFC 6455, at their
+  // edges.
+  std::vector<std::string> sent;
+  for (size_t size : {0, 125, 126, 65535, 65536, 70000}) {
+    std::string payload(size, '\0');
+    for (size_t i = 0; i < size; ++i) payload[i] = static_cast<char>(i * 7);
+    sent.push_back(payload);
+    EXPECT_TRUE(server->Broadcast(payload).ok());
+    const int count = static_cast<int>(sent.size());
+    ASSERT_TRUE(WaitFor(
+        [&clients, count] { return clients.received_count(0) == count; }))
+        << "Payload of " << size << " bytes not received";
+  }
+  const std::vector<std::string> received = clients.received(0);
+  ASSERT_EQ(received.size(), sent.size());
+  for (size_t i = 0; i < sent.size(); ++i) {
+    EXPECT_TRUE(received[i] == sent[i])
+        << "Payload of " << sent[i].size() << " bytes received as "
+        << received[i].size() << " bytes";
+  }
+}
+
+TEST(WebSocketServerTest, TestRefusesHybi00Clients) {
+  const uint16_t port = NextPort();
+  WebSocketServer* server = StartServer(port);
+  const std::string status_line = Hybi00Handshake(port);
+  EXPECT_THAT(status_line, HasSubstr("HTTP/1.1"));
+  EXPECT_THAT(status_line, Not(HasSubstr(" 101 ")));
+  EXPECT_EQ(server->ConnectionCount(), 0);
+}
+
+TEST(SimDataBroadcasterTest, TestSendsNothingWhileIdle) {
+  const uint16_t port = NextPort();
+  WebSocketServer* server = StartServer(port);
+  TestClients clients(port, 1);
+  ASSERT_TRUE(WaitForConnections(server, 1));
+  data_dispatcher::DispatcherOptions options;
+  options.suppress_unchanged = true;
+  options.heartbeat_interval = absl::InfiniteDuration();
+  std::unique_ptr<data_dispatcher::DataDispatcher> dispatcher =
+      data_dispatcher::CreateDispatcher(options);
+  SimDataBroadcaster broadcaster(server);
+  ASSERT_TRUE(broadcaster.Attach(dispatcher.get(), /*max_rate_hz=*/20).ok());
+  dispatcher->Start();
+
+  absl::SleepFor(absl::Milliseconds(100));
+  EXPECT_EQ(clients.received_count(0), 0);
+  // A paused sim keeps sending the same values.
+  data::SimVars data;
+  data.adiBank = 10;
+  for (int i = 0; i < 10; ++i) {
+    dispatcher->Notify(data);
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  EXPECT_TRUE(WaitFor([&dispatcher] {
+    const data_dispatcher::DispatcherStats stats = dispatcher->Stats();
+    return stats.dispatched + stats.suppressed == 10;
+  }));
+  dispatcher->Stop();
+
+  EXPECT_EQ(dispatcher->Stats().dispatched, 1);
+  EXPECT_TRUE(WaitFor([&clients] { return clients.received_count(0) == 1; }));
+  absl::SleepFor(absl::Milliseconds(50));
+  EXPECT_EQ(clients.received_count(0), 1);
+  ASSERT_THAT(server->GetConnectionStats(), SizeIs(1));
+  EXPECT_EQ(server->GetConnectionStats()[0].sent, 1);
+}
+
+TEST(SimDataBroadcasterTest, TestSendsAtMostMaxRate) {
+  constexpr double kMaxRateHz = 20;
+  const uint16_t port = NextPort();
+  WebSocketServer* server = StartServer(port);
+  TestClients clients(port, 1);
+  ASSERT_TRUE(WaitForConnections(server, 1));
+  std::unique_ptr<data_dispatcher::DataDispatcher> dispatcher =
+      data_dispatcher::CreateDispatcher();
+  SimDataBroadcaster broadcaster(server);
+  ASSERT_TRUE(broadcaster.Attach(dispatcher.get(), kMaxRateHz).ok());
+  dispatcher->Start();
+
+  // A changed frame every 2 ms or more, for at least 15 intervals.
+  constexpr int kFrames = 375;
+  const absl::Time start = absl::Now();
+  data::SimVars data;
+  for (int i = 1; i <= kFrames; ++i) {
+    data.adiBank = i % 90;
+    dispatcher->Notify(data);
+    absl::SleepFor(absl::Milliseconds(2));
+  }
+  EXPECT_TRUE(WaitFor([&dispatcher] {
+    const data_dispatcher::DispatcherStats stats = dispatcher->Stats();
+    return stats.dispatched + stats.skipped == kFrames;
+  }));
+  const absl::Duration elapsed = absl::Now() - start;
+  dispatcher->Stop();
+
+  ASSERT_THAT(server->GetConnectionStats(), SizeIs(1));
+  const int64_t sent = server->GetConnectionStats()[0].sent;
+  EXPECT_TRUE(WaitFor([&clients, sent] {
+    return clients.received_count(0) == sent;
+  }));
+  // The first frame goes out right away, then one per interval.
+  EXPECT_THAT(sent, Le(static_cast<int64_t>(
+                        absl::ToDoubleSeconds(elapsed) * kMaxRateHz) +
+                    1));
+  EXPECT_GE(sent, 2);
+  EXPECT_GT(dispatcher->Stats().skipped, 0);
+}
+
+}  // namespace
+}  // namespace ws
+}  // namespace flight_panel